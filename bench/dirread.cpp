@@ -0,0 +1,376 @@
+/*	NAME:
+		dirread.cpp
+
+	DESCRIPTION:
+		Directory listing benchmark.
+
+		Lists a directory the way FUSE asks logfuse for it, a batch of entries
+		per readdir call, through a DIR stream and through the getdents64
+		reader used by logfuse on Linux.
+
+		Each listing is run sequentially, where each call resumes at the
+		offset returned for the last entry of the previous one, and with a
+		seek before every call, as happens when the kernel asks for an offset
+		the handle is not at.
+
+	USAGE:
+		g++ -std=c++14 -O2 -o dirread bench/dirread.cpp
+		./dirread --create /tmp/dirread 1000000
+		./dirread /tmp/dirread 5
+
+	COPYRIGHT:
+		Copyright (c) 2017-2019, refNum Software
+		All rights reserved.
+
+		Redistribution and use in source and binary forms, with or without
+		modification, are permitted provided that the following conditions
+		are met:
+
+		1. Redistributions of source code must retain the above copyright
+		notice, this list of conditions and the following disclaimer.
+
+		2. Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		3. Neither the name of the copyright holder nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+		THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+		"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+		LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+		A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+		HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+		SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+		LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+		DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+		THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+		(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+		OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+	__________________________________________________________________________
+*/
+//============================================================================
+//		Include files
+//----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <new>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+
+
+
+
+//============================================================================
+//		Internal constants
+//----------------------------------------------------------------------------
+enum {
+	kEntriesPerCall													= 100,
+	kDirReadBufferMin												= 4 * 1024,
+	kDirReadBufferMax												= 256 * 1024
+};
+
+
+
+
+
+//============================================================================
+//		Internal types
+//----------------------------------------------------------------------------
+// Directory reader
+//
+// Matches the Linux logfuse_dir_info.
+struct dirread_reader {
+	int							fd;
+	std::unique_ptr<char[]>		buffer;
+	size_t						bufferAlloc;
+	size_t						bufferPos;
+	size_t						bufferSize;
+};
+
+
+
+
+
+//============================================================================
+//		Internal globals
+//----------------------------------------------------------------------------
+static volatile size_t gSink;
+
+
+
+
+
+//============================================================================
+//		Internal functions
+//----------------------------------------------------------------------------
+//		dirread_read : Read the next directory entry.
+//----------------------------------------------------------------------------
+static dirent *dirread_read(dirread_reader &theReader)
+{	size_t		newAlloc;
+	char		*newBuffer;
+	dirent		*theEntry;
+	long		sysErr;
+
+
+
+	// Read the entry
+	//
+	// As logfuse_dir_read.
+	if (theReader.bufferPos >= theReader.bufferSize)
+		{
+		if (theReader.bufferAlloc < kDirReadBufferMax && theReader.bufferSize >= theReader.bufferAlloc / 2)
+			{
+			newAlloc  = std::max((size_t) kDirReadBufferMin, theReader.bufferAlloc * 2);
+			newBuffer = new (std::nothrow) char[newAlloc];
+
+			if (newBuffer != nullptr)
+				{
+				theReader.buffer.reset(newBuffer);
+				theReader.bufferAlloc = newAlloc;
+				}
+			}
+
+		if (theReader.bufferAlloc == 0)
+			return(nullptr);
+
+		sysErr = syscall(SYS_getdents64, theReader.fd, theReader.buffer.get(), theReader.bufferAlloc);
+		if (sysErr <= 0)
+			{
+			theReader.bufferPos  = 0;
+			theReader.bufferSize = 0;
+			return(nullptr);
+			}
+
+		theReader.bufferPos  = 0;
+		theReader.bufferSize = (size_t) sysErr;
+		}
+
+	theEntry = (dirent *) &theReader.buffer[theReader.bufferPos];
+	theReader.bufferPos += theEntry->d_reclen;
+
+	return(theEntry);
+}
+
+
+
+
+
+//============================================================================
+//		dirread_seek : Seek to a directory offset.
+//----------------------------------------------------------------------------
+static void dirread_seek(dirread_reader &theReader, off_t offset)
+{
+
+
+	// Seek to the offset
+	//
+	// As logfuse_dir_seek.
+	lseek(theReader.fd, offset, SEEK_SET);
+
+	theReader.buffer.reset();
+	theReader.bufferAlloc = 0;
+	theReader.bufferPos   = 0;
+	theReader.bufferSize  = 0;
+}
+
+
+
+
+
+//============================================================================
+//		dirread_list_stream : List a directory through a DIR stream.
+//----------------------------------------------------------------------------
+static double dirread_list_stream(const char *thePath, bool seekEach)
+{	auto		startTime = std::chrono::steady_clock::now();
+	off_t		theOffset = 0;
+	off_t		dirOffset = 0;
+	size_t		numEntries;
+	dirent		*theEntry;
+	DIR			*theDir;
+
+
+
+	// List the directory
+	//
+	// A call seeks when the offset it is asked for is not where the stream
+	// is, as logfuse_readdir did before the getdents64 reader.
+	theDir = opendir(thePath);
+	if (theDir == nullptr)
+		return(-1.0);
+
+	do
+		{
+		if (seekEach || theOffset != dirOffset)
+			seekdir(theDir, theOffset);
+
+		for (numEntries = 0; numEntries < kEntriesPerCall; numEntries++)
+			{
+			theEntry = readdir(theDir);
+			if (theEntry == nullptr)
+				break;
+
+			gSink     += (size_t) theEntry->d_name[0];
+			theOffset  = telldir(theDir);
+			}
+
+		dirOffset = theOffset;
+		}
+	while (numEntries == kEntriesPerCall);
+
+	closedir(theDir);
+
+	return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+}
+
+
+
+
+
+//============================================================================
+//		dirread_list_reader : List a directory through the getdents64 reader.
+//----------------------------------------------------------------------------
+static double dirread_list_reader(const char *thePath, bool seekEach)
+{	auto				startTime = std::chrono::steady_clock::now();
+	off_t				theOffset = 0;
+	off_t				dirOffset = 0;
+	dirread_reader		theReader;
+	size_t				numEntries;
+	dirent				*theEntry;
+
+
+
+	// List the directory
+	theReader.fd          = open(thePath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	theReader.bufferAlloc = 0;
+	theReader.bufferPos   = 0;
+	theReader.bufferSize  = 0;
+
+	if (theReader.fd == -1)
+		return(-1.0);
+
+	do
+		{
+		if (seekEach || theOffset != dirOffset)
+			dirread_seek(theReader, theOffset);
+
+		for (numEntries = 0; numEntries < kEntriesPerCall; numEntries++)
+			{
+			theEntry = dirread_read(theReader);
+			if (theEntry == nullptr)
+				break;
+
+			gSink     += (size_t) theEntry->d_name[0];
+			theOffset  = theEntry->d_off;
+			}
+
+		dirOffset = theOffset;
+		}
+	while (numEntries == kEntriesPerCall);
+
+	close(theReader.fd);
+
+	return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+}
+
+
+
+
+
+//============================================================================
+//		dirread_create : Create a directory of empty files.
+//----------------------------------------------------------------------------
+static int dirread_create(const char *thePath, long numFiles)
+{	char		theName[32];
+	int			dirFd;
+	int			fd;
+
+
+
+	// Create the files
+	if (mkdir(thePath, 0755) != 0 && errno != EEXIST)
+		{
+		fprintf(stderr, "dirread: unable to create '%s': %s\n", thePath, strerror(errno));
+		return(1);
+		}
+
+	dirFd = open(thePath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd == -1)
+		{
+		fprintf(stderr, "dirread: unable to open '%s': %s\n", thePath, strerror(errno));
+		return(1);
+		}
+
+	for (long n = 0; n < numFiles; n++)
+		{
+		snprintf(theName, sizeof(theName), "f%07ld", n);
+
+		fd = openat(dirFd, theName, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (fd == -1)
+			{
+			fprintf(stderr, "dirread: unable to create '%s': %s\n", theName, strerror(errno));
+			close(dirFd);
+			return(1);
+			}
+
+		close(fd);
+		}
+
+	close(dirFd);
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		main : Entry point.
+//----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{	long		numRuns;
+
+
+
+	// Create the directory
+	if (argc == 4 && strcmp(argv[1], "--create") == 0)
+		return(dirread_create(argv[2], atol(argv[3])));
+
+	if (argc != 3)
+		{
+		fprintf(stderr, "usage: dirread <path> <runs>\n       dirread --create <path> <files>\n");
+		return(1);
+		}
+
+
+
+	// Run the benchmark
+	//
+	// Times are in milliseconds per listing of the whole directory.
+	numRuns = atol(argv[2]);
+
+	printf("stream      reader      stream+seek reader+seek\n");
+
+	for (long n = 0; n < numRuns; n++)
+		{
+		printf("%-11.1f %-11.1f %-11.1f %-11.1f\n",
+					dirread_list_stream(argv[1], false),
+					dirread_list_reader(argv[1], false),
+					dirread_list_stream(argv[1], true),
+					dirread_list_reader(argv[1], true));
+		}
+
+	return(0);
+}
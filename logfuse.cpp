@@ -39,23 +39,60 @@
 //============================================================================
 //		Include files
 //----------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/attr.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/time.h>
-#include <sys/vnode.h>
 #include <sys/xattr.h>
 
+#if FUSE_APPLE
+	#include <sys/attr.h>
+	#include <sys/vnode.h>
+#endif
+
+#if defined(__linux__)
+	#include <sched.h>
+	#include <semaphore.h>
+	#include <sys/syscall.h>
+#endif
+
 #include <fuse.h>
 
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	#include <fuse_lowlevel.h>
+#endif
+
 #if FUSE_APPLE
 	#include <os/log.h>
 #endif
@@ -68,7 +105,136 @@
 //		Internal constants
 //----------------------------------------------------------------------------
 enum {
-	kMaxLogMsg														= 10 * 1024
+	kMaxLogMsg														= 10 * 1024,
+	kContentCacheMaxFile											= 64 * 1024,
+	kPathCacheShards												= 32,
+	kPathCacheMaxEntries											= 256 * 1024,
+	kAccessCacheMaxResults											= 8,
+	kAccessCacheGroups												= 32,
+	kDirReadBufferMin												= 4 * 1024,
+	kDirReadBufferMax												= 256 * 1024,
+	kXattrCacheMaxNames												= 16,
+	kXattrCacheMaxValue												= 4 * 1024,
+	kTierThreshold													= 3,
+	kTierCopyBuffer													= 1024 * 1024,
+	kTierMaxEntries													= 64 * 1024,
+	kThrottleShards													= 16,
+	kThrottleMaxEntries												= 1024,
+	kThrottleBurst													= 1000000000,
+	kLogFlushInterval												= 1000,
+	kLogDrainTimeout												= 2000
+};
+
+
+// Statistics
+enum logfuse_stat {
+	kStatAttrCacheHit,
+	kStatAttrCacheMiss,
+	kStatContentCacheHit,
+	kStatContentCacheMiss,
+	kStatNegativeCacheHit,
+	kStatNegativeCacheMiss,
+	kStatDirCacheHit,
+	kStatDirCacheMiss,
+	kStatFdCacheHit,
+	kStatFdCacheMiss,
+	kStatAccessCacheHit,
+	kStatAccessCacheMiss,
+	kStatXattrCacheHit,
+	kStatXattrCacheMiss,
+	kStatTierHit,
+	kStatTierMiss,
+	kStatTierCopy,
+	kStatInjectDelay,
+	kStatInjectFault,
+	kStatThrottleWait,
+	kStatThrottleTime,
+	kStatCount
+};
+
+
+// Options
+enum {
+	kOptCacheRule,
+	kOptCacheDefault,
+	kOptContentCache,
+	kOptContentCacheMax,
+	kOptAttrCacheTTL,
+	kOptNegativeCacheTTL,
+	kOptReaddirStat,
+	kOptDirCache,
+	kOptRoot,
+	kOptFdCache,
+	kOptAccessCacheTTL,
+	kOptXattrCacheTTL,
+	kOptAttrTimeout,
+	kOptEntryTimeout,
+	kOptNegativeTimeout,
+	kOptReaddirPlus,
+	kOptMaxPages,
+	kOptLowLevel,
+	kOptMaxThreads,
+	kOptPinThreads,
+	kOptWritebackCache,
+	kOptConfig,
+	kOptLogOps,
+	kOptLogSample,
+	kOptLogSink,
+	kOptLogBuffer,
+	kOptTier,
+	kOptTierThreshold,
+	kOptTierMax,
+	kOptDelayRule,
+	kOptFaultRule,
+	kOptThrottleBy,
+	kOptThrottleOps,
+	kOptThrottleBytes,
+	kOptThrottleBurst,
+	kOptMount
+};
+
+static const fuse_opt kLogfuseOptions[] = {
+	FUSE_OPT_KEY("cache_rule=",			kOptCacheRule),
+	FUSE_OPT_KEY("cache_default=",		kOptCacheDefault),
+	FUSE_OPT_KEY("content_cache=",		kOptContentCache),
+	FUSE_OPT_KEY("content_cache_max=",	kOptContentCacheMax),
+	FUSE_OPT_KEY("attr_cache_ttl=",		kOptAttrCacheTTL),
+	FUSE_OPT_KEY("negative_cache_ttl=",	kOptNegativeCacheTTL),
+	FUSE_OPT_KEY("readdir_stat",		kOptReaddirStat),
+	FUSE_OPT_KEY("dir_cache=",			kOptDirCache),
+	FUSE_OPT_KEY("root=",				kOptRoot),
+	FUSE_OPT_KEY("mount=",				kOptMount),
+	FUSE_OPT_KEY("fd_cache=",			kOptFdCache),
+	FUSE_OPT_KEY("access_cache_ttl=",	kOptAccessCacheTTL),
+	FUSE_OPT_KEY("xattr_cache_ttl=",	kOptXattrCacheTTL),
+	FUSE_OPT_KEY("config=",				kOptConfig),
+	FUSE_OPT_KEY("log_ops=",			kOptLogOps),
+	FUSE_OPT_KEY("log_sample=",			kOptLogSample),
+	FUSE_OPT_KEY("log_sink=",			kOptLogSink),
+	FUSE_OPT_KEY("log_buffer=",			kOptLogBuffer),
+	FUSE_OPT_KEY("tier=",				kOptTier),
+	FUSE_OPT_KEY("tier_threshold=",		kOptTierThreshold),
+	FUSE_OPT_KEY("tier_max=",			kOptTierMax),
+	FUSE_OPT_KEY("delay_rule=",			kOptDelayRule),
+	FUSE_OPT_KEY("fault_rule=",			kOptFaultRule),
+	FUSE_OPT_KEY("throttle_by=",		kOptThrottleBy),
+	FUSE_OPT_KEY("throttle_ops=",		kOptThrottleOps),
+	FUSE_OPT_KEY("throttle_bytes=",		kOptThrottleBytes),
+	FUSE_OPT_KEY("throttle_burst=",		kOptThrottleBurst),
+#if FUSE_USE_VERSION >= 30
+	FUSE_OPT_KEY("attr_timeout=",		kOptAttrTimeout),
+	FUSE_OPT_KEY("entry_timeout=",		kOptEntryTimeout),
+	FUSE_OPT_KEY("negative_timeout=",	kOptNegativeTimeout),
+	FUSE_OPT_KEY("readdirplus=",		kOptReaddirPlus),
+	FUSE_OPT_KEY("max_pages=",			kOptMaxPages),
+	FUSE_OPT_KEY("writeback_cache",		kOptWritebackCache),
+#endif
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	FUSE_OPT_KEY("lowlevel",			kOptLowLevel),
+	FUSE_OPT_KEY("max_threads=",		kOptMaxThreads),
+	FUSE_OPT_KEY("pin_threads",			kOptPinThreads),
+#endif
+	FUSE_OPT_END
 };
 
 
@@ -81,8 +247,30 @@ enum {
 // Extended attributes
 #if FUSE_APPLE
 	#define XATTR_POSITION											, uint32_t position
+	#define XATTR_CACHEABLE											(position == 0)
+	#define XATTR_MISSING											ENOATTR
 #else
 	#define XATTR_POSITION
+	#define XATTR_CACHEABLE											true
+	#define XATTR_MISSING											ENODATA
+#endif
+
+
+// Directory listings
+#if FUSE_USE_VERSION >= 30
+	#define READDIR_FLAGS											, fuse_readdir_flags flags
+	#define READDIR_PLUS											((flags & FUSE_READDIR_PLUS) != 0)
+#else
+	#define READDIR_FLAGS
+	#define READDIR_PLUS											false
+#endif
+
+
+// Device control
+#if FUSE_USE_VERSION >= 35
+	#define IOCTL_CMD												unsigned int
+#else
+	#define IOCTL_CMD												int
 #endif
 
 
@@ -98,6 +286,57 @@ enum {
 	while (0)
 
 
+// Root directory
+#if defined(O_PATH)
+	#define ROOT_OPEN_FLAGS											(O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+	#define ROOT_OPEN_FLAGS											(O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+
+// File times
+#if FUSE_APPLE
+	#define STAT_ATIME(_info)										(_info).st_atimespec
+	#define STAT_MTIME(_info)										(_info).st_mtimespec
+	#define STAT_CTIME(_info)										(_info).st_ctimespec
+#else
+	#define STAT_ATIME(_info)										(_info).st_atim
+	#define STAT_MTIME(_info)										(_info).st_mtim
+	#define STAT_CTIME(_info)										(_info).st_ctim
+#endif
+
+
+// Fault injection
+#define INJECT_OP(_ops, _name)										\
+	do																\
+		{															\
+		typedef logfuse_inject_op<decltype(_ops._name), __LINE__>	theOp;	\
+																	\
+		if (_ops._name != nullptr)									\
+			{														\
+			theOp::theFunc = _ops._name;							\
+			theOp::theName = #_name;								\
+			_ops._name     = theOp::invoke;							\
+			}														\
+		}															\
+	while (0)
+
+
+// Throttling
+#define THROTTLE_LL_OP(_ops, _name)									\
+	do																\
+		{															\
+		typedef logfuse_ll_throttle_op<decltype(_ops._name), __LINE__>	theOp;	\
+																	\
+		if (_ops._name != nullptr)									\
+			{														\
+			theOp::theFunc = _ops._name;							\
+			_ops._name     = theOp::invoke;							\
+			}														\
+		}															\
+	while (0)
+
+
 // Bitfield text
 #define TEXT_BEGIN()												\
 			std::string		theText;
@@ -111,7 +350,7 @@ enum {
 					if (theText.empty())							\
 						theText  = #_bit;							\
 					else											\
-						theText += #_bit " | ";						\
+						theText += " | " #_bit;						\
 					}												\
 				}													\
 			while(0)
@@ -133,41 +372,690 @@ enum {
 //============================================================================
 //		Internal types
 //----------------------------------------------------------------------------
+// Errors
+//
+// Operations return errno after logging and invalidating their caches, so
+// the helpers that run after a call preserve errno with a saver.
+struct logfuse_errno_saver {
+	int				theErr;
+
+	logfuse_errno_saver() : theErr(errno)
+	{
+	}
+
+	~logfuse_errno_saver()
+	{
+		errno = theErr;
+	}
+};
+
+
+// File identity
+struct logfuse_file_id {
+	dev_t			dev;
+	ino_t			ino;
+
+	bool operator==(const logfuse_file_id &otherID) const
+	{
+		return(dev == otherID.dev && ino == otherID.ino);
+	}
+};
+
+struct logfuse_file_id_hash {
+	size_t operator()(const logfuse_file_id &fileID) const
+	{
+		return(std::hash<uint64_t>()(((uint64_t) fileID.dev << 48) ^ (uint64_t) fileID.ino));
+	}
+};
+
+
+// File contents
+//
+// Contents are immutable once cached. Invalidating an entry clears isValid,
+// so that open files holding a reference fall back to the backing file.
+struct logfuse_content {
+	logfuse_file_id			fileID;
+	timespec				modTime;
+	off_t					size;
+	std::string				data;
+	std::atomic<bool>		isValid;
+	std::atomic<bool>		wasUsed;
+};
+
+typedef std::shared_ptr<logfuse_content> logfuse_content_ref;
+
+struct logfuse_content_cache {
+	std::mutex																theLock;
+	std::unordered_map<logfuse_file_id, size_t, logfuse_file_id_hash>		theIndex;
+	std::vector<logfuse_content_ref>										theSlots;
+	std::vector<size_t>														freeSlots;
+	size_t																	clockHand;
+	size_t																	totalBytes;
+};
+
+
+// Directory snapshot
+//
+// Snapshots are immutable once cached. Each entry holds only the inode and
+// type of the entry, as a change to a child does not change the directory.
+// Full attributes are taken from the attribute cache when a snapshot is read.
+struct logfuse_dir_entry {
+	std::string				name;
+	ino_t					inode;
+	mode_t					type;
+};
+
+struct logfuse_dir_snapshot {
+	logfuse_file_id						dirID;
+	timespec							modTime;
+	timespec							changeTime;
+	std::vector<logfuse_dir_entry>		theEntries;
+	size_t								theSize;
+};
+
+typedef std::shared_ptr<logfuse_dir_snapshot> logfuse_dir_snapshot_ref;
+
+struct logfuse_dir_cache_entry {
+	logfuse_dir_snapshot_ref				snapshot;
+	std::list<uint64_t>::iterator			lruIter;
+};
+
+struct logfuse_dir_cache {
+	std::mutex														theLock;
+	std::unordered_map<uint64_t, logfuse_dir_cache_entry>			theIndex;
+	std::list<uint64_t>												theLRU;
+	size_t															totalBytes;
+};
+
+
 // Directory info
+//
+// On Linux directories are read with getdents64 into a per-handle buffer,
+// and entries are identified by the offset cookies it returns. The records
+// it returns have the same layout as a dirent.
 struct logfuse_dir_info {
-	DIR				*dir;
-    dirent			*entry;
-	off_t			offset;
+#if defined(__linux__)
+	int							fd;
+	std::unique_ptr<char[]>		buffer;
+	size_t						bufferAlloc;
+	size_t						bufferPos;
+	size_t						bufferSize;
+#else
+	DIR							*dir;
+#endif
+    dirent						*entry;
+	off_t						offset;
+	logfuse_dir_snapshot_ref	snapshot;
+	logfuse_dir_snapshot_ref	pending;
+};
+
+
+// Descriptor cache
+struct logfuse_fd_key {
+	logfuse_file_id			fileID;
+	int						flags;
+
+	bool operator==(const logfuse_fd_key &otherKey) const
+	{
+		return(fileID == otherKey.fileID && flags == otherKey.flags);
+	}
+};
+
+struct logfuse_fd_key_hash {
+	size_t operator()(const logfuse_fd_key &theKey) const
+	{
+		return(logfuse_file_id_hash()(theKey.fileID) ^ std::hash<int>()(theKey.flags));
+	}
+};
+
+struct logfuse_fd_entry {
+	logfuse_fd_key			theKey;
+	int						fd;
+};
+
+struct logfuse_fd_cache {
+	std::mutex																						theLock;
+	std::list<logfuse_fd_entry>																		theLRU;
+	std::unordered_multimap<logfuse_fd_key, std::list<logfuse_fd_entry>::iterator, logfuse_fd_key_hash>	theIndex;
+};
+
+
+// Tier
+//
+// Files that are opened often are copied to a directory on faster storage,
+// and later opens are served from the copy while the original still has the
+// size and modification time it was copied with.
+//
+// Copies are named by the identity of their original, and are made by a
+// background thread from a descriptor to the original taken at open. Files
+// with a copy are kept in least recently opened order for eviction.
+struct logfuse_tier_entry {
+	size_t									numOpens;
+	bool									isCopying;
+	bool									isCopied;
+	bool									isExcluded;
+	off_t									theSize;
+	timespec								modTime;
+	std::list<logfuse_file_id>::iterator	copyIter;
+};
+
+struct logfuse_tier_copy {
+	logfuse_file_id			fileID;
+	int						fd;
+};
+
+struct logfuse_tier {
+	std::mutex																		theLock;
+	std::condition_variable															theSignal;
+	std::unordered_map<logfuse_file_id, logfuse_tier_entry, logfuse_file_id_hash>	theEntries;
+	std::list<logfuse_tier_copy>													thePending;
+	std::list<logfuse_file_id>														theCopies;
+	std::thread																		theThread;
+	std::atomic<bool>																isStopping;
+	size_t																			theSize;
+	int																				fd;
+};
+
+
+// File info
+struct logfuse_file_info {
+	int						fd;
+	int						flags;
+	bool					wasLocked;
+	bool					isTiered;
+	logfuse_file_id			fileID;
+	logfuse_content_ref		content;
+};
+
+
+// Inodes
+//
+// The low-level frontend names each backing file by its identity, and holds
+// an O_PATH descriptor to it for as long as the kernel holds a lookup.
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+struct logfuse_inode {
+	int						fd;
+	logfuse_file_id			fileID;
+	uint64_t				nlookup;
+};
+
+struct logfuse_inode_table {
+	std::mutex																					theLock;
+	logfuse_inode																				theRoot;
+	std::unordered_map<logfuse_file_id, std::unique_ptr<logfuse_inode>, logfuse_file_id_hash>	theInodes;
+};
+
+
+// Workers
+struct logfuse_worker {
+	fuse_session			*theSession;
+	sem_t					*theFinish;
+	int						theCPU;
+	pthread_t				theThread;
+};
+#endif
+
+
+// Mounts
+//
+// A single process can serve several mount points, each with its own root.
+// The first mount is the one given on the command line, and the others are
+// run by their own threads once it has started.
+//
+// Every mount shares the same caches, settings, statistics and log. The
+// paths of each extra mount are held in the path tree below a node that no
+// path component can name, so their cached values never collide.
+//
+// Each mount is unmounted exactly once, by whichever of its thread or the
+// stopper clears its published instance.
+struct logfuse_mount_path {
+	std::string							rootPath;
+	std::string							mountPoint;
+};
+
+struct logfuse_mount {
+	std::string							rootPath;
+	std::string							mountPoint;
+	std::string							nodeName;
+	int									rootFd;
+	std::mutex							theLock;
+	std::thread							theThread;
+	struct fuse							*theFuse;
+	bool								isStopping;
+};
+
+struct logfuse_mount_table {
+	std::vector<std::unique_ptr<logfuse_mount>>		theMounts;
+	std::vector<std::string>						fuseArgs;
+	const fuse_operations							*fuseOps;
+};
+
+
+// Path nodes
+//
+// Paths are interned into a tree of nodes, each named by a component within
+// its parent, so that caches can be keyed by a compact node ID. Renaming a
+// path moves its node to its new parent, and removing a path discards its
+// node and everything below it.
+//
+// Each node holds a pair of stamps for each path cache, taken from the clock
+// when the node, or the tree below it, was last invalidated. Values carry the
+// time from before they were fetched, so a value is only valid if it is newer
+// than every stamp that applies to it. A node also records when a child was
+// last discarded, which new children take as their initial stamps.
+//
+// A full table evicts leaf nodes that have not been found since the clock
+// hand last passed them. Values cached for an evicted node are orphaned, as
+// IDs are never reused, and are reclaimed as their shards fill.
+//
+// The root node has ID 0, so other nodes are numbered from 1 and no cache
+// entry for a path can be mistaken for one for the root.
+enum logfuse_node_stamp {
+	kNodeStampAttr,
+	kNodeStampNegative,
+	kNodeStampAccess,
+	kNodeStampXattr,
+	kNodeStampCount
+};
+
+struct logfuse_node {
+	logfuse_node															*parent;
+	std::string																name;
+	uint64_t																nodeID;
+	std::atomic<uint64_t>													selfStamps[kNodeStampCount];
+	std::atomic<uint64_t>													treeStamps[kNodeStampCount];
+	std::atomic<uint64_t>													childStamp;
+	std::atomic<bool>														wasFound;
+	std::list<logfuse_node *>::iterator										clockIter;
+	std::unordered_map<std::string, std::unique_ptr<logfuse_node>>			children;
+};
+
+struct logfuse_node_table {
+	std::shared_timed_mutex			theLock;
+	logfuse_node					theRoot;
+	size_t							numNodes;
+	uint64_t						nextID;
+	std::list<logfuse_node *>		theClock;
+};
+
+
+// Path cache
+//
+// Path caches are keyed by node ID, and sharded by that ID to reduce
+// contention between the FUSE worker threads. Each cache uses its own
+// stamps within the nodes, so can be invalidated independently.
+template<typename T>
+struct logfuse_path_entry {
+	T				value;
+	uint64_t		expires;
+	uint64_t		stamp;
+};
+
+template<typename T>
+struct logfuse_path_shard {
+	std::mutex													theLock;
+	std::unordered_map<uint64_t, logfuse_path_entry<T>>			theEntries;
+};
+
+template<typename T, logfuse_node_stamp K>
+struct logfuse_path_cache {
+	logfuse_path_shard<T>		theShards[kPathCacheShards];
+};
+
+
+// Access cache
+//
+// Permission checks are cached per path, with the results for each caller's
+// credentials and access mode held in a small list.
+struct logfuse_access_result {
+	uid_t					uid;
+	gid_t					gid;
+	size_t					groupsHash;
+	int						mode;
+	int						sysErr;
+	uint64_t				expires;
+};
+
+typedef std::vector<logfuse_access_result> logfuse_access_results;
+
+
+// Extended attribute cache
+//
+// The values and missing results of a path's attributes are held in an
+// immutable list that is replaced as results are added, with the list of
+// names held as an entry with an empty name.
+struct logfuse_xattr_value {
+	std::string				name;
+	int						sysErr;
+	std::string				data;
+	uint64_t				expires;
+};
+
+struct logfuse_xattrs {
+	std::vector<logfuse_xattr_value>	theValues;
+};
+
+typedef std::shared_ptr<const logfuse_xattrs> logfuse_xattrs_ref;
+
+
+// Cache policy
+enum logfuse_cache_policy {
+	kCachePolicyDefault,
+	kCachePolicyKeepCache,
+	kCachePolicyDirectIO
+};
+
+struct logfuse_cache_rule {
+	std::string				pattern;
+	logfuse_cache_policy	policy;
+};
+
+
+// Fault injection
+//
+// Delays and errors are injected into operations whose name and path match
+// a rule, so that clients can be tested against slow or failing storage.
+// Rules with no operations apply to every operation.
+enum logfuse_delay_kind {
+	kDelayFixed,
+	kDelayUniform,
+	kDelayTail
+};
+
+struct logfuse_delay_rule {
+	std::vector<std::string>	ops;
+	std::string					pattern;
+	logfuse_delay_kind			kind;
+	uint64_t					minTime;
+	uint64_t					maxTime;
+};
+
+struct logfuse_fault_rule {
+	std::vector<std::string>	ops;
+	std::string					pattern;
+	int							sysErr;
+	double						theRate;
+	bool						isAfter;
+};
+
+
+// Throttling
+//
+// Each caller, identified by its uid or pid, has a token bucket for its
+// operations and another for its bytes. Buckets refill at the configured
+// rate up to a burst allowance, and a caller that overdraws a bucket waits
+// until the debt has been repaid.
+struct logfuse_bucket {
+	double								tokens;
+	uint64_t							lastTime;
+};
+
+struct logfuse_throttle_entry {
+	logfuse_bucket						theOps;
+	logfuse_bucket						theBytes;
+};
+
+struct logfuse_throttle_shard {
+	std::mutex												theLock;
+	std::unordered_map<uint32_t, logfuse_throttle_entry>	theEntries;
+};
+
+struct logfuse_throttle {
+	logfuse_throttle_shard				theShards[kThrottleShards];
+};
+
+
+// Readdirplus
+enum logfuse_readdir_plus {
+	kReaddirPlusDefault,
+	kReaddirPlusYes,
+	kReaddirPlusNo,
+	kReaddirPlusAuto
+};
+
+
+// Log buffers
+//
+// With log_buffer set, messages for a file or stderr sink are gathered in a
+// buffer for each thread. Buffers are written when they fill, periodically
+// by a flush thread, and when the filesystem is destroyed.
+//
+// Each buffer is also held by the list of buffers, so that messages left by
+// a thread that has exited are still written.
+struct logfuse_settings;
+
+struct logfuse_log_buffer {
+	std::timed_mutex					theLock;
+	std::string							theData;
+	const logfuse_settings				*theSettings;
+};
+
+struct logfuse_log_buffers {
+	std::mutex											theLock;
+	std::condition_variable								theSignal;
+	std::vector<std::shared_ptr<logfuse_log_buffer>>	theBuffers;
+	std::thread											theThread;
+	std::atomic<bool>									isStopping;
+	bool												isStopped;
+};
+
+
+// Settings
+//
+// Settings that can be reloaded while mounted are published as an immutable
+// snapshot, which is replaced as a whole rather than modified in place.
+//
+// Readers load the current snapshot once per operation, without taking a
+// lock or a reference. Reloads are rare, so replaced snapshots are kept until
+// the process exits rather than tracking when their last reader is done.
+//
+// A file sink is held by one descriptor that each reload points at the file
+// it opens, so that a replaced snapshot still writes to the current file.
+struct logfuse_settings {
+	std::vector<logfuse_cache_rule>		cacheRules;
+	logfuse_cache_policy				cacheDefault;
+	std::vector<logfuse_delay_rule>		delayRules;
+	std::vector<logfuse_fault_rule>		faultRules;
+	uint64_t							attrCacheTTL;
+	uint64_t							negativeCacheTTL;
+	uint64_t							accessCacheTTL;
+	uint64_t							xattrCacheTTL;
+	bool								logAllOps;
+	std::vector<std::string>			logOps;
+	size_t								logSample;
+	std::string							logSink;
+	int									logFd;
+	size_t								logBuffer;
+	bool								throttleByPID;
+	size_t								throttleOps;
+	size_t								throttleBytes;
+	uint64_t							throttleBurst;
+};
+
+struct logfuse_settings_table {
+	std::mutex											theLock;
+	std::atomic<const logfuse_settings *>				theCurrent;
+	std::vector<std::unique_ptr<logfuse_settings>>		theSnapshots;
+	int													sinkFd;
+};
+
+
+// Configuration
+struct logfuse_config {
+	logfuse_settings					settings;
+	std::string							configPath;
+	std::string							tierPath;
+	size_t								tierThreshold;
+	size_t								tierMax;
+	size_t								contentCacheSize;
+	size_t								contentCacheMax;
+	bool								readdirStat;
+	size_t								dirCacheSize;
+	std::string							rootPath;
+	std::string							mountPoint;
+	std::vector<logfuse_mount_path>		mounts;
+	size_t								fdCacheSize;
+	double								attrTimeout;
+	double								entryTimeout;
+	double								negativeTimeout;
+	logfuse_readdir_plus				readdirPlus;
+	size_t								maxPages;
+	bool								lowLevel;
+	size_t								maxThreads;
+	bool								pinThreads;
+	bool								writebackCache;
 };
 
 
 
 
 
+//============================================================================
+//		Internal globals
+//----------------------------------------------------------------------------
+static logfuse_config gConfig;
+static int gRootFd = AT_FDCWD;
+static logfuse_content_cache gContentCache;
+static logfuse_node_table gNodes = { {}, {}, 0, 1, {} };
+static logfuse_path_cache<struct stat, kNodeStampAttr> gAttrCache;
+static logfuse_path_cache<bool, kNodeStampNegative> gNegativeCache;
+static logfuse_dir_cache gDirCache;
+static logfuse_fd_cache gFdCache;
+static logfuse_path_cache<logfuse_access_results, kNodeStampAccess> gAccessCache;
+static logfuse_path_cache<logfuse_xattrs_ref, kNodeStampXattr> gXattrCache;
+static std::atomic<uint64_t> gStats[kStatCount];
+static logfuse_settings_table gSettings = { {}, {nullptr}, {}, -1 };
+static std::atomic<uint64_t> gLogCount;
+static logfuse_log_buffers gLogBuffers;
+static uint64_t gMountTime;
+static logfuse_tier gTier;
+static logfuse_mount_table gMounts;
+static thread_local logfuse_mount *gCurrentMount;
+static logfuse_throttle gThrottle;
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+static logfuse_inode_table gInodes;
+#endif
+
+
+
+
+
 //============================================================================
 //		Internal functions
 //----------------------------------------------------------------------------
-//		logfuse_log : Emit a log message.
+//		logfuse_get_settings : Get the current settings.
 //----------------------------------------------------------------------------
-__attribute__((__format__ (__printf__, 1, 2)))
-static void logfuse_log(const char *formatMsg, ...)
-{	char		theBuffer[kMaxLogMsg];
-	va_list		argList;
+static const logfuse_settings *logfuse_get_settings()
+{
 
 
+	// Get the settings
+	return(gSettings.theCurrent.load(std::memory_order_acquire));
+}
 
-	// Format the message
-	va_start(argList, formatMsg);
-	vsprintf(theBuffer, formatMsg, argList);
-	va_end(argList);
 
 
 
-	// Emit the log
+
+//============================================================================
+//		logfuse_current_mount : Get the current mount.
+//----------------------------------------------------------------------------
+static logfuse_mount *logfuse_current_mount()
+{	fuse_context	*theContext;
+
+
+
+	// Get the mount
+	//
+	// An operation is given its mount as the user data of its FUSE instance.
+	// Threads that run outside an operation, such as a mount's own thread,
+	// name their mount directly.
+	if (gCurrentMount != nullptr)
+		return(gCurrentMount);
+
+	theContext = fuse_get_context();
+	if (theContext != nullptr && theContext->fuse != nullptr)
+		return((logfuse_mount *) theContext->private_data);
+
+	return(nullptr);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_wanted : Should a log message be emitted?
+//----------------------------------------------------------------------------
+static bool logfuse_log_wanted(const logfuse_settings *theSettings, const char *formatMsg)
+{	const char		*theName;
+	size_t			theSize;
+	bool			wantOp;
+
+
+
+	// Get the operation
+	//
+	// Operations log their name followed by their arguments, while status
+	// messages such as the statistics are always emitted. The low-level
+	// operations share the names of their high-level equivalents.
+	if (strncmp(formatMsg, "logfuse_", 8) != 0)
+		return(true);
+
+	theName = formatMsg + 8;
+	if (strncmp(theName, "ll_", 3) == 0)
+		theName += 3;
+
+	theSize = strcspn(theName, "(:");
+	if (theName[theSize] != '(')
+		return(true);
+
+
+
+	// Filter the operation
+	if (!theSettings->logAllOps)
+		{
+		wantOp = false;
+
+		for (const auto &theOp : theSettings->logOps)
+			{
+			if (theOp.size() == theSize && memcmp(theOp.data(), theName, theSize) == 0)
+				{
+				wantOp = true;
+				break;
+				}
+			}
+
+		if (!wantOp)
+			return(false);
+		}
+
+
+
+	// Sample the operation
+	if (theSettings->logSample > 1)
+		return((gLogCount.fetch_add(1, std::memory_order_relaxed) % theSettings->logSample) == 0);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_system : Emit a message to the system log.
+//----------------------------------------------------------------------------
+static void logfuse_log_system(const char *theMsg)
+{
+
+
+	// Emit the message
 #if FUSE_APPLE
-	os_log(OS_LOG_DEFAULT, "%{public}s", theBuffer);
+	os_log(OS_LOG_DEFAULT, "%{public}s", theMsg);
 #else
-	syslog(LOG_INFO, "%s", theBuffer);
+	syslog(LOG_INFO, "%s", theMsg);
 #endif
 }
 
@@ -176,19 +1064,7560 @@ static void logfuse_log(const char *formatMsg, ...)
 
 
 //============================================================================
-//		logfuse_get_dir : Get the directory info.
+//		logfuse_log_write : Write a log buffer to its sink.
+//----------------------------------------------------------------------------
+static void logfuse_log_write(logfuse_log_buffer &theBuffer)
+{	const char		*theText = theBuffer.theData.data();
+	size_t			theSize  = theBuffer.theData.size();
+	std::string		theMsg;
+	const char		*theEnd;
+	ssize_t			numWritten;
+
+
+
+	// Write the buffer
+	while (theSize != 0)
+		{
+		numWritten = write(theBuffer.theSettings->logFd, theText, theSize);
+		if (numWritten == -1 && errno == EINTR)
+			continue;
+
+		if (numWritten <= 0)
+			break;
+
+		theText += numWritten;
+		theSize -= (size_t) numWritten;
+		}
+
+
+
+	// Fall back to the system log
+	//
+	// Messages that could not be written are sent to the system log, as they
+	// would have been without a buffer.
+	while (theSize != 0)
+		{
+		theEnd = (const char *) memchr(theText, '\n', theSize);
+		if (theEnd == nullptr)
+			theEnd = theText + theSize;
+
+		theMsg.assign(theText, theEnd);
+		logfuse_log_system(theMsg.c_str());
+
+		theSize -= std::min(theSize, (size_t) (theEnd - theText) + 1);
+		theText  = theEnd + 1;
+		}
+
+	theBuffer.theData.clear();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_flush : Flush the log buffers.
+//----------------------------------------------------------------------------
+static bool logfuse_log_flush(std::chrono::steady_clock::time_point theDeadline)
+{	std::vector<std::shared_ptr<logfuse_log_buffer>>	theBuffers;
+	bool												didFlush = true;
+
+
+
+	// Get the buffers
+	//
+	// The buffers are flushed from a copy of the list, so that threads can
+	// add their buffers while a write is in progress.
+	{	std::lock_guard<std::mutex>		acquireLock(gLogBuffers.theLock);
+
+		theBuffers = gLogBuffers.theBuffers;
+	}
+
+
+
+	// Flush the buffers
+	//
+	// A buffer that is still held by its thread at the deadline is skipped,
+	// so that a thread blocked in a write can't hold up the flush.
+	for (const auto &theBuffer : theBuffers)
+		{
+		if (!theBuffer->theLock.try_lock_until(theDeadline))
+			{
+			didFlush = false;
+			continue;
+			}
+
+		if (!theBuffer->theData.empty())
+			logfuse_log_write(*theBuffer);
+
+		theBuffer->theLock.unlock();
+		}
+
+	theBuffers.clear();
+
+
+
+	// Discard the buffers
+	//
+	// A buffer that is only held by the list belongs to a thread that has
+	// exited, and is discarded once it has been written.
+	std::lock_guard<std::mutex>		acquireLock(gLogBuffers.theLock);
+
+	for (auto theIter = gLogBuffers.theBuffers.begin(); theIter != gLogBuffers.theBuffers.end(); )
+		{
+		if (theIter->use_count() == 1 && (*theIter)->theData.empty())
+			theIter = gLogBuffers.theBuffers.erase(theIter);
+		else
+			theIter++;
+		}
+
+	return(didFlush);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_flush_thread : Log flush thread.
+//----------------------------------------------------------------------------
+static void logfuse_log_flush_thread()
+{
+
+
+	// Flush the buffers
+	//
+	// The buffers are flushed periodically, so that a thread that logs
+	// rarely does not hold its messages indefinitely.
+	while (true)
+		{
+		{	std::unique_lock<std::mutex>	acquireLock(gLogBuffers.theLock);
+
+			gLogBuffers.theSignal.wait_for(acquireLock, std::chrono::milliseconds(kLogFlushInterval), [] { return(gLogBuffers.isStopping.load()); });
+
+			if (gLogBuffers.isStopping)
+				break;
+		}
+
+		logfuse_log_flush(std::chrono::steady_clock::now() + std::chrono::milliseconds(kLogDrainTimeout));
+		}
+
+
+
+	// Finish the thread
+	std::lock_guard<std::mutex>		acquireLock(gLogBuffers.theLock);
+
+	gLogBuffers.isStopped = true;
+	gLogBuffers.theSignal.notify_all();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_append : Append a message to the log buffer.
+//----------------------------------------------------------------------------
+static bool logfuse_log_append(const logfuse_settings *theSettings, const char *theMsg, size_t theSize)
+{	static thread_local std::shared_ptr<logfuse_log_buffer>	theBuffer;
+
+
+
+	// Get the buffer
+	//
+	// Each thread adds its buffer to the list on first use, and the first
+	// buffer starts the flush thread. Once the log has been drained messages
+	// are no longer buffered.
+	if (gLogBuffers.isStopping)
+		return(false);
+
+	if (theBuffer == nullptr)
+		{
+		std::lock_guard<std::mutex>		acquireLock(gLogBuffers.theLock);
+
+		theBuffer = std::make_shared<logfuse_log_buffer>();
+
+		gLogBuffers.theBuffers.push_back(theBuffer);
+
+		if (!gLogBuffers.theThread.joinable())
+			gLogBuffers.theThread = std::thread(logfuse_log_flush_thread);
+		}
+
+
+
+	// Append the message
+	//
+	// A buffer is written when it fills, or before a message logged with
+	// different settings is added to it.
+	std::lock_guard<std::timed_mutex>	acquireLock(theBuffer->theLock);
+
+	if (theBuffer->theSettings != theSettings)
+		{
+		if (!theBuffer->theData.empty())
+			logfuse_log_write(*theBuffer);
+
+		theBuffer->theSettings = theSettings;
+		}
+
+	theBuffer->theData.append(theMsg, theSize);
+
+	if (theBuffer->theData.size() >= theSettings->logBuffer)
+		logfuse_log_write(*theBuffer);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log : Emit a log message.
+//----------------------------------------------------------------------------
+__attribute__((__format__ (__printf__, 1, 2)))
+static void logfuse_log(const char *formatMsg, ...)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	char					theBuffer[kMaxLogMsg];
+	va_list					argList;
+	size_t					theSize;
+	logfuse_mount			*theMount;
+	logfuse_errno_saver		saveErrno;
+
+
+
+	// Check the settings
+	//
+	// Messages are filtered before they are formatted, so that unwanted
+	// operations cost as little as possible.
+	if (!logfuse_log_wanted(theSettings, formatMsg))
+		return;
+
+
+
+	// Format the message
+	//
+	// Messages from an operation are prefixed by their mount point when there
+	// are several mounts.
+	theSize = 0;
+
+	if (gMounts.theMounts.size() > 1 && (theMount = logfuse_current_mount()) != nullptr)
+		theSize = (size_t) snprintf(theBuffer, sizeof(theBuffer) - 1, "%s: ", theMount->mountPoint.c_str());
+
+	va_start(argList, formatMsg);
+	vsnprintf(theBuffer + theSize, sizeof(theBuffer) - 1 - theSize, formatMsg, argList);
+	va_end(argList);
+
+
+
+	// Emit the log
+	//
+	// Messages written to a file or stderr are terminated by a newline, and
+	// fall back to the system log if they could not be written.
+	if (theSettings->logFd != -1)
+		{
+		theSize            = strlen(theBuffer);
+		theBuffer[theSize] = '\n';
+
+		if (theSettings->logBuffer != 0 && logfuse_log_append(theSettings, theBuffer, theSize + 1))
+			return;
+
+		if (write(theSettings->logFd, theBuffer, theSize + 1) == (ssize_t) (theSize + 1))
+			return;
+
+		theBuffer[theSize] = 0x00;
+		}
+
+	logfuse_log_system(theBuffer);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_log_drain : Drain the log buffers.
+//----------------------------------------------------------------------------
+static bool logfuse_log_drain(std::chrono::steady_clock::time_point theDeadline)
+{	bool		didStop;
+
+
+
+	// Stop the flush thread
+	//
+	// Later messages are written directly. A flush thread that is blocked in
+	// a write past the deadline is abandoned rather than joined.
+	{	std::unique_lock<std::mutex>	acquireLock(gLogBuffers.theLock);
+
+		gLogBuffers.isStopping = true;
+		gLogBuffers.theSignal.notify_all();
+
+		didStop = gLogBuffers.theSignal.wait_until(acquireLock, theDeadline, [] { return(gLogBuffers.isStopped || !gLogBuffers.theThread.joinable()); });
+	}
+
+	if (gLogBuffers.theThread.joinable())
+		{
+		if (didStop)
+			gLogBuffers.theThread.join();
+		else
+			gLogBuffers.theThread.detach();
+		}
+
+
+
+	// Drain the buffers
+	return(logfuse_log_flush(theDeadline) && didStop);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_root_fd : Get the root of the current mount.
+//----------------------------------------------------------------------------
+static int logfuse_root_fd()
+{	logfuse_mount	*theMount = logfuse_current_mount();
+
+
+
+	// Get the root
+	//
+	// Operations on an extra mount resolve paths relative to its own root.
+	if (theMount != nullptr)
+		return(theMount->rootFd);
+
+	return(gRootFd);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path : Get a path relative to the root.
+//----------------------------------------------------------------------------
+static const char *logfuse_path(const char *path)
+{
+
+
+	// Get the path
+	//
+	// Paths are resolved relative to the root with the *at() calls, which
+	// avoids building a full path for each request.
+	//
+	// Without a root, the root is AT_FDCWD and FUSE paths are used as-is.
+	if (logfuse_root_fd() == AT_FDCWD)
+		return(path);
+
+	return(path[1] == 0x00 ? "." : path + 1);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_full_path : Get the full path.
+//----------------------------------------------------------------------------
+static std::string logfuse_full_path(const char *path)
+{	logfuse_mount	*theMount = logfuse_current_mount();
+
+
+
+	// Get the path
+	//
+	// Calls that have no *at() form need the full path to the backing file.
+	const std::string &rootPath = (theMount != nullptr) ? theMount->rootPath : gConfig.rootPath;
+
+	if (rootPath.empty())
+		return(path);
+
+	return(rootPath + path);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_time_now : Get the current time.
+//----------------------------------------------------------------------------
+static uint64_t logfuse_time_now()
+{	timespec		theTime;
+
+
+
+	// Get the time
+	//
+	// The time is in nanoseconds, from an arbitrary epoch.
+	clock_gettime(CLOCK_MONOTONIC, &theTime);
+
+	return(((uint64_t) theTime.tv_sec * 1000000000ULL) + (uint64_t) theTime.tv_nsec);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_stat_add : Update a statistic.
+//----------------------------------------------------------------------------
+static void logfuse_stat_add(logfuse_stat theStat, uint64_t theValue = 1)
+{
+
+
+	// Update the statistic
+	gStats[theStat].fetch_add(theValue, std::memory_order_relaxed);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_get_dir : Get the directory info.
+//----------------------------------------------------------------------------
+static logfuse_dir_info *logfuse_get_dir(fuse_file_info *fileInfo)
+{
+
+
+	// Validate our state
+	static_assert(sizeof(logfuse_dir_info *) <= sizeof(fileInfo->fh), "Unable to store pointer");
+
+
+
+	// Get the directory
+	return((logfuse_dir_info *) ((uintptr_t) fileInfo->fh));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_get_file : Get the file info.
+//----------------------------------------------------------------------------
+static logfuse_file_info *logfuse_get_file(fuse_file_info *fileInfo)
+{
+
+
+	// Validate our state
+	static_assert(sizeof(logfuse_file_info *) <= sizeof(fileInfo->fh), "Unable to store pointer");
+
+
+
+	// Get the file
+	return((logfuse_file_info *) ((uintptr_t) fileInfo->fh));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_get_fd : Get the file descriptor.
+//----------------------------------------------------------------------------
+static int logfuse_get_fd(fuse_file_info *fileInfo)
+{
+
+
+	// Get the file descriptor
+	return(logfuse_get_file(fileInfo)->fd);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_open : Open a directory.
+//----------------------------------------------------------------------------
+static logfuse_dir_info *logfuse_dir_open(int fd)
+{	logfuse_dir_info	*dirInfo;
+
+
+
+	// Create the info
+	//
+	// The info takes ownership of the descriptor, which is closed on failure.
+	dirInfo = new (std::nothrow) logfuse_dir_info;
+	if (dirInfo == nullptr)
+		{
+		close(fd);
+		errno = ENOMEM;
+		return(nullptr);
+		}
+
+	dirInfo->entry  = nullptr;
+	dirInfo->offset = 0;
+
+
+
+	// Open the directory
+#if defined(__linux__)
+	dirInfo->fd          = fd;
+	dirInfo->bufferAlloc = 0;
+	dirInfo->bufferPos   = 0;
+	dirInfo->bufferSize  = 0;
+#else
+	int		sysErr;
+
+	dirInfo->dir = fdopendir(fd);
+	if (dirInfo->dir == nullptr)
+		{
+		sysErr = errno;
+		close(fd);
+		delete dirInfo;
+		errno = sysErr;
+		return(nullptr);
+		}
+#endif
+
+	return(dirInfo);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_fd : Get a directory's descriptor.
+//----------------------------------------------------------------------------
+static int logfuse_dir_fd(logfuse_dir_info *dirInfo)
+{
+
+
+	// Get the descriptor
+#if defined(__linux__)
+	return(dirInfo->fd);
+#else
+	return(dirfd(dirInfo->dir));
+#endif
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_read : Read the next directory entry.
+//----------------------------------------------------------------------------
+static dirent *logfuse_dir_read(logfuse_dir_info *dirInfo)
+{
+
+
+	// Read the entry
+	//
+	// Each getdents64 call fills the buffer with as many entries as fit,
+	// which are then handed out without further calls.
+	//
+	// The buffer is allocated on the first read, and doubled while reads
+	// fill at least half of it, so small directories only need a small one.
+	//
+	// The end of the directory is returned as nullptr with errno cleared, and
+	// an error as nullptr with errno set.
+#if defined(__linux__)
+	size_t		newAlloc;
+	char		*newBuffer;
+	dirent		*theEntry;
+	long		sysErr;
+
+	if (dirInfo->bufferPos >= dirInfo->bufferSize)
+		{
+		if (dirInfo->bufferAlloc < kDirReadBufferMax && dirInfo->bufferSize >= dirInfo->bufferAlloc / 2)
+			{
+			newAlloc  = std::max((size_t) kDirReadBufferMin, dirInfo->bufferAlloc * 2);
+			newBuffer = new (std::nothrow) char[newAlloc];
+
+			if (newBuffer != nullptr)
+				{
+				dirInfo->buffer.reset(newBuffer);
+				dirInfo->bufferAlloc = newAlloc;
+				}
+			}
+
+		if (dirInfo->bufferAlloc == 0)
+			{
+			errno = ENOMEM;
+			return(nullptr);
+			}
+
+		sysErr = syscall(SYS_getdents64, dirInfo->fd, dirInfo->buffer.get(), dirInfo->bufferAlloc);
+		if (sysErr <= 0)
+			{
+			dirInfo->bufferPos  = 0;
+			dirInfo->bufferSize = 0;
+
+			if (sysErr == 0)
+				errno = 0;
+
+			return(nullptr);
+			}
+
+		dirInfo->bufferPos  = 0;
+		dirInfo->bufferSize = (size_t) sysErr;
+		}
+
+	theEntry = (dirent *) &dirInfo->buffer[dirInfo->bufferPos];
+	dirInfo->bufferPos += theEntry->d_reclen;
+
+	return(theEntry);
+#else
+	errno = 0;
+
+	return(readdir(dirInfo->dir));
+#endif
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_tell : Get the offset after the current directory entry.
+//----------------------------------------------------------------------------
+static off_t logfuse_dir_tell(logfuse_dir_info *dirInfo)
+{
+
+
+	// Get the offset
+	//
+	// A getdents64 record holds the offset of the entry that follows it.
+#if defined(__linux__)
+	return(dirInfo->entry->d_off);
+#else
+	return(telldir(dirInfo->dir));
+#endif
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_seek : Seek to a directory offset.
+//----------------------------------------------------------------------------
+static bool logfuse_dir_seek(logfuse_dir_info *dirInfo, off_t offset)
+{
+
+
+	// Seek to the offset
+	//
+	// An offset cookie can be passed straight to the file system, without
+	// reading the directory up to it. The buffer is released, so that a read
+	// that resumes after a seek starts again with a small one rather than
+	// fetching entries it may not use.
+#if defined(__linux__)
+	if (lseek(dirInfo->fd, offset, SEEK_SET) == -1)
+		return(false);
+
+	dirInfo->buffer.reset();
+	dirInfo->bufferAlloc = 0;
+	dirInfo->bufferPos   = 0;
+	dirInfo->bufferSize  = 0;
+#else
+	seekdir(dirInfo->dir, offset);
+#endif
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_close : Close a directory.
+//----------------------------------------------------------------------------
+static void logfuse_dir_close(logfuse_dir_info *dirInfo)
+{
+
+
+	// Close the directory
+#if defined(__linux__)
+	close(dirInfo->fd);
+#else
+	closedir(dirInfo->dir);
+#endif
+
+	delete dirInfo;
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_name : Get the name of a file's copy in the tier.
+//----------------------------------------------------------------------------
+static std::string logfuse_tier_name(const logfuse_file_id &fileID)
+{	char		theBuffer[64];
+
+
+
+	// Get the name
+	snprintf(theBuffer, sizeof(theBuffer), "logfuse-%llx-%llx", (unsigned long long) fileID.dev, (unsigned long long) fileID.ino);
+
+	return(theBuffer);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_prepare : Prepare the tier.
+//----------------------------------------------------------------------------
+static bool logfuse_tier_prepare()
+{	DIR			*theDir;
+	dirent		*theEntry;
+	int			fd;
+
+
+
+	// Open the tier
+	gTier.fd = open(gConfig.tierPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (gTier.fd == -1)
+		return(false);
+
+
+
+	// Remove any old copies
+	//
+	// Copies left by an earlier mount can't be validated, as their originals
+	// are only known while mounted. Other files in the tier are left alone.
+	fd     = dup(gTier.fd);
+	theDir = (fd == -1) ? nullptr : fdopendir(fd);
+
+	if (theDir == nullptr)
+		{
+		if (fd != -1)
+			close(fd);
+
+		return(false);
+		}
+
+	while ((theEntry = readdir(theDir)) != nullptr)
+		{
+		if (strncmp(theEntry->d_name, "logfuse-", 8) == 0)
+			unlinkat(gTier.fd, theEntry->d_name, 0);
+		}
+
+	closedir(theDir);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_eligible : Can an open be served from the tier?
+//----------------------------------------------------------------------------
+static bool logfuse_tier_eligible(int flags)
+{
+
+
+	// Check the flags
+	//
+	// Only opens for reading are served from the tier, as writes must go to
+	// the original.
+	return(!gConfig.tierPath.empty() && (flags & O_ACCMODE) == O_RDONLY && (flags & O_TRUNC) == 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_discard : Discard a file's copy in the tier.
+//----------------------------------------------------------------------------
+static void logfuse_tier_discard(const logfuse_file_id &fileID, logfuse_tier_entry &theEntry)
+{
+
+
+	// Discard the copy
+	//
+	// The caller must hold the tier lock. Descriptors that are already open
+	// to the copy remain valid until they are closed.
+	if (theEntry.isCopied)
+		{
+		unlinkat(gTier.fd, logfuse_tier_name(fileID).c_str(), 0);
+		gTier.theCopies.erase(theEntry.copyIter);
+
+		gTier.theSize     -= (size_t) theEntry.theSize;
+		theEntry.isCopied  = false;
+		theEntry.numOpens  = 0;
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_evict : Evict copies from the tier.
+//----------------------------------------------------------------------------
+static bool logfuse_tier_evict(size_t theSize)
+{
+
+
+	// Evict the copies
+	//
+	// The caller must hold the tier lock. The least recently opened copies
+	// are discarded until the new copy fits.
+	if (gConfig.tierMax == 0)
+		return(true);
+
+	if (theSize > gConfig.tierMax)
+		return(false);
+
+	while (gTier.theSize + theSize > gConfig.tierMax)
+		{
+		if (gTier.theCopies.empty())
+			return(false);
+
+		auto theOldest = gTier.theEntries.find(gTier.theCopies.back());
+
+		logfuse_tier_discard(theOldest->first, theOldest->second);
+		}
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_find_entry : Find a file's entry in the tier.
+//----------------------------------------------------------------------------
+static logfuse_tier_entry *logfuse_tier_find_entry(const logfuse_file_id &fileID)
+{
+
+
+	// Find the entry
+	//
+	// The caller must hold the tier lock. When the table is full, files that
+	// are only being counted are forgotten to make space for new ones.
+	auto theIter = gTier.theEntries.find(fileID);
+
+	if (theIter == gTier.theEntries.end())
+		{
+		if (gTier.theEntries.size() >= kTierMaxEntries)
+			{
+			for (theIter = gTier.theEntries.begin(); theIter != gTier.theEntries.end(); )
+				{
+				if (!theIter->second.isCopying && !theIter->second.isCopied)
+					theIter = gTier.theEntries.erase(theIter);
+				else
+					theIter++;
+				}
+
+			if (gTier.theEntries.size() >= kTierMaxEntries)
+				return(nullptr);
+			}
+
+		theIter = gTier.theEntries.emplace(fileID, logfuse_tier_entry{}).first;
+		}
+
+	return(&theIter->second);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_count : Count an open that was not served from the tier.
+//----------------------------------------------------------------------------
+static bool logfuse_tier_count(logfuse_tier_entry &theEntry)
+{
+
+
+	// Count the open
+	//
+	// The caller must hold the tier lock. A file is copied once it has been
+	// opened often enough, and continues to be served from the original until
+	// its copy is complete.
+	logfuse_stat_add(kStatTierMiss);
+
+	theEntry.numOpens++;
+
+	if (theEntry.numOpens >= gConfig.tierThreshold && !theEntry.isCopying && !theEntry.isExcluded)
+		{
+		theEntry.isCopying = true;
+		return(true);
+		}
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_open : Open a file from the tier.
+//----------------------------------------------------------------------------
+static int logfuse_tier_open(const struct stat &statInfo, bool *wantCopy)
+{	logfuse_file_id					fileID = { statInfo.st_dev, statInfo.st_ino };
+	std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+	logfuse_tier_entry				*theEntry;
+	int								fd;
+
+
+
+	// Check the file
+	//
+	// Small files held by the content cache are left to it.
+	*wantCopy = false;
+
+	if (!S_ISREG(statInfo.st_mode) || (gConfig.contentCacheSize != 0 && statInfo.st_size <= (off_t) gConfig.contentCacheMax))
+		return(-1);
+
+	theEntry = logfuse_tier_find_entry(fileID);
+	if (theEntry == nullptr)
+		return(-1);
+
+
+
+	// Open the copy
+	//
+	// A copy is only used while the original has the size and modification
+	// time it was copied with, and is discarded once it goes stale.
+	if (theEntry->isCopied)
+		{
+		if (theEntry->theSize         == statInfo.st_size            &&
+			theEntry->modTime.tv_sec  == STAT_MTIME(statInfo).tv_sec &&
+			theEntry->modTime.tv_nsec == STAT_MTIME(statInfo).tv_nsec)
+			{
+			fd = openat(gTier.fd, logfuse_tier_name(fileID).c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd != -1)
+				{
+				gTier.theCopies.splice(gTier.theCopies.begin(), gTier.theCopies, theEntry->copyIter);
+				logfuse_stat_add(kStatTierHit);
+				return(fd);
+				}
+			}
+
+		logfuse_tier_discard(fileID, *theEntry);
+		}
+
+
+
+	// Count the open
+	*wantCopy = logfuse_tier_count(*theEntry);
+
+	return(-1);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_open_inode : Open an inode from the tier.
+//----------------------------------------------------------------------------
+static int logfuse_tier_open_inode(const logfuse_file_id &fileID, int inodeFd, bool *wantCopy)
+{	logfuse_tier_entry		*theEntry;
+	struct stat				statInfo;
+
+
+
+	// Count the open
+	//
+	// The attributes of the original are only needed to check a copy, so
+	// an inode without one is counted by its identity. Files that the tier
+	// would not hold are excluded when they come to be copied.
+	*wantCopy = false;
+
+	{	std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+
+		theEntry = logfuse_tier_find_entry(fileID);
+		if (theEntry == nullptr)
+			return(-1);
+
+		if (!theEntry->isCopied)
+			{
+			*wantCopy = logfuse_tier_count(*theEntry);
+			return(-1);
+			}
+	}
+
+
+
+	// Open the copy
+	if (fstat(inodeFd, &statInfo) != 0)
+		return(-1);
+
+	return(logfuse_tier_open(statInfo, wantCopy));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_promote : Queue a file to be copied to the tier.
+//----------------------------------------------------------------------------
+static void logfuse_tier_promote(int fd, const logfuse_file_id &fileID)
+{	std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+	int								copyFd;
+
+
+
+	// Queue the copy
+	//
+	// The copy is made from its own descriptor to the original, so that it
+	// does not depend on the file remaining open. A copy that can't be queued
+	// is abandoned, and will be tried again by a later open.
+	copyFd = (fd == -1) ? -1 : fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+	if (copyFd == -1)
+		{
+		auto theIter = gTier.theEntries.find(fileID);
+		if (theIter != gTier.theEntries.end())
+			theIter->second.isCopying = false;
+
+		return;
+		}
+
+	gTier.thePending.push_back({ fileID, copyFd });
+	gTier.theSignal.notify_one();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_copy_file : Copy a file to the tier.
+//----------------------------------------------------------------------------
+static void logfuse_tier_copy_file(const logfuse_tier_copy &theCopy)
+{	std::string			theName = logfuse_tier_name(theCopy.fileID);
+	std::string			tmpName = theName + ".tmp";
+	std::vector<char>	theBuffer(kTierCopyBuffer);
+	struct stat			infoBefore;
+	struct stat			infoAfter;
+	ssize_t				numRead;
+	ssize_t				numWritten;
+	off_t				theOffset;
+	bool				didCopy;
+	bool				isExcluded;
+	int					fd;
+
+
+
+	// Copy the file
+	//
+	// The copy is written under a temporary name, and is only kept if the
+	// original did not change while it was being copied. Files that the tier
+	// would not hold, because they are too large for it or small enough for
+	// the content cache, are excluded until they are next written. A copy is
+	// abandoned when the tier is stopped.
+	didCopy    = false;
+	isExcluded = false;
+	theOffset  = 0;
+	fd         = -1;
+
+	if (fstat(theCopy.fd, &infoBefore) == 0 &&
+		infoBefore.st_dev == theCopy.fileID.dev && infoBefore.st_ino == theCopy.fileID.ino)
+		{
+		isExcluded = !S_ISREG(infoBefore.st_mode) ||
+						(gConfig.tierMax          != 0 && infoBefore.st_size >  (off_t) gConfig.tierMax) ||
+						(gConfig.contentCacheSize != 0 && infoBefore.st_size <= (off_t) gConfig.contentCacheMax);
+
+		if (!isExcluded)
+			fd = openat(gTier.fd, tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		}
+
+	if (fd != -1)
+		{
+		do
+			{
+			numRead    = pread(theCopy.fd, theBuffer.data(), theBuffer.size(), theOffset);
+			numWritten = (numRead > 0) ? pwrite(fd, theBuffer.data(), (size_t) numRead, theOffset) : 0;
+
+			if (numRead > 0 && numWritten == numRead)
+				theOffset += numRead;
+			}
+		while (numRead > 0 && numWritten == numRead && !gTier.isStopping);
+
+		didCopy = (numRead == 0 && theOffset == infoBefore.st_size);
+
+		if (close(fd) != 0)
+			didCopy = false;
+
+		didCopy = didCopy && fstat(theCopy.fd, &infoAfter) == 0              &&
+					infoAfter.st_size             == infoBefore.st_size             &&
+					STAT_MTIME(infoAfter).tv_sec  == STAT_MTIME(infoBefore).tv_sec  &&
+					STAT_MTIME(infoAfter).tv_nsec == STAT_MTIME(infoBefore).tv_nsec;
+		}
+
+	close(theCopy.fd);
+
+
+
+	// Publish the copy
+	//
+	// A file that was modified through the mount while it was being copied
+	// has lost its entry, and its copy is discarded.
+	std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+
+	auto theIter = gTier.theEntries.find(theCopy.fileID);
+
+	if (theIter != gTier.theEntries.end() && theIter->second.isCopying)
+		{
+		logfuse_tier_entry &theEntry = theIter->second;
+
+		theEntry.isCopying  = false;
+		theEntry.isExcluded = isExcluded;
+		didCopy             = didCopy && logfuse_tier_evict((size_t) infoBefore.st_size) &&
+								renameat(gTier.fd, tmpName.c_str(), gTier.fd, theName.c_str()) == 0;
+
+		if (didCopy)
+			{
+			theEntry.isCopied  = true;
+			theEntry.theSize   = infoBefore.st_size;
+			theEntry.modTime   = STAT_MTIME(infoBefore);
+			theEntry.copyIter  = gTier.theCopies.insert(gTier.theCopies.begin(), theCopy.fileID);
+			gTier.theSize     += (size_t) infoBefore.st_size;
+
+			logfuse_stat_add(kStatTierCopy);
+			}
+		}
+	else
+		didCopy = false;
+
+	if (!didCopy)
+		unlinkat(gTier.fd, tmpName.c_str(), 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_invalidate : Invalidate a file in the tier.
+//----------------------------------------------------------------------------
+static void logfuse_tier_invalidate(const logfuse_file_id &fileID)
+{
+
+
+	// Invalidate the file
+	//
+	// Writes go to the original, so its copy is discarded along with any copy
+	// that is in progress.
+	if (!gConfig.tierPath.empty())
+		{
+		std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+
+		auto theIter = gTier.theEntries.find(fileID);
+		if (theIter != gTier.theEntries.end())
+			{
+			logfuse_tier_discard(fileID, theIter->second);
+			gTier.theEntries.erase(theIter);
+			}
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_thread : Tier thread.
+//----------------------------------------------------------------------------
+static void logfuse_tier_thread()
+{	logfuse_tier_copy		theCopy;
+
+
+
+	// Copy files
+	//
+	// Files are copied one at a time, to limit the load on the backing store.
+	while (true)
+		{
+		{	std::unique_lock<std::mutex>	acquireLock(gTier.theLock);
+
+			gTier.theSignal.wait(acquireLock, [] { return(!gTier.thePending.empty() || gTier.isStopping); });
+
+			if (gTier.isStopping)
+				break;
+
+			theCopy = gTier.thePending.front();
+			gTier.thePending.pop_front();
+		}
+
+		logfuse_tier_copy_file(theCopy);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_tier_stop : Stop the tier thread.
+//----------------------------------------------------------------------------
+static void logfuse_tier_stop()
+{
+
+
+	// Stop the thread
+	//
+	// The thread must have exited before our globals are destroyed. Any copy
+	// in progress is abandoned after its current block, as are queued copies.
+	if (!gTier.theThread.joinable())
+		return;
+
+	{	std::lock_guard<std::mutex>		acquireLock(gTier.theLock);
+
+		gTier.isStopping = true;
+		gTier.theSignal.notify_one();
+	}
+
+	gTier.theThread.join();
+
+	for (const auto &theCopy : gTier.thePending)
+		close(theCopy.fd);
+
+	gTier.thePending.clear();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_remove : Remove an entry from the content cache.
+//----------------------------------------------------------------------------
+static void logfuse_content_remove(size_t theSlot)
+{	logfuse_content_ref		theContent;
+
+
+
+	// Remove the entry
+	//
+	// The caller must hold the cache lock.
+	theContent = gContentCache.theSlots[theSlot];
+
+	gContentCache.theIndex.erase(theContent->fileID);
+	gContentCache.theSlots[theSlot].reset();
+	gContentCache.freeSlots.push_back(theSlot);
+
+	gContentCache.totalBytes -= theContent->data.size();
+	theContent->isValid       = false;
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_evict : Evict entries from the content cache.
+//----------------------------------------------------------------------------
+static void logfuse_content_evict(size_t theSize)
+{	size_t		numSlots;
+
+
+
+	// Evict entries
+	//
+	// The caller must hold the cache lock.
+	//
+	// CLOCK eviction gives each entry a second chance if it has been used
+	// since the hand last passed, so the sweep ends within two revolutions.
+	numSlots = gContentCache.theSlots.size();
+
+	while (!gContentCache.theIndex.empty() && (gContentCache.totalBytes + theSize) > gConfig.contentCacheSize)
+		{
+		gContentCache.clockHand %= numSlots;
+
+		const logfuse_content_ref &theContent = gContentCache.theSlots[gContentCache.clockHand];
+
+		if (theContent != nullptr && !theContent->wasUsed.exchange(false))
+			logfuse_content_remove(gContentCache.clockHand);
+
+		gContentCache.clockHand++;
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_insert : Insert an entry into the content cache.
+//----------------------------------------------------------------------------
+static void logfuse_content_insert(const logfuse_content_ref &theContent)
+{	std::lock_guard<std::mutex>		acquireLock(gContentCache.theLock);
+	size_t							theSlot;
+
+
+
+	// Check our parameters
+	if (theContent->data.size() > gConfig.contentCacheSize)
+		return;
+
+
+
+	// Make space for the entry
+	auto theIter = gContentCache.theIndex.find(theContent->fileID);
+	if (theIter != gContentCache.theIndex.end())
+		logfuse_content_remove(theIter->second);
+
+	logfuse_content_evict(theContent->data.size());
+
+
+
+	// Insert the entry
+	if (gContentCache.freeSlots.empty())
+		{
+		theSlot = gContentCache.theSlots.size();
+		gContentCache.theSlots.push_back(theContent);
+		}
+	else
+		{
+		theSlot = gContentCache.freeSlots.back();
+		gContentCache.freeSlots.pop_back();
+		gContentCache.theSlots[theSlot] = theContent;
+		}
+
+	gContentCache.theIndex[theContent->fileID] = theSlot;
+	gContentCache.totalBytes                  += theContent->data.size();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_find : Find an entry in the content cache.
+//----------------------------------------------------------------------------
+static logfuse_content_ref logfuse_content_find(const struct stat &statInfo)
+{	std::lock_guard<std::mutex>		acquireLock(gContentCache.theLock);
+	logfuse_file_id					fileID = { statInfo.st_dev, statInfo.st_ino };
+
+
+
+	// Find the entry
+	auto theIter = gContentCache.theIndex.find(fileID);
+	if (theIter == gContentCache.theIndex.end())
+		return(nullptr);
+
+
+
+	// Validate the entry
+	//
+	// An entry whose size or modification time no longer matches the file
+	// has been modified outside the mount, and is discarded.
+	const logfuse_content_ref &theContent = gContentCache.theSlots[theIter->second];
+
+	if (theContent->size             != statInfo.st_size              ||
+		theContent->modTime.tv_sec   != STAT_MTIME(statInfo).tv_sec   ||
+		theContent->modTime.tv_nsec  != STAT_MTIME(statInfo).tv_nsec)
+		{
+		logfuse_content_remove(theIter->second);
+		return(nullptr);
+		}
+
+	theContent->wasUsed = true;
+
+	return(theContent);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_load : Load a file into the content cache.
+//----------------------------------------------------------------------------
+static logfuse_content_ref logfuse_content_load(int fd, const struct stat &statInfo)
+{	logfuse_content_ref		theContent;
+	struct stat				newInfo;
+	size_t					theSize;
+	ssize_t					sysErr;
+
+
+
+	// Create the entry
+	theContent = std::make_shared<logfuse_content>();
+
+	theContent->fileID.dev = statInfo.st_dev;
+	theContent->fileID.ino = statInfo.st_ino;
+	theContent->modTime    = STAT_MTIME(statInfo);
+	theContent->size       = statInfo.st_size;
+	theContent->isValid    = true;
+	theContent->wasUsed    = true;
+
+
+
+	// Read the file
+	//
+	// We read one byte more than we expect, to detect a file that has grown.
+	theContent->data.resize((size_t) statInfo.st_size + 1);
+	theSize = 0;
+
+	while (theSize < theContent->data.size())
+		{
+		sysErr = pread(fd, &theContent->data[theSize], theContent->data.size() - theSize, (off_t) theSize);
+		if (sysErr <= 0)
+			break;
+
+		theSize += (size_t) sysErr;
+		}
+
+	if (theSize != (size_t) statInfo.st_size)
+		return(nullptr);
+
+	theContent->data.resize(theSize);
+
+
+
+	// Validate the file
+	//
+	// A file that was modified while we read it may be inconsistent.
+	if (fstat(fd, &newInfo) != 0                                ||
+		newInfo.st_size             != statInfo.st_size            ||
+		STAT_MTIME(newInfo).tv_sec  != STAT_MTIME(statInfo).tv_sec ||
+		STAT_MTIME(newInfo).tv_nsec != STAT_MTIME(statInfo).tv_nsec)
+		return(nullptr);
+
+	logfuse_content_insert(theContent);
+
+	return(theContent);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_invalidate : Invalidate a file in the content cache.
+//----------------------------------------------------------------------------
+static void logfuse_content_invalidate(const logfuse_file_id &fileID)
+{	logfuse_errno_saver	saveErrno;
+
+
+
+	// Invalidate the file
+	//
+	// A change to the contents of a file also discards its copy in the tier.
+	if (gConfig.contentCacheSize != 0)
+		{
+		std::lock_guard<std::mutex>		acquireLock(gContentCache.theLock);
+
+		auto theIter = gContentCache.theIndex.find(fileID);
+		if (theIter != gContentCache.theIndex.end())
+			logfuse_content_remove(theIter->second);
+		}
+
+	logfuse_tier_invalidate(fileID);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_content_invalidate_path : Invalidate a path in the content cache.
+//----------------------------------------------------------------------------
+static void logfuse_content_invalidate_path(const char *path)
+{	struct stat			statInfo;
+	logfuse_errno_saver	saveErrno;
+
+
+
+	// Invalidate the path
+	if ((gConfig.contentCacheSize != 0 || !gConfig.tierPath.empty()) &&
+		fstatat(logfuse_root_fd(), logfuse_path(path), &statInfo, AT_SYMLINK_NOFOLLOW) == 0)
+		logfuse_content_invalidate({ statInfo.st_dev, statInfo.st_ino });
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_new_file : Create the file info for an open file.
+//----------------------------------------------------------------------------
+static logfuse_file_info *logfuse_new_file(int fd, int flags)
+{	logfuse_file_info		*theFile;
+	struct stat				statInfo;
+
+
+
+	// Create the file info
+	theFile = new (std::nothrow) logfuse_file_info;
+	if (theFile == nullptr)
+		return(nullptr);
+
+	theFile->fd         = fd;
+	theFile->flags      = flags;
+	theFile->wasLocked  = false;
+	theFile->isTiered   = false;
+	theFile->fileID.dev = 0;
+	theFile->fileID.ino = 0;
+
+
+
+	// Prepare the content cache
+	//
+	// When the cache or the tier is enabled every open file is identified, so
+	// that any modification through the mount can invalidate it. Small files
+	// opened for reading are served from the cache.
+	if ((gConfig.contentCacheSize != 0 || !gConfig.tierPath.empty()) && fstat(fd, &statInfo) == 0)
+		{
+		theFile->fileID.dev = statInfo.st_dev;
+		theFile->fileID.ino = statInfo.st_ino;
+
+		if ((flags & O_TRUNC) != 0)
+			logfuse_content_invalidate(theFile->fileID);
+
+		else if (gConfig.contentCacheSize != 0 && (flags & O_ACCMODE) == O_RDONLY && S_ISREG(statInfo.st_mode) &&
+					statInfo.st_size <= (off_t) gConfig.contentCacheMax)
+			{
+			theFile->content = logfuse_content_find(statInfo);
+			if (theFile->content != nullptr)
+				logfuse_stat_add(kStatContentCacheHit);
+			else
+				{
+				logfuse_stat_add(kStatContentCacheMiss);
+				theFile->content = logfuse_content_load(fd, statInfo);
+				}
+			}
+		}
+
+	return(theFile);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_advance : Advance a node stamp.
+//----------------------------------------------------------------------------
+static void logfuse_node_advance(std::atomic<uint64_t> &theStamp, uint64_t newStamp)
+{	uint64_t	oldStamp;
+
+
+
+	// Advance the stamp
+	//
+	// Invalidations may race, so a stamp only ever moves forwards.
+	oldStamp = theStamp.load();
+
+	while (oldStamp < newStamp && !theStamp.compare_exchange_weak(oldStamp, newStamp))
+		{
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_child : Find the child of a node.
+//----------------------------------------------------------------------------
+static logfuse_node *logfuse_node_child(logfuse_node *theNode, const std::string &theName, bool canCreate)
+{
+
+
+	// Find the child
+	//
+	// The caller must hold the table lock, exclusively if nodes can be
+	// created. New nodes are stamped as invalid up to the last time a child
+	// of their parent was discarded, as a value fetched before then may have
+	// been fetched for the discarded node.
+	auto theIter = theNode->children.find(theName);
+	if (theIter != theNode->children.end())
+		return(theIter->second.get());
+
+	if (!canCreate)
+		return(nullptr);
+
+	std::unique_ptr<logfuse_node> newNode(new logfuse_node);
+	logfuse_node                  *theChild = newNode.get();
+
+	newNode->parent     = theNode;
+	newNode->name       = theName;
+	newNode->nodeID     = gNodes.nextID++;
+	newNode->childStamp = theNode->childStamp.load();
+	newNode->wasFound   = true;
+
+	for (size_t n = 0; n < kNodeStampCount; n++)
+		{
+		newNode->selfStamps[n] = newNode->childStamp.load();
+		newNode->treeStamps[n] = 0;
+		}
+
+	newNode->clockIter = gNodes.theClock.insert(gNodes.theClock.end(), theChild);
+
+	theNode->children[theName] = std::move(newNode);
+	gNodes.numNodes++;
+
+	return(theChild);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_walk : Find the node for a path.
+//----------------------------------------------------------------------------
+static logfuse_node *logfuse_node_walk(const char *path, bool canCreate, logfuse_node **theNearest)
+{	std::string		theName;
+	logfuse_mount	*theMount;
+	logfuse_node	*theNode;
+	const char		*theSep;
+
+
+
+	// Find the root
+	//
+	// The paths of an extra mount start from its own node.
+	theNode = &gNodes.theRoot;
+
+	if (theNearest != nullptr)
+		*theNearest = theNode;
+
+	theMount = logfuse_current_mount();
+
+	if (theMount != nullptr && !theMount->nodeName.empty())
+		theNode = logfuse_node_child(theNode, theMount->nodeName, canCreate);
+
+
+
+	// Find the node
+	//
+	// The nearest node is the deepest node that exists on the path.
+	while (theNode != nullptr && *path != 0x00)
+		{
+		if (*path == '/')
+			{
+			path++;
+			continue;
+			}
+
+		theSep = strchr(path, '/');
+		if (theSep == nullptr)
+			theSep = path + strlen(path);
+
+		theName.assign(path, (size_t) (theSep - path));
+		path = theSep;
+
+		if (theNearest != nullptr)
+			*theNearest = theNode;
+
+		theNode = logfuse_node_child(theNode, theName, canCreate);
+		}
+
+	if (theNearest != nullptr && theNode != nullptr)
+		*theNearest = theNode;
+
+	return(theNode);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_latest : Get the newest stamp that applies to a node.
+//----------------------------------------------------------------------------
+static uint64_t logfuse_node_latest(const logfuse_node *theNode, logfuse_node_stamp theKind)
+{	uint64_t	theStamp;
+
+
+
+	// Get the stamp
+	//
+	// The caller must hold the table lock. Any invalidation of the tree above
+	// a node also applies to the node.
+	theStamp = theNode->selfStamps[theKind];
+
+	while (theNode != nullptr)
+		{
+		theStamp = std::max(theStamp, theNode->treeStamps[theKind].load());
+		theNode  = theNode->parent;
+		}
+
+	return(theStamp);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_release : Release a detached node and its children.
+//----------------------------------------------------------------------------
+static size_t logfuse_node_release(const logfuse_node *theNode)
+{	size_t		numNodes;
+
+
+
+	// Release the nodes
+	//
+	// The caller must hold the table lock exclusively.
+	numNodes = 1;
+
+	gNodes.theClock.erase(theNode->clockIter);
+
+	for (const auto &theChild : theNode->children)
+		numNodes += logfuse_node_release(theChild.second.get());
+
+	return(numNodes);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_detach : Detach a node from its parent.
+//----------------------------------------------------------------------------
+static std::unique_ptr<logfuse_node> logfuse_node_detach(const char *path)
+{	std::unique_ptr<logfuse_node>	theNode;
+	logfuse_node					*theChild;
+	logfuse_node					*theParent;
+
+
+
+	// Detach the node
+	//
+	// The caller must hold the table lock exclusively. The parent of the path
+	// is stamped even if the path has no node, as a value being fetched for
+	// it may be inserted after this point.
+	theChild = logfuse_node_walk(path, false, &theParent);
+	if (theChild != nullptr)
+		theParent = theChild->parent;
+
+	if (theParent != nullptr)
+		logfuse_node_advance(theParent->childStamp, logfuse_time_now());
+
+	if (theChild != nullptr && theParent != nullptr)
+		{
+		auto theIter = theParent->children.find(theChild->name);
+
+		theNode = std::move(theIter->second);
+		theParent->children.erase(theIter);
+		}
+
+	return(theNode);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_evict : Evict a node from a full table.
+//----------------------------------------------------------------------------
+static bool logfuse_node_evict()
+{	logfuse_node	*theNode;
+	logfuse_node	*theParent;
+
+
+
+	// Evict a node
+	//
+	// The caller must hold the table lock exclusively. The hand passes over
+	// nodes that have children or have been found since it last passed them,
+	// so every node is considered within two turns of the clock.
+	for (size_t n = 0; n < gNodes.theClock.size() * 2; n++)
+		{
+		theNode = gNodes.theClock.front();
+
+		if (!theNode->children.empty() || theNode->wasFound.load(std::memory_order_relaxed))
+			{
+			theNode->wasFound.store(false, std::memory_order_relaxed);
+			gNodes.theClock.splice(gNodes.theClock.end(), gNodes.theClock, gNodes.theClock.begin());
+			continue;
+			}
+
+		theParent = theNode->parent;
+		logfuse_node_advance(theParent->childStamp, logfuse_time_now());
+
+		gNodes.theClock.pop_front();
+		gNodes.numNodes--;
+
+		theParent->children.erase(theNode->name);
+
+		return(true);
+		}
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_find : Find the node for a path.
+//----------------------------------------------------------------------------
+static bool logfuse_node_find(const char *path, logfuse_node_stamp theKind, uint64_t *nodeID, uint64_t *theStamp)
+{	std::shared_lock<std::shared_timed_mutex>	acquireLock(gNodes.theLock);
+	logfuse_node								*theNode;
+
+
+
+	// Find the node
+	//
+	// Found nodes are marked for the clock, which is only written when it
+	// changes to avoid contending on nodes that are found often.
+	theNode = logfuse_node_walk(path, false, nullptr);
+	if (theNode == nullptr)
+		return(false);
+
+	if (!theNode->wasFound.load(std::memory_order_relaxed))
+		theNode->wasFound.store(true, std::memory_order_relaxed);
+
+	*nodeID = theNode->nodeID;
+
+	if (theKind != kNodeStampCount)
+		*theStamp = logfuse_node_latest(theNode, theKind);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_intern : Intern a path.
+//----------------------------------------------------------------------------
+static void logfuse_node_intern(const char *path, logfuse_node_stamp theKind, uint64_t *nodeID, uint64_t *theStamp)
+{	logfuse_node	*theNode;
+
+
+
+	// Find the node
+	//
+	// Most paths are already interned, which only needs a shared lock.
+	if (logfuse_node_find(path, theKind, nodeID, theStamp))
+		return;
+
+
+
+	// Create the node
+	//
+	// A full table evicts cold nodes to make space.
+	std::lock_guard<std::shared_timed_mutex>	acquireLock(gNodes.theLock);
+
+	while (gNodes.numNodes >= kPathCacheMaxEntries && logfuse_node_evict())
+		{
+		}
+
+	theNode = logfuse_node_walk(path, true, nullptr);
+	*nodeID = theNode->nodeID;
+
+	if (theKind != kNodeStampCount)
+		*theStamp = logfuse_node_latest(theNode, theKind);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_invalidate : Invalidate a path's node.
+//----------------------------------------------------------------------------
+static bool logfuse_node_invalidate(const char *path, logfuse_node_stamp theKind, bool withChildren, uint64_t *nodeID)
+{	std::shared_lock<std::shared_timed_mutex>	acquireLock(gNodes.theLock);
+	logfuse_node								*theNearest;
+	logfuse_node								*theNode;
+	uint64_t									theStamp;
+
+
+
+	// Invalidate the node
+	//
+	// A path with no node stamps its nearest node as if a child had been
+	// discarded, as a value being fetched for it may be inserted after this
+	// point.
+	theStamp = logfuse_time_now();
+	theNode  = logfuse_node_walk(path, false, &theNearest);
+
+	if (theNode == nullptr)
+		{
+		logfuse_node_advance(theNearest->childStamp, theStamp);
+		return(false);
+		}
+
+	if (withChildren)
+		logfuse_node_advance(theNode->treeStamps[theKind], theStamp);
+	else
+		logfuse_node_advance(theNode->selfStamps[theKind], theStamp);
+
+	*nodeID = theNode->nodeID;
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_remove : Remove a path's node.
+//----------------------------------------------------------------------------
+static void logfuse_node_remove(const char *path)
+{	std::unique_ptr<logfuse_node>		theNode;
+
+
+
+	// Remove the node
+	//
+	// Removing a node invalidates every value cached for the path and its
+	// children, in every cache.
+	{	std::lock_guard<std::shared_timed_mutex>	acquireLock(gNodes.theLock);
+
+		theNode = logfuse_node_detach(path);
+		if (theNode != nullptr)
+			gNodes.numNodes -= logfuse_node_release(theNode.get());
+	}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_node_rename : Rename a path's node.
+//----------------------------------------------------------------------------
+static void logfuse_node_rename(const char *from, const char *to)
+{	std::unique_ptr<logfuse_node>		oldNode;
+	std::unique_ptr<logfuse_node>		theNode;
+	logfuse_node						*theParent;
+	std::string							theName;
+	const char							*theSep;
+
+
+
+	// Check our parameters
+	if (strcmp(from, to) == 0)
+		return;
+
+
+
+	// Rename the node
+	//
+	// The node keeps its ID and children, so values cached for the renamed
+	// tree remain valid unless they depend on the new location.
+	{	std::lock_guard<std::shared_timed_mutex>	acquireLock(gNodes.theLock);
+
+		oldNode = logfuse_node_detach(to);
+		if (oldNode != nullptr)
+			gNodes.numNodes -= logfuse_node_release(oldNode.get());
+
+		theNode = logfuse_node_detach(from);
+		theSep  = strrchr(to, '/');
+
+		if (theNode != nullptr && theSep != nullptr && theSep[1] != 0x00)
+			{
+			theName.assign(theSep + 1);
+			theParent = logfuse_node_walk(std::string(to, (size_t) (theSep - to)).c_str(), true, nullptr);
+
+			theNode->parent = theParent;
+			theNode->name   = theName;
+			theParent->children[theName] = std::move(theNode);
+			}
+
+		else if (theNode != nullptr)
+			gNodes.numNodes -= logfuse_node_release(theNode.get());
+	}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_cache_shard : Get the shard for a node.
+//----------------------------------------------------------------------------
+template<typename T, logfuse_node_stamp K>
+static logfuse_path_shard<T> &logfuse_path_cache_shard(logfuse_path_cache<T, K> &theCache, uint64_t nodeID)
+{
+
+
+	// Get the shard
+	return(theCache.theShards[nodeID % kPathCacheShards]);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_cache_find : Find a path in a path cache.
+//----------------------------------------------------------------------------
+template<typename T, logfuse_node_stamp K>
+static bool logfuse_path_cache_find(logfuse_path_cache<T, K> &theCache, const char *path, T *theValue, uint64_t *theGeneration)
+{	uint64_t		nodeID;
+	uint64_t		theStamp;
+
+
+
+	// Get the state we need
+	//
+	// The generation must be taken before the node's stamps are checked, so
+	// that any later invalidation will discard a value fetched after a miss.
+	*theGeneration = logfuse_time_now();
+
+	if (!logfuse_node_find(path, K, &nodeID, &theStamp))
+		return(false);
+
+
+
+	// Find the entry
+	logfuse_path_shard<T>			&theShard = logfuse_path_cache_shard(theCache, nodeID);
+	std::lock_guard<std::mutex>		acquireLock(theShard.theLock);
+
+	auto theIter = theShard.theEntries.find(nodeID);
+	if (theIter == theShard.theEntries.end())
+		return(false);
+
+	if (theIter->second.expires <= *theGeneration || theIter->second.stamp <= theStamp)
+		{
+		theShard.theEntries.erase(theIter);
+		return(false);
+		}
+
+	*theValue = theIter->second.value;
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_cache_insert : Insert a path into a path cache.
+//----------------------------------------------------------------------------
+template<typename T, logfuse_node_stamp K>
+static void logfuse_path_cache_insert(logfuse_path_cache<T, K> &theCache, const char *path, const T &theValue, uint64_t theTTL, uint64_t theGeneration)
+{	uint64_t		timeNow;
+	uint64_t		nodeID;
+	uint64_t		theStamp;
+
+
+
+	// Check our state
+	//
+	// A value fetched before the path was last invalidated is discarded, as
+	// is one fetched at the same time.
+	logfuse_node_intern(path, K, &nodeID, &theStamp);
+
+	if (theGeneration <= theStamp)
+		return;
+
+
+
+	// Make space for the entry
+	//
+	// A full shard is purged of expired entries, and if that fails to make
+	// space then an arbitrary entry is discarded.
+	logfuse_path_shard<T>			&theShard = logfuse_path_cache_shard(theCache, nodeID);
+	std::lock_guard<std::mutex>		acquireLock(theShard.theLock);
+
+	timeNow = logfuse_time_now();
+
+	if (theShard.theEntries.size() >= (kPathCacheMaxEntries / kPathCacheShards))
+		{
+		for (auto theIter = theShard.theEntries.begin(); theIter != theShard.theEntries.end(); )
+			{
+			if (theIter->second.expires <= timeNow)
+				theIter = theShard.theEntries.erase(theIter);
+			else
+				theIter++;
+			}
+
+		if (theShard.theEntries.size() >= (kPathCacheMaxEntries / kPathCacheShards))
+			theShard.theEntries.erase(theShard.theEntries.begin());
+		}
+
+
+
+	// Insert the entry
+	logfuse_path_entry<T> &theEntry = theShard.theEntries[nodeID];
+
+	theEntry.value   = theValue;
+	theEntry.expires = timeNow + theTTL;
+	theEntry.stamp   = theGeneration;
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_cache_remove : Remove a path from a path cache.
+//----------------------------------------------------------------------------
+template<typename T, logfuse_node_stamp K>
+static void logfuse_path_cache_remove(logfuse_path_cache<T, K> &theCache, const char *path)
+{	uint64_t		nodeID;
+
+
+
+	// Remove the entry
+	if (logfuse_node_invalidate(path, K, false, &nodeID))
+		{
+		logfuse_path_shard<T>			&theShard = logfuse_path_cache_shard(theCache, nodeID);
+		std::lock_guard<std::mutex>		acquireLock(theShard.theLock);
+
+		theShard.theEntries.erase(nodeID);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_cache_remove_tree : Remove a path and its children from a path cache.
+//----------------------------------------------------------------------------
+template<typename T, logfuse_node_stamp K>
+static void logfuse_path_cache_remove_tree(logfuse_path_cache<T, K> &theCache, const char *path)
+{	uint64_t		nodeID;
+
+
+
+	// Remove the entries
+	//
+	// Entries below the path are discarded as they are found, rather than
+	// searching every shard for them.
+	logfuse_node_invalidate(path, K, true, &nodeID);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parent_path : Get the parent of a path.
+//----------------------------------------------------------------------------
+static bool logfuse_parent_path(const char *path, std::string &theParent)
+{	const char		*theSep;
+
+
+
+	// Get the parent
+	theSep = strrchr(path, '/');
+	if (theSep == nullptr)
+		return(false);
+
+	theParent.assign(path, theSep == path ? 1 : (size_t) (theSep - path));
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_cache_remove : Remove a directory from the directory cache.
+//----------------------------------------------------------------------------
+static void logfuse_dir_cache_remove(uint64_t nodeID)
+{
+
+
+	// Remove the entry
+	//
+	// The caller must hold the cache lock.
+	auto theIter = gDirCache.theIndex.find(nodeID);
+	if (theIter != gDirCache.theIndex.end())
+		{
+		gDirCache.totalBytes -= theIter->second.snapshot->theSize;
+		gDirCache.theLRU.erase(theIter->second.lruIter);
+		gDirCache.theIndex.erase(theIter);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_cache_find : Find a directory in the directory cache.
+//----------------------------------------------------------------------------
+static logfuse_dir_snapshot_ref logfuse_dir_cache_find(const char *path, const struct stat &statInfo)
+{	uint64_t		nodeID;
+	uint64_t		theStamp;
+
+
+
+	// Find the entry
+	if (!logfuse_node_find(path, kNodeStampCount, &nodeID, &theStamp))
+		return(nullptr);
+
+	std::lock_guard<std::mutex>		acquireLock(gDirCache.theLock);
+
+	auto theIter = gDirCache.theIndex.find(nodeID);
+	if (theIter == gDirCache.theIndex.end())
+		return(nullptr);
+
+
+
+	// Validate the entry
+	//
+	// Snapshots are found by path but identified by the directory itself, and
+	// any change to the directory will update its modification or change time.
+	const logfuse_dir_snapshot_ref &theSnapshot = theIter->second.snapshot;
+
+	if (theSnapshot->dirID.dev            != statInfo.st_dev              ||
+		theSnapshot->dirID.ino            != statInfo.st_ino              ||
+		theSnapshot->modTime.tv_sec       != STAT_MTIME(statInfo).tv_sec  ||
+		theSnapshot->modTime.tv_nsec      != STAT_MTIME(statInfo).tv_nsec ||
+		theSnapshot->changeTime.tv_sec    != STAT_CTIME(statInfo).tv_sec  ||
+		theSnapshot->changeTime.tv_nsec   != STAT_CTIME(statInfo).tv_nsec)
+		{
+		logfuse_dir_cache_remove(nodeID);
+		return(nullptr);
+		}
+
+	gDirCache.theLRU.splice(gDirCache.theLRU.begin(), gDirCache.theLRU, theIter->second.lruIter);
+
+	return(theSnapshot);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_cache_insert : Insert a directory into the directory cache.
+//----------------------------------------------------------------------------
+static void logfuse_dir_cache_insert(const char *path, const logfuse_dir_snapshot_ref &theSnapshot)
+{	uint64_t		nodeID;
+	uint64_t		theStamp;
+
+
+
+	// Make space for the entry
+	logfuse_node_intern(path, kNodeStampCount, &nodeID, &theStamp);
+
+	std::lock_guard<std::mutex>		acquireLock(gDirCache.theLock);
+
+	logfuse_dir_cache_remove(nodeID);
+
+	while (!gDirCache.theLRU.empty() && (gDirCache.totalBytes + theSnapshot->theSize) > gConfig.dirCacheSize)
+		logfuse_dir_cache_remove(gDirCache.theLRU.back());
+
+
+
+	// Insert the entry
+	gDirCache.theLRU.push_front(nodeID);
+
+	gDirCache.theIndex[nodeID] = { theSnapshot, gDirCache.theLRU.begin() };
+	gDirCache.totalBytes       += theSnapshot->theSize;
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_dir_cache_invalidate : Invalidate a directory in the directory cache.
+//----------------------------------------------------------------------------
+static void logfuse_dir_cache_invalidate(const char *path)
+{	uint64_t		nodeID;
+	uint64_t		theStamp;
+
+
+
+	// Invalidate the directory
+	if (gConfig.dirCacheSize != 0 && logfuse_node_find(path, kNodeStampCount, &nodeID, &theStamp))
+		{
+		std::lock_guard<std::mutex>		acquireLock(gDirCache.theLock);
+
+		logfuse_dir_cache_remove(nodeID);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_path_caching : Are any values being cached by path?
+//----------------------------------------------------------------------------
+static bool logfuse_path_caching(const logfuse_settings *theSettings)
+{
+
+
+
+	// Check the caches
+	//
+	// Nodes only need to follow the file system while values are cached for
+	// them, and a cache that is enabled by a reload is invalidated as a whole.
+	return(theSettings->attrCacheTTL     != 0 ||
+		   theSettings->negativeCacheTTL != 0 ||
+		   theSettings->accessCacheTTL   != 0 ||
+		   theSettings->xattrCacheTTL    != 0 ||
+		   gConfig.dirCacheSize          != 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_invalidate_attr : Invalidate the attributes of a path.
+//----------------------------------------------------------------------------
+static void logfuse_invalidate_attr(const char *path)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	std::string				theParent;
+	logfuse_errno_saver		saveErrno;
+
+
+
+	// Invalidate the path
+	//
+	// Directory snapshots that hold the full attributes of their entries must
+	// also be invalidated when an entry changes.
+	if (theSettings->attrCacheTTL != 0)
+		logfuse_path_cache_remove(gAttrCache, path);
+
+	if (theSettings->xattrCacheTTL != 0)
+		logfuse_path_cache_remove(gXattrCache, path);
+
+	if (gConfig.dirCacheSize != 0 && gConfig.readdirStat && logfuse_parent_path(path, theParent))
+		logfuse_dir_cache_invalidate(theParent.c_str());
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_invalidate_access : Invalidate the permissions of a path.
+//----------------------------------------------------------------------------
+static void logfuse_invalidate_access(const char *path)
+{	logfuse_errno_saver	saveErrno;
+
+
+
+	// Invalidate the path
+	//
+	// Access to a path depends on the permissions of every directory above
+	// it, so changes to a directory invalidate everything below it.
+	if (logfuse_get_settings()->accessCacheTTL != 0)
+		logfuse_path_cache_remove_tree(gAccessCache, path);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_invalidate_name : Invalidate a created or removed path.
+//----------------------------------------------------------------------------
+static void logfuse_invalidate_name(const char *path)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	std::string				theParent;
+	bool					hasParent;
+	logfuse_errno_saver		saveErrno;
+
+
+
+	// Invalidate the path
+	//
+	// Creating or removing a name changes the parent directory, and discards
+	// the path's node along with everything cached for it and below it.
+	hasParent = logfuse_parent_path(path, theParent);
+
+	logfuse_dir_cache_invalidate(path);
+
+	if (logfuse_path_caching(theSettings))
+		logfuse_node_remove(path);
+
+	if (hasParent)
+		{
+		if (theSettings->attrCacheTTL != 0)
+			logfuse_path_cache_remove(gAttrCache, theParent.c_str());
+
+		logfuse_dir_cache_invalidate(theParent.c_str());
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_invalidate_rename : Invalidate a renamed path.
+//----------------------------------------------------------------------------
+static void logfuse_invalidate_rename(const char *from, const char *to)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	std::string				fromParent;
+	std::string				toParent;
+	logfuse_errno_saver		saveErrno;
+
+
+
+	// Invalidate the paths
+	//
+	// The renamed node keeps the values cached below it, apart from access
+	// checks that depend on the directories above it. Any node it replaced
+	// is discarded.
+	logfuse_dir_cache_invalidate(from);
+	logfuse_dir_cache_invalidate(to);
+
+	if (logfuse_path_caching(theSettings))
+		logfuse_node_rename(from, to);
+
+	if (theSettings->attrCacheTTL != 0)
+		logfuse_path_cache_remove(gAttrCache, to);
+
+	logfuse_invalidate_access(to);
+
+	if (logfuse_parent_path(from, fromParent))
+		{
+		if (theSettings->attrCacheTTL != 0)
+			logfuse_path_cache_remove(gAttrCache, fromParent.c_str());
+
+		logfuse_dir_cache_invalidate(fromParent.c_str());
+		}
+
+	if (logfuse_parent_path(to, toParent) && toParent != fromParent)
+		{
+		if (theSettings->attrCacheTTL != 0)
+			logfuse_path_cache_remove(gAttrCache, toParent.c_str());
+
+		logfuse_dir_cache_invalidate(toParent.c_str());
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_invalidate_created : Invalidate a created path.
+//----------------------------------------------------------------------------
+static void logfuse_invalidate_created(const char *path, bool withChildren)
+{	logfuse_errno_saver	saveErrno;
+
+
+
+	// Invalidate the path
+	//
+	// A new symlink or a renamed directory can also bring paths below it into
+	// existence, so their children must be invalidated as well.
+	if (logfuse_get_settings()->negativeCacheTTL != 0)
+		{
+		if (withChildren)
+			logfuse_path_cache_remove_tree(gNegativeCache, path);
+		else
+			logfuse_path_cache_remove(gNegativeCache, path);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_negative_find : Check for a path that does not exist.
+//----------------------------------------------------------------------------
+static bool logfuse_negative_find(const logfuse_settings *theSettings, const char *path, uint64_t *theGeneration)
+{	bool	theValue;
+
+
+
+	// Check the cache
+	//
+	// Each hit saves a call to the backing store.
+	if (theSettings->negativeCacheTTL == 0)
+		return(false);
+
+	if (logfuse_path_cache_find(gNegativeCache, path, &theValue, theGeneration))
+		{
+		logfuse_stat_add(kStatNegativeCacheHit);
+		return(true);
+		}
+
+	logfuse_stat_add(kStatNegativeCacheMiss);
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_negative_insert : Record a path that does not exist.
+//----------------------------------------------------------------------------
+static void logfuse_negative_insert(const logfuse_settings *theSettings, const char *path, int sysErr, uint64_t theGeneration)
+{	logfuse_errno_saver	saveErrno;
+
+
+
+	// Update the cache
+	if (theSettings->negativeCacheTTL != 0 && sysErr == -1 && errno == ENOENT)
+		logfuse_path_cache_insert(gNegativeCache, path, true, theSettings->negativeCacheTTL, theGeneration);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_access_caller : Get the credentials of the caller.
+//----------------------------------------------------------------------------
+static logfuse_access_result logfuse_access_caller(const logfuse_settings *theSettings, int mode)
+{	fuse_context			*theContext = fuse_get_context();
+	logfuse_access_result	theResult = {};
+
+
+
+	// Get the caller
+	//
+	// The caller only identifies a cached result, so is not needed when the
+	// cache is disabled.
+	theResult.uid  = theContext->uid;
+	theResult.gid  = theContext->gid;
+	theResult.mode = mode;
+
+	if (theSettings->accessCacheTTL == 0)
+		return(theResult);
+
+
+
+	// Get the groups
+	//
+	// Supplementary groups are not available from macFUSE, where the primary
+	// group identifies the caller.
+	//
+	// Each thread keeps a buffer for the groups, which grows to hold the
+	// largest set of groups it has seen.
+#if !FUSE_APPLE
+	static thread_local std::vector<gid_t>	theGroups(kAccessCacheGroups);
+	int										numGroups;
+
+	numGroups = fuse_getgroups((int) theGroups.size(), theGroups.data());
+	if (numGroups > (int) theGroups.size())
+		{
+		theGroups.resize((size_t) numGroups);
+		numGroups = fuse_getgroups((int) theGroups.size(), theGroups.data());
+		}
+
+	numGroups = std::min(numGroups, (int) theGroups.size());
+
+	for (int n = 0; n < numGroups; n++)
+		theResult.groupsHash = (theResult.groupsHash * 31) + std::hash<gid_t>()(theGroups[n]);
+#endif
+
+	return(theResult);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_access_find : Find a cached permission check.
+//----------------------------------------------------------------------------
+static bool logfuse_access_find(const logfuse_settings *theSettings, const char *path, logfuse_access_result &theCaller, uint64_t *theGeneration)
+{	logfuse_access_results		theResults;
+	uint64_t					timeNow;
+
+
+
+	// Check the cache
+	if (theSettings->accessCacheTTL == 0)
+		return(false);
+
+	if (logfuse_path_cache_find(gAccessCache, path, &theResults, theGeneration))
+		{
+		timeNow = logfuse_time_now();
+
+		for (const auto &theResult : theResults)
+			{
+			if (theResult.uid        == theCaller.uid        &&
+				theResult.gid        == theCaller.gid        &&
+				theResult.groupsHash == theCaller.groupsHash &&
+				theResult.mode       == theCaller.mode       &&
+				theResult.expires    >  timeNow)
+				{
+				theCaller.sysErr = theResult.sysErr;
+				logfuse_stat_add(kStatAccessCacheHit);
+				return(true);
+				}
+			}
+		}
+
+	logfuse_stat_add(kStatAccessCacheMiss);
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_access_insert : Cache a permission check.
+//----------------------------------------------------------------------------
+static void logfuse_access_insert(const logfuse_settings *theSettings, const char *path, logfuse_access_result &theCaller, uint64_t theGeneration)
+{	logfuse_access_results		theResults;
+	uint64_t					unusedGeneration;
+	uint64_t					timeNow;
+	logfuse_errno_saver			saveErrno;
+
+
+
+	// Update the cache
+	//
+	// Each result carries its own expiry, as the list for a path is replaced
+	// whenever a new result is added to it.
+	if (theSettings->accessCacheTTL == 0)
+		return;
+
+	timeNow = logfuse_time_now();
+
+	if (logfuse_path_cache_find(gAccessCache, path, &theResults, &unusedGeneration))
+		{
+		theResults.erase(std::remove_if(theResults.begin(), theResults.end(),
+							[&](const logfuse_access_result &theResult)
+							{
+								return(theResult.expires <= timeNow ||
+									   (theResult.uid        == theCaller.uid        &&
+										theResult.gid        == theCaller.gid        &&
+										theResult.groupsHash == theCaller.groupsHash &&
+										theResult.mode       == theCaller.mode));
+							}), theResults.end());
+
+		if (theResults.size() >= kAccessCacheMaxResults)
+			theResults.erase(theResults.begin());
+		}
+
+	theCaller.expires = timeNow + theSettings->accessCacheTTL;
+	theResults.push_back(theCaller);
+
+	logfuse_path_cache_insert(gAccessCache, path, theResults, theSettings->accessCacheTTL, theGeneration);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_xattr_find : Find a cached extended attribute.
+//----------------------------------------------------------------------------
+static bool logfuse_xattr_find(const char *path, const char *name, logfuse_xattr_value &theValue, uint64_t *theGeneration)
+{	logfuse_xattrs_ref		theAttributes;
+	uint64_t				timeNow;
+
+
+
+	// Check the cache
+	if (logfuse_path_cache_find(gXattrCache, path, &theAttributes, theGeneration))
+		{
+		timeNow = logfuse_time_now();
+
+		for (const auto &cachedValue : theAttributes->theValues)
+			{
+			if (cachedValue.name == name && cachedValue.expires > timeNow)
+				{
+				theValue = cachedValue;
+				logfuse_stat_add(kStatXattrCacheHit);
+				return(true);
+				}
+			}
+		}
+
+	logfuse_stat_add(kStatXattrCacheMiss);
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_xattr_insert : Cache an extended attribute.
+//----------------------------------------------------------------------------
+static void logfuse_xattr_insert(const logfuse_settings *theSettings, const char *path, logfuse_xattr_value &theValue, uint64_t theGeneration)
+{	std::shared_ptr<logfuse_xattrs>		newAttributes;
+	logfuse_xattrs_ref					theAttributes;
+	uint64_t							unusedGeneration;
+	uint64_t							timeNow;
+	logfuse_errno_saver					saveErrno;
+
+
+
+	// Update the cache
+	//
+	// Each value carries its own expiry, as the list for a path is replaced
+	// whenever a new value is added to it.
+	timeNow       = logfuse_time_now();
+	newAttributes = std::make_shared<logfuse_xattrs>();
+
+	if (logfuse_path_cache_find(gXattrCache, path, &theAttributes, &unusedGeneration))
+		{
+		for (const auto &cachedValue : theAttributes->theValues)
+			{
+			if (cachedValue.name != theValue.name && cachedValue.expires > timeNow)
+				newAttributes->theValues.push_back(cachedValue);
+			}
+
+		if (newAttributes->theValues.size() >= kXattrCacheMaxNames)
+			newAttributes->theValues.erase(newAttributes->theValues.begin());
+		}
+
+	theValue.expires = timeNow + theSettings->xattrCacheTTL;
+	newAttributes->theValues.push_back(theValue);
+
+	logfuse_path_cache_insert(gXattrCache, path, logfuse_xattrs_ref(newAttributes), theSettings->xattrCacheTTL, theGeneration);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_xattr_copy : Copy a cached extended attribute.
+//----------------------------------------------------------------------------
+static ssize_t logfuse_xattr_copy(const logfuse_xattr_value &theValue, char *buffer, size_t size)
+{
+
+
+	// Copy the value
+	//
+	// A zero size asks for the size of the value.
+	if (theValue.sysErr != 0)
+		{
+		errno = theValue.sysErr;
+		return(-1);
+		}
+
+	if (size == 0)
+		return((ssize_t) theValue.data.size());
+
+	if (size < theValue.data.size())
+		{
+		errno = ERANGE;
+		return(-1);
+		}
+
+	memcpy(buffer, theValue.data.data(), theValue.data.size());
+
+	return((ssize_t) theValue.data.size());
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_eligible : Can a file's descriptor be reused?
+//----------------------------------------------------------------------------
+static bool logfuse_fd_cache_eligible(int flags)
+{
+
+
+	// Check the flags
+	//
+	// Only plain read-only descriptors can be shared between opens, as any
+	// other flags have side effects on open or on the open file.
+	if (gConfig.fdCacheSize == 0 || (flags & O_ACCMODE) != O_RDONLY)
+		return(false);
+
+#if FUSE_APPLE
+	if ((flags & (O_SHLOCK | O_EXLOCK)) != 0)
+		return(false);
+#endif
+
+	return((flags & (O_CREAT | O_TRUNC | O_EXCL | O_APPEND)) == 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_close : Close descriptors removed from the descriptor cache.
+//----------------------------------------------------------------------------
+static void logfuse_fd_cache_close(const std::vector<int> &theFDs)
+{
+
+
+	// Close the descriptors
+	//
+	// Descriptors are closed outside the cache lock, as close may block.
+	for (int fd : theFDs)
+		close(fd);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_take : Take a descriptor from the descriptor cache.
+//----------------------------------------------------------------------------
+static int logfuse_fd_cache_take(const struct stat &statInfo, int flags)
+{	logfuse_fd_key		theKey = { { statInfo.st_dev, statInfo.st_ino }, flags };
+	std::vector<int>	staleFDs;
+	struct stat			fdInfo;
+	int					fd;
+
+
+
+	// Take a descriptor
+	//
+	// The caller's attributes identify the file the path refers to, and a
+	// descriptor is only reused while it refers to that file and the file
+	// is still linked.
+	fd = -1;
+
+	while (fd == -1)
+		{
+		std::unique_lock<std::mutex>	acquireLock(gFdCache.theLock);
+
+		auto theIter = gFdCache.theIndex.find(theKey);
+		if (theIter == gFdCache.theIndex.end())
+			break;
+
+		fd = theIter->second->fd;
+		gFdCache.theLRU.erase(theIter->second);
+		gFdCache.theIndex.erase(theIter);
+		acquireLock.unlock();
+
+		if (fstat(fd, &fdInfo) != 0 || fdInfo.st_nlink == 0 ||
+			fdInfo.st_dev != statInfo.st_dev || fdInfo.st_ino != statInfo.st_ino)
+			{
+			staleFDs.push_back(fd);
+			fd = -1;
+			}
+		}
+
+	logfuse_fd_cache_close(staleFDs);
+
+	return(fd);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_park : Park an idle descriptor in the descriptor cache.
+//----------------------------------------------------------------------------
+static bool logfuse_fd_cache_park(int fd, int flags)
+{	std::vector<int>	oldFDs;
+	struct stat			statInfo;
+
+
+
+	// Check our state
+	if (fstat(fd, &statInfo) != 0 || !S_ISREG(statInfo.st_mode) || statInfo.st_nlink == 0)
+		return(false);
+
+
+
+	// Park the descriptor
+	//
+	// The least recently parked descriptors are closed to make space.
+	{	std::lock_guard<std::mutex>		acquireLock(gFdCache.theLock);
+		logfuse_fd_key					theKey = { { statInfo.st_dev, statInfo.st_ino }, flags };
+
+		while (!gFdCache.theLRU.empty() && gFdCache.theLRU.size() >= gConfig.fdCacheSize)
+			{
+			const logfuse_fd_entry &oldEntry = gFdCache.theLRU.back();
+
+			auto theRange = gFdCache.theIndex.equal_range(oldEntry.theKey);
+			for (auto theIter = theRange.first; theIter != theRange.second; theIter++)
+				{
+				if (theIter->second->fd == oldEntry.fd)
+					{
+					gFdCache.theIndex.erase(theIter);
+					break;
+					}
+				}
+
+			oldFDs.push_back(oldEntry.fd);
+			gFdCache.theLRU.pop_back();
+			}
+
+		gFdCache.theLRU.push_front({ theKey, fd });
+		gFdCache.theIndex.insert({ theKey, gFdCache.theLRU.begin() });
+	}
+
+	logfuse_fd_cache_close(oldFDs);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_purge : Purge a file from the descriptor cache.
+//----------------------------------------------------------------------------
+static void logfuse_fd_cache_purge(const logfuse_file_id &fileID)
+{	std::vector<int>	oldFDs;
+	logfuse_errno_saver	saveErrno;
+
+
+
+	// Purge the file
+	//
+	// An idle descriptor would keep an unlinked file's storage allocated.
+	{	std::lock_guard<std::mutex>		acquireLock(gFdCache.theLock);
+
+		for (auto theIter = gFdCache.theLRU.begin(); theIter != gFdCache.theLRU.end(); )
+			{
+			if (theIter->theKey.fileID == fileID)
+				{
+				auto theRange = gFdCache.theIndex.equal_range(theIter->theKey);
+				for (auto indexIter = theRange.first; indexIter != theRange.second; indexIter++)
+					{
+					if (indexIter->second == theIter)
+						{
+						gFdCache.theIndex.erase(indexIter);
+						break;
+						}
+					}
+
+				oldFDs.push_back(theIter->fd);
+				theIter = gFdCache.theLRU.erase(theIter);
+				}
+			else
+				theIter++;
+			}
+	}
+
+	logfuse_fd_cache_close(oldFDs);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fd_cache_identify : Identify a path for the descriptor cache.
+//----------------------------------------------------------------------------
+static bool logfuse_fd_cache_identify(const char *path, logfuse_file_id *fileID)
+{	struct stat		statInfo;
+
+
+
+	// Identify the path
+	//
+	// A path must be identified before it is removed, so that the file it
+	// referred to can be purged afterwards.
+	if (gConfig.fdCacheSize == 0)
+		return(false);
+
+	if (fstatat(logfuse_root_fd(), logfuse_path(path), &statInfo, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(statInfo.st_mode))
+		return(false);
+
+	*fileID = { statInfo.st_dev, statInfo.st_ino };
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_open_flags : Get the flags to open a backing file with.
+//----------------------------------------------------------------------------
+static int logfuse_open_flags(int flags)
+{
+
+
+	// Get the flags
+	//
+	// With the writeback cache the kernel may read a file opened write-only to
+	// fill a partly written page, and gives every write an explicit offset
+	// that O_APPEND would override.
+	if (gConfig.writebackCache)
+		{
+		if ((flags & O_ACCMODE) == O_WRONLY)
+			flags = (flags & ~O_ACCMODE) | O_RDWR;
+
+		flags &= ~O_APPEND;
+		}
+
+	return(flags);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_open_stat : Get the attributes of a file being opened.
+//----------------------------------------------------------------------------
+static bool logfuse_open_stat(const char *path, struct stat *statInfo)
+{	uint64_t		theGeneration;
+
+
+
+	// Get the attributes
+	//
+	// The file is identified from the attribute cache where possible, so that
+	// opening it does not need any calls to the backing store. Like a cached
+	// getattr, a path replaced outside the mount may then be served from
+	// the file it referred to until its attributes expire.
+	if (logfuse_get_settings()->attrCacheTTL != 0 && logfuse_path_cache_find(gAttrCache, path, statInfo, &theGeneration) && S_ISREG(statInfo->st_mode))
+		return(true);
+
+	return(fstatat(logfuse_root_fd(), logfuse_path(path), statInfo, 0) == 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_open_fd : Open a backing file.
+//----------------------------------------------------------------------------
+static int logfuse_open_fd(const char *path, int flags, const struct stat *pathInfo, bool *wasCached)
+{	struct stat		statInfo;
+	bool			gotInfo;
+	int				fd;
+
+
+
+	// Reuse an idle descriptor
+	//
+	// The caller may pass the attributes it has already fetched for the file.
+	*wasCached = false;
+
+	if (logfuse_fd_cache_eligible(flags))
+		{
+		if (pathInfo != nullptr)
+			{
+			statInfo = *pathInfo;
+			gotInfo  = true;
+			}
+		else
+			gotInfo = logfuse_open_stat(path, &statInfo);
+
+		if (gotInfo && S_ISREG(statInfo.st_mode))
+			{
+			fd = logfuse_fd_cache_take(statInfo, flags);
+			if (fd != -1)
+				{
+				logfuse_stat_add(kStatFdCacheHit);
+				*wasCached = true;
+				return(fd);
+				}
+			}
+
+		logfuse_stat_add(kStatFdCacheMiss);
+		}
+
+
+
+	// Open the file
+	fd = openat(logfuse_root_fd(), logfuse_path(path), flags);
+
+	return(fd);
+}
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_fset_timespec : Set a file time.
+//----------------------------------------------------------------------------
+static int logfuse_fset_timespec(int fd, attrgroup_t theAttribute, timespec theTime)
+{	attrlist		attributeInfo;
+	int				sysErr;
+
+
+
+	// Get the state we need
+	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+
+	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
+	attributeInfo.commonattr  = theAttribute;
+
+
+
+	// Set the time
+	sysErr = fsetattrlist(fd, &attributeInfo, &theTime, sizeof(timespec), FSOPT_NOFOLLOW);
+
+	return(sysErr);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_set_timespec : Set a file time.
+//----------------------------------------------------------------------------
+static int logfuse_set_timespec(const char *path, attrgroup_t theAttribute, timespec theTime)
+{	attrlist		attributeInfo;
+	int				sysErr;
+
+
+
+	// Get the state we need
+	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+
+	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
+	attributeInfo.commonattr  = theAttribute;
+
+
+
+	// Set the time
+	sysErr = setattrlist(logfuse_full_path(path).c_str(), &attributeInfo, &theTime, sizeof(timespec), FSOPT_NOFOLLOW);
+
+	return(sysErr);
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+//============================================================================
+//		logfuse_str_access_mode : Access mode string.
+//----------------------------------------------------------------------------
+static std::string logfuse_str_access_mode(int mode)
+{
+
+
+	// Get the text
+	TEXT_BEGIN();
+		TEXT_BIT(mode, F_OK);
+		TEXT_BIT(mode, R_OK);
+		TEXT_BIT(mode, W_OK);
+		TEXT_BIT(mode, X_OK);
+	TEXT_END(mode);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_str_open_flags : open flags string.
+//----------------------------------------------------------------------------
+static std::string logfuse_str_open_flags(int flags)
+{
+
+
+	// Get the text
+	TEXT_BEGIN();
+		TEXT_BIT(flags, O_RDONLY);
+		TEXT_BIT(flags, O_WRONLY);
+		TEXT_BIT(flags, O_RDWR);
+		TEXT_BIT(flags, O_NONBLOCK);
+		TEXT_BIT(flags, O_APPEND);
+#if FUSE_APPLE
+		TEXT_BIT(flags, O_SHLOCK);
+		TEXT_BIT(flags, O_EXLOCK);
+#endif
+		TEXT_BIT(flags, O_NOFOLLOW);
+		TEXT_BIT(flags, O_CREAT);
+		TEXT_BIT(flags, O_TRUNC);
+		TEXT_BIT(flags, O_EXCL);
+#if FUSE_APPLE
+		TEXT_BIT(flags, O_EVTONLY);
+		TEXT_BIT(flags, O_SYMLINK);
+#else
+		TEXT_BIT(flags, O_DIRECT);
+		TEXT_BIT(flags, O_NOATIME);
+		TEXT_BIT(flags, O_DSYNC);
+		TEXT_BIT(flags, O_SYNC);
+#endif
+		TEXT_BIT(flags, O_CLOEXEC);
+	TEXT_END(flags);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_str_fallocate_mode : fallocate mode string.
+//----------------------------------------------------------------------------
+static std::string logfuse_str_fallocate_mode(int mode)
+{
+
+
+	// Get the text
+	TEXT_BEGIN();
+#if FUSE_APPLE
+		TEXT_BIT(mode, PREALLOCATE);
+		TEXT_BIT(mode, ALLOCATECONTIG);
+		TEXT_BIT(mode, ALLOCATEALL);
+		TEXT_BIT(mode, ALLOCATEFROMPEOF);
+		TEXT_BIT(mode, ALLOCATEFROMVOL);
+#else
+		TEXT_BIT(mode, FALLOC_FL_KEEP_SIZE);
+		TEXT_BIT(mode, FALLOC_FL_PUNCH_HOLE);
+		TEXT_BIT(mode, FALLOC_FL_ZERO_RANGE);
+		TEXT_BIT(mode, FALLOC_FL_COLLAPSE_RANGE);
+		TEXT_BIT(mode, FALLOC_FL_INSERT_RANGE);
+#endif
+	TEXT_END(mode);
+}
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+//============================================================================
+//		logfuse_str_setattr_valid : setattr valid string.
+//----------------------------------------------------------------------------
+static std::string logfuse_str_setattr_valid(int valid)
+{
+
+
+	// Get the text
+	TEXT_BEGIN();
+		TEXT_BIT(valid, FUSE_SET_ATTR_MODE);
+		TEXT_BIT(valid, FUSE_SET_ATTR_UID);
+		TEXT_BIT(valid, FUSE_SET_ATTR_GID);
+		TEXT_BIT(valid, FUSE_SET_ATTR_SIZE);
+		TEXT_BIT(valid, FUSE_SET_ATTR_ATIME);
+		TEXT_BIT(valid, FUSE_SET_ATTR_MTIME);
+		TEXT_BIT(valid, FUSE_SET_ATTR_ATIME_NOW);
+		TEXT_BIT(valid, FUSE_SET_ATTR_MTIME_NOW);
+		TEXT_BIT(valid, FUSE_SET_ATTR_CTIME);
+	TEXT_END(valid);
+}
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
+
+
+
+
+
+//============================================================================
+//		logfuse_str_fcntl_cmd : fcntl command string.
+//----------------------------------------------------------------------------
+static const char *logfuse_str_fcntl_cmd(int cmd)
+{
+
+
+	// Get the text
+	switch (cmd) {
+		case F_DUPFD:						return("F_DUPFD");						break;
+		case F_GETFD:						return("F_GETFD");						break;
+		case F_SETFD:						return("F_SETFD");						break;
+		case F_GETFL:						return("F_GETFL");						break;
+		case F_SETFL:						return("F_SETFL");						break;
+		case F_GETOWN:						return("F_GETOWN");						break;
+		case F_SETOWN:						return("F_SETOWN");						break;
+		case F_GETLK:						return("F_GETLK");						break;
+		case F_SETLK:						return("F_SETLK");						break;
+		case F_SETLKW:						return("F_SETLKW");						break;
+#if FUSE_APPLE
+		case F_SETLKWTIMEOUT:				return("F_SETLKWTIMEOUT");				break;
+		case F_FLUSH_DATA:					return("F_FLUSH_DATA");					break;
+		case F_PREALLOCATE:					return("F_PREALLOCATE");				break;
+		case F_SETSIZE:						return("F_SETSIZE");					break;
+		case F_RDADVISE:					return("F_RDADVISE");					break;
+		case F_RDAHEAD:						return("F_RDAHEAD");					break;
+		case F_NOCACHE:						return("F_NOCACHE");					break;
+		case F_LOG2PHYS:					return("F_LOG2PHYS");					break;
+		case F_GETPATH:						return("F_GETPATH");					break;
+		case F_FULLFSYNC:					return("F_FULLFSYNC");					break;
+		case F_PATHPKG_CHECK:				return("F_PATHPKG_CHECK");				break;
+		case F_FREEZE_FS:					return("F_FREEZE_FS");					break;
+		case F_THAW_FS:						return("F_THAW_FS");					break;
+		case F_GLOBAL_NOCACHE:				return("F_GLOBAL_NOCACHE");				break;
+		case F_ADDSIGS:						return("F_ADDSIGS");					break;
+		case F_ADDFILESIGS:					return("F_ADDFILESIGS");				break;
+		case F_NODIRECT:					return("F_NODIRECT");					break;
+		case F_GETPROTECTIONCLASS:			return("F_GETPROTECTIONCLASS");			break;
+		case F_SETPROTECTIONCLASS:			return("F_SETPROTECTIONCLASS");			break;
+		case F_LOG2PHYS_EXT:				return("F_LOG2PHYS_EXT");				break;
+		case F_GETLKPID:					return("F_GETLKPID");					break;
+		case F_SETBACKINGSTORE:				return("F_SETBACKINGSTORE");			break;
+		case F_GETPATH_MTMINFO:				return("F_GETPATH_MTMINFO");			break;
+		case F_GETCODEDIR:					return("F_GETCODEDIR");					break;
+		case F_SETNOSIGPIPE:				return("F_SETNOSIGPIPE");				break;
+		case F_GETNOSIGPIPE:				return("F_GETNOSIGPIPE");				break;
+		case F_TRANSCODEKEY:				return("F_TRANSCODEKEY");				break;
+		case F_SINGLE_WRITER:				return("F_SINGLE_WRITER");				break;
+		case F_GETPROTECTIONLEVEL:			return("F_GETPROTECTIONLEVEL");			break;
+		case F_FINDSIGS:					return("F_FINDSIGS");					break;
+		case F_ADDFILESIGS_FOR_DYLD_SIM:	return("F_ADDFILESIGS_FOR_DYLD_SIM");	break;
+		case F_BARRIERFSYNC:				return("F_BARRIERFSYNC");				break;
+		case F_ADDFILESIGS_RETURN:			return("F_ADDFILESIGS_RETURN");			break;
+		case F_CHECK_LV:					return("F_CHECK_LV");					break;
+		case F_PUNCHHOLE:					return("F_PUNCHHOLE");					break;
+		case F_TRIM_ACTIVE_FILE:			return("F_TRIM_ACTIVE_FILE");			break;
+#else
+		case F_DUPFD_CLOEXEC:				return("F_DUPFD_CLOEXEC");				break;
+		case F_SETSIG:						return("F_SETSIG");						break;
+		case F_GETSIG:						return("F_GETSIG");						break;
+		case F_SETLEASE:					return("F_SETLEASE");					break;
+		case F_GETLEASE:					return("F_GETLEASE");					break;
+		case F_NOTIFY:						return("F_NOTIFY");						break;
+		case F_SETPIPE_SZ:					return("F_SETPIPE_SZ");					break;
+		case F_GETPIPE_SZ:					return("F_GETPIPE_SZ");					break;
+		case F_OFD_GETLK:					return("F_OFD_GETLK");					break;
+		case F_OFD_SETLK:					return("F_OFD_SETLK");					break;
+		case F_OFD_SETLKW:					return("F_OFD_SETLKW");					break;
+#endif
+		default:
+			break;
+		}
+
+	return("UNKNOWN");
+}
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+//============================================================================
+//		logfuse_str_seek_whence : lseek whence string.
+//----------------------------------------------------------------------------
+static const char *logfuse_str_seek_whence(int whence)
+{
+
+
+	// Get the text
+	switch (whence) {
+		case SEEK_SET:						return("SEEK_SET");						break;
+		case SEEK_CUR:						return("SEEK_CUR");						break;
+		case SEEK_END:						return("SEEK_END");						break;
+		case SEEK_DATA:						return("SEEK_DATA");					break;
+		case SEEK_HOLE:						return("SEEK_HOLE");					break;
+		default:
+			break;
+		}
+
+	return("UNKNOWN");
+}
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
+
+
+
+
+
+//============================================================================
+//		logfuse_str_stat : Statistic string.
+//----------------------------------------------------------------------------
+static const char *logfuse_str_stat(logfuse_stat theStat)
+{
+
+
+	// Get the text
+	switch (theStat) {
+		case kStatAttrCacheHit:				return("attr_cache_hit");				break;
+		case kStatAttrCacheMiss:			return("attr_cache_miss");				break;
+		case kStatContentCacheHit:			return("content_cache_hit");			break;
+		case kStatContentCacheMiss:			return("content_cache_miss");			break;
+		case kStatNegativeCacheHit:			return("negative_cache_hit");			break;
+		case kStatNegativeCacheMiss:		return("negative_cache_miss");			break;
+		case kStatDirCacheHit:				return("dir_cache_hit");				break;
+		case kStatDirCacheMiss:				return("dir_cache_miss");				break;
+		case kStatFdCacheHit:				return("fd_cache_hit");					break;
+		case kStatFdCacheMiss:				return("fd_cache_miss");				break;
+		case kStatAccessCacheHit:			return("access_cache_hit");				break;
+		case kStatAccessCacheMiss:			return("access_cache_miss");			break;
+		case kStatXattrCacheHit:			return("xattr_cache_hit");				break;
+		case kStatXattrCacheMiss:			return("xattr_cache_miss");				break;
+		case kStatTierHit:					return("tier_hit");						break;
+		case kStatTierMiss:					return("tier_miss");					break;
+		case kStatTierCopy:					return("tier_copy");					break;
+		case kStatInjectDelay:				return("inject_delay");					break;
+		case kStatInjectFault:				return("inject_fault");					break;
+		case kStatThrottleWait:				return("throttle_wait");				break;
+		case kStatThrottleTime:				return("throttle_wait_us");				break;
+		case kStatCount:															break;
+		}
+
+	return("UNKNOWN");
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_stats_text : Get the statistics as text.
+//----------------------------------------------------------------------------
+static std::string logfuse_stats_text()
+{	std::string		theText;
+
+
+
+	// Get the text
+	for (int n = 0; n < kStatCount; n++)
+		{
+		theText += " ";
+		theText += logfuse_str_stat((logfuse_stat) n);
+		theText += "=";
+		theText += std::to_string(gStats[n].load(std::memory_order_relaxed));
+		}
+
+	return(theText);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_stats_log : Log the statistics.
+//----------------------------------------------------------------------------
+static void logfuse_stats_log()
+{
+
+
+	// Log the statistics
+	logfuse_log("logfuse_stats:%s", logfuse_stats_text().c_str());
+}
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+//============================================================================
+//		logfuse_worker_thread : Worker thread.
+//----------------------------------------------------------------------------
+static void *logfuse_worker_thread(void *userData)
+{	logfuse_worker		*theWorker = (logfuse_worker *) userData;
+	fuse_buf			theBuffer;
+	cpu_set_t			theCPUs;
+	int					sysErr;
+
+
+
+	// Get the state we need
+	//
+	// Workers may only be cancelled while waiting for a request, so that
+	// a request is never abandoned part way through.
+	memset(&theBuffer, 0x00, sizeof(theBuffer));
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+
+	if (theWorker->theCPU != -1)
+		{
+		CPU_ZERO(&theCPUs);
+		CPU_SET(theWorker->theCPU, &theCPUs);
+		pthread_setaffinity_np(pthread_self(), sizeof(theCPUs), &theCPUs);
+		}
+
+
+
+	// Process requests
+	while (!fuse_session_exited(theWorker->theSession))
+		{
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+		sysErr = fuse_session_receive_buf(theWorker->theSession, &theBuffer);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+
+		if (sysErr == -EINTR)
+			continue;
+
+		if (sysErr <= 0)
+			{
+			if (sysErr < 0)
+				fuse_session_exit(theWorker->theSession);
+			break;
+			}
+
+		fuse_session_process_buf(theWorker->theSession, &theBuffer);
+		}
+
+	free(theBuffer.mem);
+	sem_post(theWorker->theFinish);
+
+	return(nullptr);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_workers_loop : Process requests with a fixed pool of workers.
+//----------------------------------------------------------------------------
+static int logfuse_workers_loop(fuse_session *fuseSession)
+{	std::vector<logfuse_worker>		theWorkers;
+	std::vector<int>				theCPUs;
+	cpu_set_t						cpuSet;
+	sem_t							theFinish;
+	size_t							numThreads;
+	int								sysErr;
+
+
+
+	// Get the state we need
+	//
+	// Pinned workers are spread over the CPUs we may run on, and a pool
+	// without an explicit size has one worker per CPU.
+	CPU_ZERO(&cpuSet);
+	sched_getaffinity(0, sizeof(cpuSet), &cpuSet);
+
+	for (int n = 0; n < CPU_SETSIZE; n++)
+		{
+		if (CPU_ISSET(n, &cpuSet))
+			theCPUs.push_back(n);
+		}
+
+	if (theCPUs.empty())
+		theCPUs.push_back(0);
+
+	numThreads = gConfig.maxThreads != 0 ? gConfig.maxThreads : theCPUs.size();
+	theWorkers.resize(numThreads);
+
+	sem_init(&theFinish, 0, 0);
+
+	logfuse_log("logfuse_workers: threads=%zu, pinned=%s", numThreads, gConfig.pinThreads ? "yes" : "no");
+
+
+
+	// Run the workers
+	//
+	// The pool runs until a worker sees the session end, or a signal ends it
+	// while we wait, at which point any workers still waiting are cancelled.
+	for (size_t n = 0; n < numThreads; n++)
+		{
+		theWorkers[n].theSession = fuseSession;
+		theWorkers[n].theFinish  = &theFinish;
+		theWorkers[n].theCPU     = gConfig.pinThreads ? theCPUs[n % theCPUs.size()] : -1;
+
+		sysErr = pthread_create(&theWorkers[n].theThread, nullptr, logfuse_worker_thread, &theWorkers[n]);
+		if (sysErr != 0)
+			{
+			fprintf(stderr, "logfuse: unable to create worker: %s\n", strerror(sysErr));
+			fuse_session_exit(fuseSession);
+			theWorkers.resize(n);
+			break;
+			}
+		}
+
+	while (!fuse_session_exited(fuseSession))
+		sem_wait(&theFinish);
+
+	for (auto &theWorker : theWorkers)
+		pthread_cancel(theWorker.theThread);
+
+	for (auto &theWorker : theWorkers)
+		pthread_join(theWorker.theThread, nullptr);
+
+	sem_destroy(&theFinish);
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_session_loop : Process requests for a session.
+//----------------------------------------------------------------------------
+static int logfuse_session_loop(fuse_session *fuseSession, const fuse_cmdline_opts &fuseOpts)
+{	fuse_loop_config		loopConfig;
+
+
+
+	// Process requests
+	//
+	// A fixed pool is used for an explicit size or pinning, which libfuse's
+	// own pool does not provide. Otherwise libfuse starts workers on demand,
+	// each with its own cloned channel if clone_fd is set.
+	if (gConfig.maxThreads != 0 || gConfig.pinThreads)
+		return(logfuse_workers_loop(fuseSession));
+
+	if (fuseOpts.singlethread)
+		return(fuse_session_loop(fuseSession));
+
+	loopConfig.clone_fd         = fuseOpts.clone_fd;
+	loopConfig.max_idle_threads = fuseOpts.max_idle_threads;
+
+	return(fuse_session_loop_mt(fuseSession, &loopConfig));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_cmdline : Parse the FUSE command line.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_cmdline(fuse_args *fuseArgs, fuse_cmdline_opts *fuseOpts, int *theResult)
+{
+
+
+	// Parse the command line
+	//
+	// Help and version requests are answered here, and end the process. A
+	// fixed pool of workers cannot also be single-threaded, or clone the
+	// channel, as its workers share the session's descriptor.
+	*theResult = 1;
+
+	if (fuse_parse_cmdline(fuseArgs, fuseOpts) != 0)
+		return(false);
+
+	if (fuseOpts->show_version)
+		{
+		printf("FUSE library version %s\n", fuse_pkgversion());
+		fuse_lowlevel_version();
+
+		*theResult = 0;
+		}
+
+	else if (fuseOpts->show_help || fuseOpts->mountpoint == nullptr)
+		{
+		fprintf(fuseOpts->show_help ? stdout : stderr, "usage: logfuse <mountpoint> [options]\n\n");
+		fuse_cmdline_help();
+
+		if (gConfig.lowLevel)
+			fuse_lowlevel_help();
+		else
+			fuse_lib_help(fuseArgs);
+
+		*theResult = fuseOpts->show_help ? 0 : 1;
+		}
+
+	else if (fuseOpts->singlethread && (gConfig.maxThreads != 0 || gConfig.pinThreads))
+		fprintf(stderr, "logfuse: -s cannot be used with max_threads or pin_threads\n");
+
+	else if (fuseOpts->clone_fd && (gConfig.maxThreads != 0 || gConfig.pinThreads))
+		fprintf(stderr, "logfuse: clone_fd cannot be used with max_threads or pin_threads\n");
+
+	else
+		return(true);
+
+	free(fuseOpts->mountpoint);
+	return(false);
+}
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
+
+
+
+
+
+//============================================================================
+//		logfuse_mounts_primary : Get the mount given on the command line.
+//----------------------------------------------------------------------------
+static logfuse_mount *logfuse_mounts_primary()
+{
+
+
+	// Get the mount
+	//
+	// Without extra mounts, the filesystem has no mount object.
+	if (gMounts.theMounts.empty())
+		return(nullptr);
+
+	return(gMounts.theMounts.front().get());
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mounts_prepare : Prepare the mounts.
+//----------------------------------------------------------------------------
+static bool logfuse_mounts_prepare(const fuse_args *fuseArgs, const fuse_operations *fuseOps)
+{	std::unique_ptr<logfuse_mount>		theMount;
+
+
+
+	// Check our state
+	if (gConfig.mounts.empty())
+		return(true);
+
+
+
+	// Save the arguments
+	//
+	// Each extra mount is given the FUSE options of the first mount. FUSE
+	// consumes the options it parses, so they are parsed afresh for each.
+	for (int n = 0; n < fuseArgs->argc; n++)
+		gMounts.fuseArgs.push_back(fuseArgs->argv[n]);
+
+	gMounts.fuseOps = fuseOps;
+
+
+
+	// Create the mounts
+	//
+	// The first mount keeps the root and path tree it would have alone.
+	theMount.reset(new logfuse_mount());
+	theMount->rootPath   = gConfig.rootPath;
+	theMount->mountPoint = gConfig.mountPoint;
+	theMount->rootFd     = gRootFd;
+
+	gMounts.theMounts.push_back(std::move(theMount));
+
+	for (const auto &thePath : gConfig.mounts)
+		{
+		theMount.reset(new logfuse_mount());
+		theMount->rootPath   = thePath.rootPath;
+		theMount->mountPoint = thePath.mountPoint;
+		theMount->nodeName   = "/" + std::to_string(gMounts.theMounts.size());
+		theMount->rootFd     = open(thePath.rootPath.c_str(), ROOT_OPEN_FLAGS);
+
+		if (theMount->rootFd == -1)
+			{
+			fprintf(stderr, "logfuse: unable to open root '%s': %s\n", thePath.rootPath.c_str(), strerror(errno));
+			return(false);
+			}
+
+		gMounts.theMounts.push_back(std::move(theMount));
+		}
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mount_publish : Publish the FUSE instance of a mount.
+//----------------------------------------------------------------------------
+static bool logfuse_mount_publish(logfuse_mount *theMount, struct fuse *theFuse)
+{	std::lock_guard<std::mutex>		acquireLock(theMount->theLock);
+
+
+
+	// Publish the instance
+	//
+	// A mount that is being stopped can't be published, and is abandoned.
+	if (theMount->isStopping)
+		return(false);
+
+	theMount->theFuse = theFuse;
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mount_release : Release the FUSE instance of a mount.
+//----------------------------------------------------------------------------
+static bool logfuse_mount_release(logfuse_mount *theMount)
+{	std::lock_guard<std::mutex>		acquireLock(theMount->theLock);
+	bool							needsUnmount;
+
+
+
+	// Release the instance
+	//
+	// A mount that was stopped has already been unmounted by the stopper,
+	// and must not be unmounted again.
+	needsUnmount      = (theMount->theFuse != nullptr);
+	theMount->theFuse = nullptr;
+
+	return(needsUnmount);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mount_thread : Mount thread.
+//----------------------------------------------------------------------------
+static void logfuse_mount_thread(logfuse_mount *theMount)
+{	fuse_args				fuseArgs = FUSE_ARGS_INIT(0, nullptr);
+	struct fuse				*theFuse = nullptr;
+	bool					didMount = false;
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	fuse_cmdline_opts		fuseOpts;
+#elif FUSE_USE_VERSION < 30
+	fuse_chan				*theChan;
+	char					*mountPoint;
+	int						multiThreaded;
+	int						foreground;
+#endif
+
+
+
+	// Get the arguments
+	gCurrentMount = theMount;
+
+	for (const auto &theArg : gMounts.fuseArgs)
+		fuse_opt_add_arg(&fuseArgs, theArg.c_str());
+
+
+
+	// Run the filesystem
+	//
+	// This follows fuse_main, other than mounting our own mount point. The
+	// first mount has already daemonized and installed the signal handlers.
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	if (fuse_parse_cmdline(&fuseArgs, &fuseOpts) == 0)
+		{
+		free(fuseOpts.mountpoint);
+		theFuse = fuse_new(&fuseArgs, gMounts.fuseOps, sizeof(*gMounts.fuseOps), theMount);
+
+		if (theFuse != nullptr && fuse_mount(theFuse, theMount->mountPoint.c_str()) == 0)
+			{
+			didMount = logfuse_mount_publish(theMount, theFuse);
+
+			if (didMount && fuse_start_cleanup_thread(theFuse) == 0)
+				{
+				logfuse_session_loop(fuse_get_session(theFuse), fuseOpts);
+				fuse_stop_cleanup_thread(theFuse);
+				}
+
+			if (!didMount || logfuse_mount_release(theMount))
+				fuse_unmount(theFuse);
+			}
+
+		if (theFuse != nullptr)
+			fuse_destroy(theFuse);
+		}
+#elif FUSE_USE_VERSION < 30
+	if (fuse_parse_cmdline(&fuseArgs, &mountPoint, &multiThreaded, &foreground) == 0)
+		{
+		free(mountPoint);
+		theChan = fuse_mount(theMount->mountPoint.c_str(), &fuseArgs);
+
+		if (theChan != nullptr)
+			{
+			theFuse  = fuse_new(theChan, &fuseArgs, gMounts.fuseOps, sizeof(*gMounts.fuseOps), theMount);
+			didMount = (theFuse != nullptr && logfuse_mount_publish(theMount, theFuse));
+
+			if (didMount)
+				{
+				if (multiThreaded)
+					fuse_loop_mt(theFuse);
+				else
+					fuse_loop(theFuse);
+				}
+
+			if (!didMount || logfuse_mount_release(theMount))
+				fuse_unmount(theMount->mountPoint.c_str(), theChan);
+
+			if (theFuse != nullptr)
+				fuse_destroy(theFuse);
+			}
+		}
+#endif
+
+	if (!didMount)
+		logfuse_log("logfuse_mount: unable to mount %s", theMount->mountPoint.c_str());
+
+	fuse_opt_free_args(&fuseArgs);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mounts_start : Start the extra mounts.
+//----------------------------------------------------------------------------
+static void logfuse_mounts_start()
+{
+
+
+	// Start the mounts
+	for (size_t n = 1; n < gMounts.theMounts.size(); n++)
+		gMounts.theMounts[n]->theThread = std::thread(logfuse_mount_thread, gMounts.theMounts[n].get());
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mounts_stop : Stop the extra mounts.
+//----------------------------------------------------------------------------
+static void logfuse_mounts_stop()
+{
+
+
+	// Stop the mounts
+	//
+	// Unmounting a mount ends its loop, after which its thread destroys it.
+	// A mount that has already been released by its thread only needs to be
+	// joined.
+	//
+	// The FUSE 2 channel belongs to the thread, so only the kernel mount is
+	// removed here, and the channel is destroyed with the instance.
+	for (size_t n = 1; n < gMounts.theMounts.size(); n++)
+		{
+		logfuse_mount *theMount = gMounts.theMounts[n].get();
+
+		{	std::lock_guard<std::mutex>		acquireLock(theMount->theLock);
+
+			theMount->isStopping = true;
+
+			if (theMount->theFuse != nullptr)
+				{
+				fuse_exit(theMount->theFuse);
+#if FUSE_USE_VERSION >= 30
+				fuse_unmount(theMount->theFuse);
+#else
+				fuse_unmount(theMount->mountPoint.c_str(), nullptr);
+#endif
+				theMount->theFuse = nullptr;
+				}
+		}
+
+		if (theMount->theThread.joinable())
+			theMount->theThread.join();
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_str_cache_policy : Cache policy string.
+//----------------------------------------------------------------------------
+static const char *logfuse_str_cache_policy(logfuse_cache_policy thePolicy)
+{
+
+
+	// Get the text
+	switch (thePolicy) {
+		case kCachePolicyDefault:			return("default");						break;
+		case kCachePolicyKeepCache:			return("keep_cache");					break;
+		case kCachePolicyDirectIO:			return("direct_io");					break;
+		}
+
+	return("UNKNOWN");
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_cache_policy : Parse a cache policy.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_cache_policy(const char *theText, logfuse_cache_policy *thePolicy)
+{
+
+
+	// Parse the policy
+	if (strcmp(theText, "default") == 0)
+		*thePolicy = kCachePolicyDefault;
+
+	else if (strcmp(theText, "keep_cache") == 0)
+		*thePolicy = kCachePolicyKeepCache;
+
+	else if (strcmp(theText, "direct_io") == 0)
+		*thePolicy = kCachePolicyDirectIO;
+
+	else
+		return(false);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_apply_cache_policy : Apply the cache policy to an open file.
+//----------------------------------------------------------------------------
+static logfuse_cache_policy logfuse_apply_cache_policy(const char *path, fuse_file_info *fileInfo)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	logfuse_cache_policy	thePolicy;
+
+
+
+	// Find the policy
+	//
+	// Rules are evaluated in the order they were given, and the first match
+	// wins. Patterns are fnmatch globs without FNM_PATHNAME, so a trailing
+	// '*' matches everything below a prefix.
+	//
+	// Files opened without a path only receive the default policy.
+	thePolicy = theSettings->cacheDefault;
+
+	for (const auto &theRule : theSettings->cacheRules)
+		{
+		if (path != nullptr && fnmatch(theRule.pattern.c_str(), path, 0) == 0)
+			{
+			thePolicy = theRule.policy;
+			break;
+			}
+		}
+
+
+
+	// Apply the policy
+	//
+	// With no policy we leave the kernel's defaults in place, which drops
+	// the page cache for the file on every open.
+	//
+	// With the writeback cache the kernel's cached size and modification time
+	// are authoritative, so its pages are kept rather than flushed and dropped
+	// on every open.
+	switch (thePolicy) {
+		case kCachePolicyDefault:
+			if (gConfig.writebackCache)
+				fileInfo->keep_cache = 1;
+			break;
+
+		case kCachePolicyKeepCache:
+			fileInfo->keep_cache = 1;
+			fileInfo->direct_io  = 0;
+			break;
+
+		case kCachePolicyDirectIO:
+			fileInfo->keep_cache = 0;
+			fileInfo->direct_io  = 1;
+			break;
+		}
+
+	return(thePolicy);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_size : Parse a size.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_size(const char *theText, size_t *theSize)
+{	unsigned long long		theValue;
+	unsigned long long		theScale;
+	char					*theEnd;
+
+
+
+	// Parse the size
+	//
+	// Sizes may have a K, M, or G suffix. strtoull accepts a sign, and
+	// would wrap a negative size to a huge one, so signs are rejected.
+	while (isspace((unsigned char) *theText))
+		theText++;
+
+	if (*theText == '-' || *theText == '+')
+		return(false);
+
+	errno    = 0;
+	theValue = strtoull(theText, &theEnd, 10);
+
+	if (errno != 0 || theEnd == theText)
+		return(false);
+
+	switch (*theEnd) {
+		case 'k':
+		case 'K':
+			theScale = 1024;
+			theEnd++;
+			break;
+
+		case 'm':
+		case 'M':
+			theScale = 1024 * 1024;
+			theEnd++;
+			break;
+
+		case 'g':
+		case 'G':
+			theScale = 1024 * 1024 * 1024;
+			theEnd++;
+			break;
+
+		default:
+			theScale = 1;
+			break;
+		}
+
+	if (*theEnd != 0x00 || theValue > ULLONG_MAX / theScale || theValue * theScale > SIZE_MAX)
+		return(false);
+
+	*theSize = (size_t) (theValue * theScale);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_time : Parse a time.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_time(const char *theText, uint64_t *theTime)
+{	double		theValue;
+	char		*theEnd;
+
+
+
+	// Parse the time
+	//
+	// Times are in seconds, and are returned in nanoseconds. strtod accepts
+	// nan and inf, and times that do not fit in a uint64_t can not be cast,
+	// so only finite times up to that limit are accepted.
+	errno    = 0;
+	theValue = strtod(theText, &theEnd);
+
+	if (errno != 0 || theEnd == theText || *theEnd != 0x00)
+		return(false);
+
+	theValue *= 1000000000.0;
+
+	if (!isfinite(theValue) || theValue < 0.0 || theValue >= (double) UINT64_MAX)
+		return(false);
+
+	*theTime = (uint64_t) theValue;
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_inject_rule : Parse the common fields of an injection rule.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_inject_rule(const char *theText, std::vector<std::string> &theOps, std::string &theSpec, std::string &thePattern)
+{	const char		*theOp;
+	const char		*theSep;
+	const char		*theEnd;
+
+
+
+	// Parse the rule
+	//
+	// Rules take the form <ops>:<spec>:<glob>, with the glob following the
+	// second ':' so that patterns may contain colons. Operations are joined
+	// with '+', or given as '*' for every operation.
+	theSep = strchr(theText, ':');
+	theEnd = (theSep == nullptr) ? nullptr : strchr(theSep + 1, ':');
+
+	if (theSep == nullptr || theEnd == nullptr || theSep == theText || theEnd == theSep + 1 || theEnd[1] == 0x00)
+		return(false);
+
+	theOps.clear();
+
+	if (theSep - theText != 1 || theText[0] != '*')
+		{
+		for (theOp = theText; theOp < theSep; )
+			{
+			const char *opEnd = std::find(theOp, theSep, '+');
+
+			if (opEnd == theOp)
+				return(false);
+
+			theOps.emplace_back(theOp, (size_t) (opEnd - theOp));
+			theOp = (opEnd == theSep) ? theSep : opEnd + 1;
+			}
+		}
+
+	theSpec.assign(theSep + 1, (size_t) (theEnd - theSep - 1));
+	thePattern.assign(theEnd + 1);
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_delay_rule : Parse a delay rule.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_delay_rule(const char *theText, logfuse_delay_rule *theRule)
+{	std::string		theSpec;
+	std::string		theKind;
+	std::string		minText;
+	std::string		maxText;
+	size_t			theSep;
+
+
+
+	// Parse the rule
+	//
+	// Delays are fixed/<time>, uniform/<min>/<max>, or tail/<median>/<p99>
+	// for a long-tailed log-normal distribution. A tail needs a non-zero
+	// median and a p99 above it, as the distribution must have a spread.
+	if (!logfuse_parse_inject_rule(theText, theRule->ops, theSpec, theRule->pattern))
+		return(false);
+
+	theSep  = theSpec.find('/');
+	theKind = theSpec.substr(0, theSep);
+
+	if (theSep == std::string::npos)
+		return(false);
+
+	minText = theSpec.substr(theSep + 1);
+	theSep  = minText.find('/');
+
+	if (theSep != std::string::npos)
+		{
+		maxText = minText.substr(theSep + 1);
+		minText.resize(theSep);
+		}
+
+	if (theKind == "fixed" && maxText.empty())
+		{
+		theRule->kind = kDelayFixed;
+		return(logfuse_parse_time(minText.c_str(), &theRule->minTime));
+		}
+
+	if (theKind == "uniform")
+		{
+		theRule->kind = kDelayUniform;
+		return(logfuse_parse_time(minText.c_str(), &theRule->minTime) &&
+			   logfuse_parse_time(maxText.c_str(), &theRule->maxTime) &&
+			   theRule->maxTime >= theRule->minTime);
+		}
+
+	if (theKind == "tail")
+		{
+		theRule->kind = kDelayTail;
+		return(logfuse_parse_time(minText.c_str(), &theRule->minTime) &&
+			   logfuse_parse_time(maxText.c_str(), &theRule->maxTime) &&
+			   theRule->minTime != 0 && theRule->maxTime > theRule->minTime);
+		}
+
+	return(false);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_parse_fault_rule : Parse a fault rule.
+//----------------------------------------------------------------------------
+static bool logfuse_parse_fault_rule(const char *theText, logfuse_fault_rule *theRule)
+{	std::string		theSpec;
+	std::string		theName;
+	std::string		theRate;
+	size_t			theSep;
+	char			*theEnd;
+
+
+
+	// Parse the rule
+	//
+	// Faults are <error>/<rate>, with a rate between 0 and 1, optionally
+	// followed by /before or /after the backing call.
+	if (!logfuse_parse_inject_rule(theText, theRule->ops, theSpec, theRule->pattern))
+		return(false);
+
+	theSep  = theSpec.find('/');
+	theName = theSpec.substr(0, theSep);
+
+	if (theSep == std::string::npos)
+		return(false);
+
+	theRate = theSpec.substr(theSep + 1);
+	theSep  = theRate.find('/');
+
+	theRule->isAfter = false;
+
+	if (theSep != std::string::npos)
+		{
+		if (theRate.compare(theSep + 1, std::string::npos, "after") == 0)
+			theRule->isAfter = true;
+
+		else if (theRate.compare(theSep + 1, std::string::npos, "before") != 0)
+			return(false);
+
+		theRate.resize(theSep);
+		}
+
+	if (theName == "eio")
+		theRule->sysErr = EIO;
+
+	else if (theName == "enospc")
+		theRule->sysErr = ENOSPC;
+
+	else if (theName == "eintr")
+		theRule->sysErr = EINTR;
+
+	else
+		return(false);
+
+	errno            = 0;
+	theRule->theRate = strtod(theRate.c_str(), &theEnd);
+
+	return(errno == 0 && theEnd != theRate.c_str() && *theEnd == 0x00 && theRule->theRate >= 0.0 && theRule->theRate <= 1.0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_opt_proc : Process an option.
+//----------------------------------------------------------------------------
+static int logfuse_opt_proc(void *userData, const char *arg, int key, fuse_args */*outArgs*/)
+{	logfuse_config			*theConfig = (logfuse_config *) userData;
+	logfuse_cache_rule		theRule;
+	logfuse_delay_rule		theDelay;
+	logfuse_fault_rule		theFault;
+	logfuse_mount_path		theMount;
+	const char				*theValue;
+	const char				*theSep;
+	char					*thePath;
+	uint64_t				theTime;
+	size_t					*theCount;
+
+
+
+	// Process the option
+	switch (key) {
+		case kOptCacheRule:
+			// Parse the rule
+			//
+			// Rules take the form cache_rule=<glob>:<policy>, with the policy
+			// following the last ':' so that patterns may contain colons.
+			theValue = strchr(arg, '=') + 1;
+			theSep   = strrchr(theValue, ':');
+
+			if (theSep == nullptr || theSep == theValue || !logfuse_parse_cache_policy(theSep + 1, &theRule.policy))
+				{
+				fprintf(stderr, "logfuse: invalid cache rule '%s'\n", theValue);
+				return(-1);
+				}
+
+			theRule.pattern.assign(theValue, theSep - theValue);
+			theConfig->settings.cacheRules.push_back(theRule);
+			return(0);
+			break;
+
+		case kOptCacheDefault:
+			theValue = strchr(arg, '=') + 1;
+
+			if (!logfuse_parse_cache_policy(theValue, &theConfig->settings.cacheDefault))
+				{
+				fprintf(stderr, "logfuse: invalid cache policy '%s'\n", theValue);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptContentCache:
+		case kOptContentCacheMax:
+		case kOptDirCache:
+		case kOptFdCache:
+		case kOptTierMax:
+		case kOptThrottleBytes:
+		case kOptLogBuffer:
+			theValue = strchr(arg, '=') + 1;
+
+			if (!logfuse_parse_size(theValue, key == kOptContentCache    ? &theConfig->contentCacheSize :
+											  key == kOptContentCacheMax ? &theConfig->contentCacheMax  :
+											  key == kOptDirCache        ? &theConfig->dirCacheSize     :
+											  key == kOptFdCache         ? &theConfig->fdCacheSize      :
+											  key == kOptTierMax         ? &theConfig->tierMax          :
+											  key == kOptThrottleBytes   ? &theConfig->settings.throttleBytes :
+																		   &theConfig->settings.logBuffer))
+				{
+				fprintf(stderr, "logfuse: invalid size '%s'\n", arg);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptAttrCacheTTL:
+		case kOptNegativeCacheTTL:
+		case kOptAccessCacheTTL:
+		case kOptXattrCacheTTL:
+		case kOptThrottleBurst:
+			theValue = strchr(arg, '=') + 1;
+
+			if (!logfuse_parse_time(theValue, key == kOptAttrCacheTTL     ? &theConfig->settings.attrCacheTTL     :
+											  key == kOptNegativeCacheTTL ? &theConfig->settings.negativeCacheTTL :
+											  key == kOptAccessCacheTTL   ? &theConfig->settings.accessCacheTTL   :
+											  key == kOptXattrCacheTTL    ? &theConfig->settings.xattrCacheTTL    :
+																			&theConfig->settings.throttleBurst))
+				{
+				fprintf(stderr, "logfuse: invalid time '%s'\n", arg);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptRoot:
+			// Resolve the root
+			//
+			// FUSE may change directory when it daemonizes, so the root must
+			// be an absolute path.
+			theValue = strchr(arg, '=') + 1;
+			thePath  = realpath(theValue, nullptr);
+
+			if (thePath == nullptr)
+				{
+				fprintf(stderr, "logfuse: invalid root '%s': %s\n", theValue, strerror(errno));
+				return(-1);
+				}
+
+			theConfig->rootPath = thePath;
+			free(thePath);
+			return(0);
+			break;
+
+		case kOptMount:
+			// Resolve the mount
+			//
+			// Mounts are given as <root>:<mountpoint>, and both are resolved
+			// for the same reason as the root.
+			theValue = strchr(arg, '=') + 1;
+			theSep   = strchr(theValue, ':');
+
+			if (theSep == nullptr || theSep == theValue || theSep[1] == 0x00)
+				{
+				fprintf(stderr, "logfuse: invalid mount '%s'\n", theValue);
+				return(-1);
+				}
+
+			theMount.rootPath.assign(theValue, (size_t) (theSep - theValue));
+			theMount.mountPoint.assign(theSep + 1);
+
+			for (std::string *theString : { &theMount.rootPath, &theMount.mountPoint })
+				{
+				thePath = realpath(theString->c_str(), nullptr);
+				if (thePath == nullptr)
+					{
+					fprintf(stderr, "logfuse: invalid mount '%s': %s\n", theString->c_str(), strerror(errno));
+					return(-1);
+					}
+
+				theString->assign(thePath);
+				free(thePath);
+				}
+
+			theConfig->mounts.push_back(theMount);
+			return(0);
+			break;
+
+		case kOptConfig:
+		case kOptTier:
+			theValue = strchr(arg, '=') + 1;
+			thePath  = realpath(theValue, nullptr);
+
+			if (thePath == nullptr)
+				{
+				fprintf(stderr, "logfuse: invalid %s '%s': %s\n", key == kOptConfig ? "config" : "tier", theValue, strerror(errno));
+				return(-1);
+				}
+
+			*(key == kOptConfig ? &theConfig->configPath : &theConfig->tierPath) = thePath;
+			free(thePath);
+			return(0);
+			break;
+
+		case kOptLogOps:
+			// Parse the operations
+			//
+			// Operations are separated by ':', as FUSE splits options at ','.
+			theValue = strchr(arg, '=') + 1;
+
+			theConfig->settings.logAllOps = (strcmp(theValue, "all") == 0);
+			theConfig->settings.logOps.clear();
+
+			while (!theConfig->settings.logAllOps && strcmp(theValue, "none") != 0 && *theValue != 0x00)
+				{
+				theSep = strchr(theValue, ':');
+				if (theSep == nullptr)
+					theSep = theValue + strlen(theValue);
+
+				if (theSep != theValue)
+					theConfig->settings.logOps.emplace_back(theValue, (size_t) (theSep - theValue));
+
+				theValue = (*theSep == ':') ? theSep + 1 : theSep;
+				}
+			return(0);
+			break;
+
+		case kOptDelayRule:
+		case kOptFaultRule:
+			theValue = strchr(arg, '=') + 1;
+
+			if (key == kOptDelayRule ? !logfuse_parse_delay_rule(theValue, &theDelay) : !logfuse_parse_fault_rule(theValue, &theFault))
+				{
+				fprintf(stderr, "logfuse: invalid %s rule '%s'\n", key == kOptDelayRule ? "delay" : "fault", theValue);
+				return(-1);
+				}
+
+			if (key == kOptDelayRule)
+				theConfig->settings.delayRules.push_back(theDelay);
+			else
+				theConfig->settings.faultRules.push_back(theFault);
+			return(0);
+			break;
+
+		case kOptThrottleBy:
+			theValue = strchr(arg, '=') + 1;
+
+			if (strcmp(theValue, "uid") == 0)
+				theConfig->settings.throttleByPID = false;
+
+			else if (strcmp(theValue, "pid") == 0)
+				theConfig->settings.throttleByPID = true;
+
+			else
+				{
+				fprintf(stderr, "logfuse: invalid throttle_by '%s'\n", theValue);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptLogSample:
+			theValue = strchr(arg, '=') + 1;
+
+			if (!logfuse_parse_size(theValue, &theConfig->settings.logSample) || theConfig->settings.logSample == 0)
+				{
+				fprintf(stderr, "logfuse: invalid count '%s'\n", arg);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptLogSink:
+			// Parse the sink
+			//
+			// Logs go to the system log, stderr, or are appended to a file. FUSE
+			// may change directory when it daemonizes, so a file must be given
+			// by an absolute path.
+			theValue = strchr(arg, '=') + 1;
+
+			if (strcmp(theValue, "system") != 0 && strcmp(theValue, "stderr") != 0 && theValue[0] != '/')
+				{
+				fprintf(stderr, "logfuse: invalid log sink '%s'\n", theValue);
+				return(-1);
+				}
+
+			theConfig->settings.logSink = theValue;
+			return(0);
+			break;
+
+		case kOptReaddirStat:
+			theConfig->readdirStat = true;
+			return(0);
+			break;
+
+		case kOptAttrTimeout:
+		case kOptEntryTimeout:
+		case kOptNegativeTimeout:
+			// Parse the timeout
+			//
+			// FUSE 3 applies these timeouts to every node, so they are held
+			// until init rather than being passed through.
+			theValue = strchr(arg, '=') + 1;
+
+			if (!logfuse_parse_time(theValue, &theTime))
+				{
+				fprintf(stderr, "logfuse: invalid time '%s'\n", arg);
+				return(-1);
+				}
+
+			*(key == kOptAttrTimeout  ? &theConfig->attrTimeout  :
+			  key == kOptEntryTimeout ? &theConfig->entryTimeout :
+										&theConfig->negativeTimeout) = ((double) theTime) / 1000000000.0;
+			return(0);
+			break;
+
+		case kOptLowLevel:
+			theConfig->lowLevel = true;
+			return(0);
+			break;
+
+		case kOptPinThreads:
+			theConfig->pinThreads = true;
+			return(0);
+			break;
+
+		case kOptWritebackCache:
+			theConfig->writebackCache = true;
+			return(0);
+			break;
+
+		case kOptReaddirPlus:
+			theValue = strchr(arg, '=') + 1;
+
+			if (strcmp(theValue, "yes") == 0)
+				theConfig->readdirPlus = kReaddirPlusYes;
+
+			else if (strcmp(theValue, "no") == 0)
+				theConfig->readdirPlus = kReaddirPlusNo;
+
+			else if (strcmp(theValue, "auto") == 0)
+				theConfig->readdirPlus = kReaddirPlusAuto;
+
+			else
+				{
+				fprintf(stderr, "logfuse: invalid readdirplus '%s'\n", theValue);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case kOptMaxPages:
+		case kOptMaxThreads:
+		case kOptTierThreshold:
+		case kOptThrottleOps:
+			theValue = strchr(arg, '=') + 1;
+			theCount = (key == kOptMaxPages      ? &theConfig->maxPages      :
+						key == kOptMaxThreads    ? &theConfig->maxThreads    :
+						key == kOptTierThreshold ? &theConfig->tierThreshold :
+												   &theConfig->settings.throttleOps);
+
+			if (!logfuse_parse_size(theValue, theCount) || *theCount == 0)
+				{
+				fprintf(stderr, "logfuse: invalid count '%s'\n", arg);
+				return(-1);
+				}
+			return(0);
+			break;
+
+		case FUSE_OPT_KEY_NONOPT:
+			// Record the mount point
+			//
+			// The mount point is left for FUSE, but is recorded so that the log
+			// can name it when there are several mounts.
+			if (theConfig->mountPoint.empty())
+				theConfig->mountPoint = arg;
+			break;
+
+		default:
+			break;
+		}
+
+
+
+	// Pass through to FUSE
+	return(1);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_config_load : Load the configuration from a file.
+//----------------------------------------------------------------------------
+static bool logfuse_config_load(const char *thePath, logfuse_config &theConfig)
+{	fuse_args			theArgs = FUSE_ARGS_INIT(0, nullptr);
+	char				*theLine = nullptr;
+	size_t				lineSize = 0;
+	FILE				*theFile;
+	char				*theText;
+	size_t				theSize;
+	bool				isValid;
+
+
+
+	// Read the options
+	//
+	// Each line of the file holds an option in its -o form, with blank lines
+	// and lines that start with a '#' ignored.
+	theFile = fopen(thePath, "r");
+	if (theFile == nullptr)
+		return(false);
+
+	fuse_opt_add_arg(&theArgs, "logfuse");
+
+	while (getline(&theLine, &lineSize, theFile) != -1)
+		{
+		theText = theLine + strspn(theLine, " \t");
+		theSize = strlen(theText);
+
+		while (theSize != 0 && isspace((unsigned char) theText[theSize - 1]))
+			theText[--theSize] = 0x00;
+
+		if (theSize != 0 && theText[0] != '#')
+			{
+			fuse_opt_add_arg(&theArgs, "-o");
+			fuse_opt_add_arg(&theArgs, theText);
+			}
+		}
+
+	free(theLine);
+	fclose(theFile);
+
+
+
+	// Parse the options
+	//
+	// The file is applied over the options given at mount time, so removing
+	// a setting from the file restores its original value. Rules and mounts
+	// in the file replace those of the same kind given at mount time, rather
+	// than being added to them.
+	//
+	// Options that are not ours are rejected.
+	theConfig = gConfig;
+	theConfig.settings.cacheRules.clear();
+	theConfig.settings.delayRules.clear();
+	theConfig.settings.faultRules.clear();
+	theConfig.mounts.clear();
+
+	isValid = (fuse_opt_parse(&theArgs, &theConfig, kLogfuseOptions, logfuse_opt_proc) == 0 && theArgs.argc == 1);
+
+	if (isValid)
+		{
+		if (theConfig.settings.cacheRules.empty())
+			theConfig.settings.cacheRules = gConfig.settings.cacheRules;
+
+		if (theConfig.settings.delayRules.empty())
+			theConfig.settings.delayRules = gConfig.settings.delayRules;
+
+		if (theConfig.settings.faultRules.empty())
+			theConfig.settings.faultRules = gConfig.settings.faultRules;
+
+		if (theConfig.mounts.empty())
+			theConfig.mounts = gConfig.mounts;
+		}
+
+	fuse_opt_free_args(&theArgs);
+
+	return(isValid);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_config_fixed : Get the fixed options that a configuration changes.
+//----------------------------------------------------------------------------
+static std::string logfuse_config_fixed(const logfuse_config &theConfig)
+{	std::string		theText;
+	bool			sameMounts;
+
+
+
+	// Compare the options
+	//
+	// Options other than the settings are fixed once mounted.
+	sameMounts = (theConfig.mounts.size() == gConfig.mounts.size());
+
+	for (size_t n = 0; sameMounts && n < theConfig.mounts.size(); n++)
+		sameMounts = (theConfig.mounts[n].rootPath   == gConfig.mounts[n].rootPath &&
+					  theConfig.mounts[n].mountPoint == gConfig.mounts[n].mountPoint);
+
+	const std::pair<const char *, bool> theOptions[] = {
+		{ "config",				theConfig.configPath       != gConfig.configPath       },
+		{ "tier",				theConfig.tierPath         != gConfig.tierPath         },
+		{ "tier_threshold",		theConfig.tierThreshold    != gConfig.tierThreshold    },
+		{ "tier_max",			theConfig.tierMax          != gConfig.tierMax          },
+		{ "content_cache",		theConfig.contentCacheSize != gConfig.contentCacheSize },
+		{ "content_cache_max",	theConfig.contentCacheMax  != gConfig.contentCacheMax  },
+		{ "readdir_stat",		theConfig.readdirStat      != gConfig.readdirStat      },
+		{ "dir_cache",			theConfig.dirCacheSize     != gConfig.dirCacheSize     },
+		{ "root",				theConfig.rootPath         != gConfig.rootPath         },
+		{ "mount",				!sameMounts                                            },
+		{ "fd_cache",			theConfig.fdCacheSize      != gConfig.fdCacheSize      },
+		{ "attr_timeout",		theConfig.attrTimeout      != gConfig.attrTimeout      },
+		{ "entry_timeout",		theConfig.entryTimeout     != gConfig.entryTimeout     },
+		{ "negative_timeout",	theConfig.negativeTimeout  != gConfig.negativeTimeout  },
+		{ "readdirplus",		theConfig.readdirPlus      != gConfig.readdirPlus      },
+		{ "max_pages",			theConfig.maxPages         != gConfig.maxPages         },
+		{ "lowlevel",			theConfig.lowLevel         != gConfig.lowLevel         },
+		{ "max_threads",		theConfig.maxThreads       != gConfig.maxThreads       },
+		{ "pin_threads",		theConfig.pinThreads       != gConfig.pinThreads       },
+		{ "writeback_cache",	theConfig.writebackCache   != gConfig.writebackCache   }
+	};
+
+
+
+	// Get the names
+	for (const auto &theOption : theOptions)
+		{
+		if (!theOption.second)
+			continue;
+
+		if (!theText.empty())
+			theText += ", ";
+
+		theText += theOption.first;
+		}
+
+	return(theText);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_settings_publish : Publish new settings.
+//----------------------------------------------------------------------------
+static bool logfuse_settings_publish(const logfuse_settings &newSettings)
+{	std::lock_guard<std::mutex>					acquireLock(gSettings.theLock);
+	std::unique_ptr<logfuse_settings>			theSettings(new logfuse_settings(newSettings));
+	const logfuse_settings						*oldSettings;
+	int											theFd;
+
+
+
+	// Open the sink
+	//
+	// A file sink is opened afresh each time the settings are published, so
+	// that a reload will follow a log file that has been rotated.
+	//
+	// Buffered messages are written to the file they were logged for before
+	// the sink's descriptor is pointed at the new file.
+	theSettings->logFd = -1;
+
+	if (theSettings->logSink == "stderr")
+		theSettings->logFd = STDERR_FILENO;
+
+	else if (!theSettings->logSink.empty() && theSettings->logSink != "system")
+		{
+		theFd = open(theSettings->logSink.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (theFd == -1)
+			return(false);
+
+		if (gSettings.sinkFd == -1)
+			gSettings.sinkFd = theFd;
+		else
+			{
+			logfuse_log_flush(std::chrono::steady_clock::now() + std::chrono::milliseconds(kLogDrainTimeout));
+
+			dup2(theFd, gSettings.sinkFd);
+			fcntl(gSettings.sinkFd, F_SETFD, FD_CLOEXEC);
+			close(theFd);
+			}
+
+		theSettings->logFd = gSettings.sinkFd;
+		}
+
+
+
+	// Publish the settings
+	oldSettings = gSettings.theCurrent.exchange(theSettings.get(), std::memory_order_acq_rel);
+
+	gSettings.theSnapshots.push_back(std::move(theSettings));
+
+	if (oldSettings == nullptr)
+		return(true);
+
+
+
+	// Invalidate the caches
+	//
+	// A cache whose TTL has changed is invalidated, as its entries may have
+	// outlived the new TTL or missed invalidations while it was disabled.
+	if (oldSettings->attrCacheTTL != newSettings.attrCacheTTL)
+		logfuse_path_cache_remove_tree(gAttrCache, "/");
+
+	if (oldSettings->negativeCacheTTL != newSettings.negativeCacheTTL)
+		logfuse_path_cache_remove_tree(gNegativeCache, "/");
+
+	if (oldSettings->accessCacheTTL != newSettings.accessCacheTTL)
+		logfuse_path_cache_remove_tree(gAccessCache, "/");
+
+	if (oldSettings->xattrCacheTTL != newSettings.xattrCacheTTL)
+		logfuse_path_cache_remove_tree(gXattrCache, "/");
+
+	return(true);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_settings_reload : Reload the settings.
+//----------------------------------------------------------------------------
+static void logfuse_settings_reload()
+{	const char			*thePath = gConfig.configPath.c_str();
+	logfuse_config		theConfig;
+	std::string			fixedNames;
+
+
+
+	// Load the file
+	//
+	// Settings that fail to load leave the current settings in place, as do
+	// rules that the low-level frontend would reject at mount time.
+	if (!logfuse_config_load(thePath, theConfig))
+		{
+		logfuse_log("logfuse_config: unable to reload %s", thePath);
+		return;
+		}
+
+	if (gConfig.lowLevel && (!theConfig.settings.delayRules.empty() || !theConfig.settings.faultRules.empty()))
+		{
+		logfuse_log("logfuse_config: unable to reload %s, delay and fault rules are not supported with lowlevel", thePath);
+		return;
+		}
+
+
+
+	// Reload the settings
+	//
+	// Changes to options that are fixed once mounted are reported, rather
+	// than silently dropped.
+	fixedNames = logfuse_config_fixed(theConfig);
+	if (!fixedNames.empty())
+		logfuse_log("logfuse_config: ignoring changes to %s until remounted", fixedNames.c_str());
+
+	if (logfuse_settings_publish(theConfig.settings))
+		logfuse_log("logfuse_config: reloaded %s", thePath);
+	else
+		logfuse_log("logfuse_config: unable to reload %s", thePath);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_match : Does an injection rule match an operation?
+//----------------------------------------------------------------------------
+static bool logfuse_inject_match(const std::vector<std::string> &theOps, const std::string &thePattern, const char *theOp, const char *path)
+{
+
+
+	// Check the rule
+	if (!theOps.empty() && std::find(theOps.begin(), theOps.end(), theOp) == theOps.end())
+		return(false);
+
+	return(path != nullptr && fnmatch(thePattern.c_str(), path, 0) == 0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_random : Get the random number generator.
+//----------------------------------------------------------------------------
+static std::mt19937_64 &logfuse_inject_random()
+{	thread_local std::mt19937_64		theRandom(std::random_device{}());
+
+
+
+	// Get the generator
+	//
+	// Each thread has its own generator, so injection never contends.
+	return(theRandom);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_delay : Inject a delay into an operation.
+//----------------------------------------------------------------------------
+static void logfuse_inject_delay(const logfuse_settings *theSettings, const char *theOp, const char *path)
+{	double		theDelay;
+	double		theSigma;
+	double		theMedian;
+
+
+
+	// Find the rule
+	//
+	// The first rule that matches the operation applies.
+	for (const auto &theRule : theSettings->delayRules)
+		{
+		if (!logfuse_inject_match(theRule.ops, theRule.pattern, theOp, path))
+			continue;
+
+
+
+		// Get the delay
+		//
+		// Long-tailed delays are log-normal, with the spread chosen so that one
+		// in a hundred operations waits longer than the 99th percentile.
+		switch (theRule.kind) {
+			case kDelayFixed:
+				theDelay = (double) theRule.minTime;
+				break;
+
+			case kDelayUniform:
+				theDelay = std::uniform_real_distribution<double>((double) theRule.minTime, (double) theRule.maxTime)(logfuse_inject_random());
+				break;
+
+			case kDelayTail:
+				theMedian = (double) theRule.minTime;
+				theSigma  = log((double) theRule.maxTime / theMedian) / 2.3263;
+				theDelay  = std::lognormal_distribution<double>(log(theMedian), theSigma)(logfuse_inject_random());
+				break;
+			}
+
+
+
+		// Delay the operation
+		logfuse_stat_add(kStatInjectDelay);
+		std::this_thread::sleep_for(std::chrono::nanoseconds((uint64_t) theDelay));
+		break;
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_fault : Inject an error into an operation.
+//----------------------------------------------------------------------------
+static int logfuse_inject_fault(const logfuse_settings *theSettings, const char *theOp, const char *path, bool isAfter)
+{
+
+
+	// Check our state
+	//
+	// Operations that open a handle can only fail before the backing call,
+	// as a handle opened by a call that failed would never be released.
+	if (isAfter && (strcmp(theOp, "open") == 0 || strcmp(theOp, "create") == 0 || strcmp(theOp, "opendir") == 0))
+		return(0);
+
+
+
+	// Inject the fault
+	//
+	// Each rule that matches the operation is tried in turn, and the first to
+	// fire supplies the error.
+	for (const auto &theRule : theSettings->faultRules)
+		{
+		if (theRule.isAfter == isAfter && logfuse_inject_match(theRule.ops, theRule.pattern, theOp, path) &&
+			std::generate_canonical<double, 53>(logfuse_inject_random()) < theRule.theRate)
+			{
+			logfuse_stat_add(kStatInjectFault);
+			logfuse_log("logfuse_inject: %s(%s) err=%d %s", theOp, path, -theRule.sysErr, isAfter ? "after" : "before");
+
+			return(-theRule.sysErr);
+			}
+		}
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_throttle_refill : Refill a token bucket.
+//----------------------------------------------------------------------------
+static bool logfuse_throttle_refill(logfuse_bucket &theBucket, size_t theRate, double theBurst, uint64_t timeNow)
+{	double		theCapacity = (double) theRate * theBurst;
+
+
+
+	// Check our state
+	//
+	// A bucket without a rate is never drawn from, so is always full.
+	if (theRate == 0)
+		return(true);
+
+
+
+	// Refill the bucket
+	//
+	// New buckets start full, so that a caller can always use its burst.
+	if (theBucket.lastTime == 0)
+		theBucket.tokens = theCapacity;
+	else
+		theBucket.tokens = std::min(theCapacity, theBucket.tokens + ((double) theRate * (double) (timeNow - theBucket.lastTime) / 1000000000.0));
+
+	theBucket.lastTime = timeNow;
+
+	return(theBucket.tokens >= theCapacity);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_throttle : Throttle a caller.
+//----------------------------------------------------------------------------
+static void logfuse_throttle(const logfuse_settings *theSettings, uid_t uid, pid_t pid, size_t numOps, size_t numBytes)
+{	double		theBurst = (double) theSettings->throttleBurst / 1000000000.0;
+	bool		wantOps   = (theSettings->throttleOps   != 0 && numOps   != 0);
+	bool		wantBytes = (theSettings->throttleBytes != 0 && numBytes != 0);
+	uint64_t	theWait   = 0;
+	uint64_t	timeNow;
+	uint32_t	theKey;
+
+
+
+	// Check our state
+	if (!wantOps && !wantBytes)
+		return;
+
+
+
+	// Find the caller
+	//
+	// Callers that are idle are discarded when a shard grows too large, as
+	// their buckets have refilled and would be recreated full.
+	theKey = theSettings->throttleByPID ? (uint32_t) pid : (uint32_t) uid;
+
+	logfuse_throttle_shard &theShard = gThrottle.theShards[theKey % kThrottleShards];
+
+	{	std::lock_guard<std::mutex>		acquireLock(theShard.theLock);
+
+		timeNow = logfuse_time_now();
+
+		if (theShard.theEntries.size() >= kThrottleMaxEntries && theShard.theEntries.count(theKey) == 0)
+			{
+			for (auto theIter = theShard.theEntries.begin(); theIter != theShard.theEntries.end(); )
+				{
+				if (logfuse_throttle_refill(theIter->second.theOps,   theSettings->throttleOps,   theBurst, timeNow) &&
+					logfuse_throttle_refill(theIter->second.theBytes, theSettings->throttleBytes, theBurst, timeNow))
+					theIter = theShard.theEntries.erase(theIter);
+				else
+					theIter++;
+				}
+			}
+
+		logfuse_throttle_entry &theEntry = theShard.theEntries[theKey];
+
+
+
+		// Draw from the buckets
+		//
+		// A request is charged in full even if it overdraws a bucket, and then
+		// waits for the debt to be repaid. Charging up front queues callers in
+		// the order they arrived, and lets a request larger than the burst
+		// proceed.
+		if (wantOps)
+			{
+			logfuse_throttle_refill(theEntry.theOps, theSettings->throttleOps, theBurst, timeNow);
+			theEntry.theOps.tokens -= (double) numOps;
+
+			if (theEntry.theOps.tokens < 0.0)
+				theWait = std::max(theWait, (uint64_t) (-theEntry.theOps.tokens * 1000000000.0 / (double) theSettings->throttleOps));
+			}
+
+		if (wantBytes)
+			{
+			logfuse_throttle_refill(theEntry.theBytes, theSettings->throttleBytes, theBurst, timeNow);
+			theEntry.theBytes.tokens -= (double) numBytes;
+
+			if (theEntry.theBytes.tokens < 0.0)
+				theWait = std::max(theWait, (uint64_t) (-theEntry.theBytes.tokens * 1000000000.0 / (double) theSettings->throttleBytes));
+			}
+	}
+
+
+
+	// Wait for the buckets
+	if (theWait != 0)
+		{
+		logfuse_stat_add(kStatThrottleWait);
+		logfuse_stat_add(kStatThrottleTime, theWait / 1000);
+
+		std::this_thread::sleep_for(std::chrono::nanoseconds(theWait));
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_throttle_caller : Throttle the caller of an operation.
+//----------------------------------------------------------------------------
+static void logfuse_throttle_caller(size_t numOps, size_t numBytes)
+{	fuse_context		*theContext = fuse_get_context();
+
+
+
+	// Throttle the caller
+	logfuse_throttle(logfuse_get_settings(), theContext->uid, theContext->pid, numOps, numBytes);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_op : Inject delays and errors into an operation.
+//----------------------------------------------------------------------------
+template<typename T, int N>
+struct logfuse_inject_op;
+
+template<typename R, typename... A, int N>
+struct logfuse_inject_op<R (*)(const char *, A...), N> {
+	static R			(*theFunc)(const char *, A...);
+	static const char	*theName;
+
+	static R invoke(const char *path, A... theArgs)
+	{	const logfuse_settings		*theSettings = logfuse_get_settings();
+		fuse_context				*theContext  = fuse_get_context();
+		R							sysErr;
+
+
+
+		// Invoke the operation
+		//
+		// The caller is throttled before anything is injected, so that injected
+		// delays are not hidden by time spent waiting for the throttle.
+		//
+		// An error injected before the call replaces it, while one injected
+		// after the call replaces the result of a call that succeeded.
+		logfuse_throttle(theSettings, theContext->uid, theContext->pid, 1, 0);
+		logfuse_inject_delay(theSettings, theName, path);
+
+		sysErr = (R) logfuse_inject_fault(theSettings, theName, path, false);
+		if (sysErr == 0)
+			{
+			sysErr = theFunc(path, theArgs...);
+
+			if (sysErr >= 0)
+				{
+				R theErr = (R) logfuse_inject_fault(theSettings, theName, path, true);
+				if (theErr != 0)
+					sysErr = theErr;
+				}
+			}
+
+		return(sysErr);
+	}
+};
+
+template<typename R, typename... A, int N>
+R (*logfuse_inject_op<R (*)(const char *, A...), N>::theFunc)(const char *, A...);
+
+template<typename R, typename... A, int N>
+const char *logfuse_inject_op<R (*)(const char *, A...), N>::theName;
+
+
+
+
+
+//============================================================================
+//		logfuse_inject_ops : Inject delays and errors into the operations.
+//----------------------------------------------------------------------------
+static void logfuse_inject_ops(fuse_operations &fuseOps)
+{
+
+
+	// Wrap the operations
+	//
+	// Each operation that takes a path is replaced by a wrapper that calls
+	// through to the original, so that injection and throttling are invisible
+	// to the callbacks.
+	//
+	// Releases are left alone, as the kernel ignores their result and a
+	// release that was skipped would leak its handle. They are sent by the
+	// kernel rather than a caller, so are never throttled either.
+	INJECT_OP(fuseOps, getattr);
+	INJECT_OP(fuseOps, readlink);
+	INJECT_OP(fuseOps, mknod);
+	INJECT_OP(fuseOps, mkdir);
+	INJECT_OP(fuseOps, unlink);
+	INJECT_OP(fuseOps, rmdir);
+	INJECT_OP(fuseOps, symlink);
+	INJECT_OP(fuseOps, rename);
+	INJECT_OP(fuseOps, link);
+	INJECT_OP(fuseOps, chmod);
+	INJECT_OP(fuseOps, chown);
+	INJECT_OP(fuseOps, truncate);
+	INJECT_OP(fuseOps, open);
+	INJECT_OP(fuseOps, read);
+	INJECT_OP(fuseOps, write);
+	INJECT_OP(fuseOps, statfs);
+	INJECT_OP(fuseOps, flush);
+	INJECT_OP(fuseOps, fsync);
+	INJECT_OP(fuseOps, setxattr);
+	INJECT_OP(fuseOps, getxattr);
+	INJECT_OP(fuseOps, listxattr);
+	INJECT_OP(fuseOps, removexattr);
+	INJECT_OP(fuseOps, opendir);
+	INJECT_OP(fuseOps, readdir);
+	INJECT_OP(fuseOps, fsyncdir);
+	INJECT_OP(fuseOps, access);
+	INJECT_OP(fuseOps, create);
+	INJECT_OP(fuseOps, lock);
+	INJECT_OP(fuseOps, utimens);
+	INJECT_OP(fuseOps, ioctl);
+	INJECT_OP(fuseOps, poll);
+	INJECT_OP(fuseOps, flock);
+	INJECT_OP(fuseOps, fallocate);
+
+#if FUSE_USE_VERSION < 30
+	INJECT_OP(fuseOps, ftruncate);
+	INJECT_OP(fuseOps, fgetattr);
+#endif
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	INJECT_OP(fuseOps, copy_file_range);
+	INJECT_OP(fuseOps, lseek);
+#endif
+
+#if FUSE_APPLE
+	INJECT_OP(fuseOps, setvolname);
+	INJECT_OP(fuseOps, exchange);
+	INJECT_OP(fuseOps, getxtimes);
+	INJECT_OP(fuseOps, setbkuptime);
+	INJECT_OP(fuseOps, setchgtime);
+	INJECT_OP(fuseOps, setcrtime);
+	INJECT_OP(fuseOps, chflags);
+	INJECT_OP(fuseOps, setattr_x);
+	INJECT_OP(fuseOps, fsetattr_x);
+#endif
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_signal_thread : Signal thread.
+//----------------------------------------------------------------------------
+static void logfuse_signal_thread()
+{	sigset_t	theSignals;
+	int			theSignal;
+
+
+
+	// Get the state we need
+	//
+	// The signals we handle are blocked in every thread by main(), so they
+	// are only delivered here.
+	sigemptyset(&theSignals);
+	sigaddset(  &theSignals, SIGUSR1);
+
+	if (!gConfig.configPath.empty())
+		sigaddset(&theSignals, SIGHUP);
+
+
+
+	// Handle signals
+	while (sigwait(&theSignals, &theSignal) == 0)
+		{
+		if (theSignal == SIGUSR1)
+			{
+			logfuse_stats_log();
+			logfuse_log_flush(std::chrono::steady_clock::now() + std::chrono::milliseconds(kLogDrainTimeout));
+			}
+
+		else if (theSignal == SIGHUP)
+			logfuse_settings_reload();
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readdir_stat : Get the full attributes of a directory entry.
+//----------------------------------------------------------------------------
+static void logfuse_readdir_stat(const logfuse_settings *theSettings, const char *path, logfuse_dir_info *dirInfo, std::string &childPath, struct stat &statInfo)
+{	const char		*theName = dirInfo->entry->d_name;
+	uint64_t		theGeneration = 0;
+	struct stat		entryInfo;
+
+
+
+	// Get the state we need
+	//
+	// The entry is stat'd relative to the open directory, which avoids a walk
+	// of the full path for each entry. The time is taken before the stat, so
+	// that an invalidation of the entry while it is in progress wins.
+	if (strcmp(theName, ".") == 0 || strcmp(theName, "..") == 0)
+		return;
+
+	if (theSettings->attrCacheTTL != 0)
+		{
+		childPath.assign(path);
+		if (childPath.back() != '/')
+			childPath.push_back('/');
+
+		childPath.append(theName);
+		theGeneration = logfuse_time_now();
+		}
+
+
+
+	// Get the attributes
+	//
+	// Setting st_blksize to 0 ensures FUSE uses the global iosize option,
+	// and seeding the attribute cache avoids a backing call for the getattr
+	// that typically follows each entry.
+	if (fstatat(logfuse_dir_fd(dirInfo), theName, &entryInfo, AT_SYMLINK_NOFOLLOW) == 0)
+		{
+		entryInfo.st_blksize = 0;
+		statInfo             = entryInfo;
+
+		if (theSettings->attrCacheTTL != 0)
+			logfuse_path_cache_insert(gAttrCache, childPath.c_str(), entryInfo, theSettings->attrCacheTTL, theGeneration);
+		}
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readdir_fill : Fill a directory entry.
+//----------------------------------------------------------------------------
+static int logfuse_readdir_fill(void *buffer, fuse_fill_dir_t filler, const char *theName, const struct stat &statInfo, off_t offset)
+{
+
+
+	// Fill the entry
+	//
+	// An entry that was stat'd carries its full attributes, which allows
+	// FUSE 3 to skip the lookup that would otherwise follow it.
+#if FUSE_USE_VERSION >= 30
+	return(filler(buffer, theName, &statInfo, offset, statInfo.st_nlink != 0 ? FUSE_FILL_DIR_PLUS : (fuse_fill_dir_flags) 0));
+#else
+	return(filler(buffer, theName, &statInfo, offset));
+#endif
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readdir_snapshot : Read a directory snapshot.
+//----------------------------------------------------------------------------
+static int logfuse_readdir_snapshot(const logfuse_settings *theSettings, const char *path, const logfuse_dir_snapshot &theSnapshot, void *buffer, fuse_fill_dir_t filler, off_t offset, bool wantStat)
+{	uint64_t		theGeneration;
+	std::string		childPath;
+	struct stat		statInfo;
+
+
+
+	// Read the entries
+	//
+	// The offset of an entry within a snapshot is the index of the entry
+	// that follows it.
+	//
+	// Full attributes are only returned while they are in the attribute
+	// cache, which bounds their age by its TTL.
+	wantStat = (wantStat && theSettings->attrCacheTTL != 0);
+
+	for (size_t n = (size_t) offset; n < theSnapshot.theEntries.size(); n++)
+		{
+		const logfuse_dir_entry &theEntry = theSnapshot.theEntries[n];
+
+		memset(&statInfo, 0, sizeof(statInfo));
+		statInfo.st_ino  = theEntry.inode;
+		statInfo.st_mode = theEntry.type;
+
+		if (wantStat && theEntry.name != "." && theEntry.name != "..")
+			{
+			childPath.assign(path);
+			if (childPath.back() != '/')
+				childPath.push_back('/');
+
+			childPath.append(theEntry.name);
+			logfuse_path_cache_find(gAttrCache, childPath.c_str(), &statInfo, &theGeneration);
+			}
+
+		if (logfuse_readdir_fill(buffer, filler, theEntry.name.c_str(), statInfo, (off_t) (n + 1)))
+			{
+			logfuse_log("logfuse_readdir(%s, %s) err=0 cached", path, theEntry.name.c_str());
+			break;
+			}
+		}
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readdir_cache : Cache a completed directory snapshot.
+//----------------------------------------------------------------------------
+static void logfuse_readdir_cache(const char *path, logfuse_dir_info *dirInfo)
+{	logfuse_dir_snapshot_ref	theSnapshot;
+	struct stat					statInfo;
+
+
+
+	// Get the state we need
+	theSnapshot = dirInfo->pending;
+	dirInfo->pending.reset();
+
+
+
+	// Cache the snapshot
+	//
+	// A directory that changed while it was being read may be inconsistent.
+	if (fstat(logfuse_dir_fd(dirInfo), &statInfo) == 0                           &&
+		theSnapshot->modTime.tv_sec     == STAT_MTIME(statInfo).tv_sec  &&
+		theSnapshot->modTime.tv_nsec    == STAT_MTIME(statInfo).tv_nsec &&
+		theSnapshot->changeTime.tv_sec  == STAT_CTIME(statInfo).tv_sec  &&
+		theSnapshot->changeTime.tv_nsec == STAT_CTIME(statInfo).tv_nsec)
+		logfuse_dir_cache_insert(path, theSnapshot);
+}
+
+
+
+
+
+#pragma mark FUSE
+//============================================================================
+//		FUSE methods.
+//----------------------------------------------------------------------------
+//		logfuse_getattr : Get file attributes.
+//----------------------------------------------------------------------------
+static int logfuse_getattr(const char *path, struct stat *statInfo)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	uint64_t				theGeneration = 0;
+	uint64_t				negGeneration = 0;
+	int						sysErr;
+
+
+
+	// Check the cache
+	if (theSettings->attrCacheTTL != 0)
+		{
+		if (logfuse_path_cache_find(gAttrCache, path, statInfo, &theGeneration))
+			{
+			logfuse_stat_add(kStatAttrCacheHit);
+			logfuse_log("logfuse_getattr(%s) err=0 cached", path);
+			return(0);
+			}
+
+		logfuse_stat_add(kStatAttrCacheMiss);
+		}
+
+	if (logfuse_negative_find(theSettings, path, &negGeneration))
+		{
+		logfuse_log("logfuse_getattr(%s) err=-1 cached", path);
+		return(-ENOENT);
+		}
+
+
+
+	// Get the attributes
+	//
+	// Setting st_blksize to 0 ensures FUSE uses the global iosize option.
+	sysErr               = fstatat(logfuse_root_fd(), logfuse_path(path), statInfo, AT_SYMLINK_NOFOLLOW);
+	statInfo->st_blksize = 0;
+
+	logfuse_negative_insert(theSettings, path, sysErr, negGeneration);
+
+	if (sysErr == 0 && theSettings->attrCacheTTL != 0)
+		logfuse_path_cache_insert(gAttrCache, path, *statInfo, theSettings->attrCacheTTL, theGeneration);
+
+	logfuse_log("logfuse_getattr(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readlink : Read a symbol link.
+//----------------------------------------------------------------------------
+static int logfuse_readlink(const char *path, char *buffer, size_t size)
+{	int		sysErr;
+
+
+
+	// Read the link
+	sysErr = readlinkat(logfuse_root_fd(), logfuse_path(path), buffer, size - 1);
+	buffer[sysErr == -1 ? 0 : sysErr] = 0x00;
+
+	logfuse_log("logfuse_readlink(%s, %s) err=%d", path, buffer, sysErr);
+
+	if (sysErr == -1)
+		return(-errno);
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mknod : Create a file node.
+//----------------------------------------------------------------------------
+static int logfuse_mknod(const char *path, mode_t mode, dev_t rdev)
+{	int		sysErr;
+
+
+
+	// Create the node
+#if FUSE_APPLE
+	if (S_ISFIFO(mode))
+		sysErr = mkfifo(logfuse_full_path(path).c_str(), mode);
+	else
+		sysErr = mknod( logfuse_full_path(path).c_str(), mode, rdev);
+#else
+	if (S_ISFIFO(mode))
+		sysErr = mkfifoat(logfuse_root_fd(), logfuse_path(path), mode);
+	else
+		sysErr = mknodat( logfuse_root_fd(), logfuse_path(path), mode, rdev);
+#endif
+
+	logfuse_invalidate_name(path);
+	logfuse_invalidate_created(path, false);
+
+	logfuse_log("logfuse_mknod(%s, %d, %d) err=%d", path, mode, (int) rdev, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_mkdir : Create a directory.
+//----------------------------------------------------------------------------
+static int logfuse_mkdir(const char *path, mode_t mode)
+{	int		sysErr;
+
+
+
+	// Create the directory
+	sysErr = mkdirat(logfuse_root_fd(), logfuse_path(path), mode);
+
+	logfuse_invalidate_name(path);
+	logfuse_invalidate_created(path, false);
+
+	logfuse_log("logfuse_mkdir(%s, %d) err=%d", path, mode, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_unlink : Remove a file.
+//----------------------------------------------------------------------------
+static int logfuse_unlink(const char *path)
+{	logfuse_file_id		fileID;
+	bool				hasFile;
+	int					sysErr;
+
+
+
+	// Remove the file
+	hasFile = logfuse_fd_cache_identify(path, &fileID);
+
+	sysErr = unlinkat(logfuse_root_fd(), logfuse_path(path), 0);
+	logfuse_invalidate_name(path);
+
+	if (sysErr == 0 && hasFile)
+		logfuse_fd_cache_purge(fileID);
+
+	logfuse_log("logfuse_unlink(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_rmdir : Remove a directory.
+//----------------------------------------------------------------------------
+static int logfuse_rmdir(const char *path)
+{	int		sysErr;
+
+
+
+	// Remove the directory
+	sysErr = unlinkat(logfuse_root_fd(), logfuse_path(path), AT_REMOVEDIR);
+	logfuse_invalidate_name(path);
+
+	logfuse_log("logfuse_rmdir(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_symlink : Create a symbolic link.
+//----------------------------------------------------------------------------
+static int logfuse_symlink(const char *from, const char *to)
+{	int		sysErr;
+
+
+
+	// Create the link
+	sysErr = symlinkat(from, logfuse_root_fd(), logfuse_path(to));
+
+	logfuse_invalidate_name(to);
+	logfuse_invalidate_created(to, true);
+
+	logfuse_log("logfuse_symlink(%s, %s) err=%d", from, to, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_rename : Rename a file.
+//----------------------------------------------------------------------------
+static int logfuse_rename(const char *from, const char *to)
+{	logfuse_file_id		fileID;
+	bool				hasFile;
+	int					sysErr;
+
+
+
+	// Rename the file
+	//
+	// Any file replaced by the rename is no longer reachable through the mount.
+	logfuse_content_invalidate_path(to);
+	hasFile = logfuse_fd_cache_identify(to, &fileID);
+
+	sysErr = renameat(logfuse_root_fd(), logfuse_path(from), logfuse_root_fd(), logfuse_path(to));
+
+	if (sysErr == 0)
+		{
+		if (hasFile)
+			logfuse_fd_cache_purge(fileID);
+
+		logfuse_invalidate_rename(from, to);
+		}
+	else
+		{
+		logfuse_invalidate_name(from);
+		logfuse_invalidate_name(to);
+		logfuse_invalidate_created(to, true);
+		}
+
+	logfuse_log("logfuse_rename(%s, %s) err=%d", from, to, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_link : Create a hard link.
+//----------------------------------------------------------------------------
+static int logfuse_link(const char *from, const char *to)
+{	int		sysErr;
+
+
+
+	// Create the link
+	sysErr = linkat(logfuse_root_fd(), logfuse_path(from), logfuse_root_fd(), logfuse_path(to), 0);
+
+	logfuse_invalidate_attr(from);
+	logfuse_invalidate_name(to);
+	logfuse_invalidate_created(to, false);
+
+	logfuse_log("logfuse_link(%s, %s) err=%d", from, to, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_chmod : Change the permission bits.
+//----------------------------------------------------------------------------
+static int logfuse_chmod(const char *path, mode_t mode)
+{	int		sysErr;
+
+
+
+	// Change the permission
+	sysErr = fchmodat(logfuse_root_fd(), logfuse_path(path), mode, 0);
+	logfuse_invalidate_attr(path);
+	logfuse_invalidate_access(path);
+
+	logfuse_log("logfuse_chmod(%s, %d) err=%d", path, mode, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_chown : Change the owner and group of a file.
+//----------------------------------------------------------------------------
+static int logfuse_chown(const char *path, uid_t owner, gid_t group)
+{	int		sysErr;
+
+
+
+	// Change the owner/group
+	sysErr = fchownat(logfuse_root_fd(), logfuse_path(path), owner, group, 0);
+	logfuse_invalidate_attr(path);
+	logfuse_invalidate_access(path);
+
+	logfuse_log("logfuse_chown(%s, %d, %d) err=%d", path, owner, group, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_truncate : Change the size of a file.
+//----------------------------------------------------------------------------
+static int logfuse_truncate(const char *path, off_t length)
+{	int		sysErr;
+
+
+
+	// Change the size
+	sysErr = truncate(logfuse_full_path(path).c_str(), length);
+	logfuse_invalidate_attr(path);
+
+	if (sysErr == 0)
+		logfuse_content_invalidate_path(path);
+
+	logfuse_log("logfuse_truncate(%s, %lld) err=%d", path, (long long) length, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_open : Open a file.
+//----------------------------------------------------------------------------
+static int logfuse_open(const char *path, fuse_file_info *fileInfo)
+{	logfuse_cache_policy	thePolicy;
+	logfuse_file_info		*theFile;
+	struct stat				statInfo;
+	bool					wasCached;
+	bool					wasTiered;
+	bool					wantCopy;
+	bool					gotInfo;
+	int						fd;
+
+
+
+	// Open the file
+	//
+	// A file with a copy in the tier is opened from there, which only needs
+	// the attributes of the original. These are shared with the descriptor
+	// cache when the file is opened from the backing store instead.
+	fd        = -1;
+	wasCached = false;
+	wantCopy  = false;
+	gotInfo   = false;
+
+	if (logfuse_tier_eligible(fileInfo->flags))
+		{
+		gotInfo = logfuse_open_stat(path, &statInfo);
+		if (gotInfo)
+			fd = logfuse_tier_open(statInfo, &wantCopy);
+		}
+
+	wasTiered = (fd != -1);
+
+	if (!wasTiered)
+		fd = logfuse_open_fd(path, logfuse_open_flags(fileInfo->flags), gotInfo ? &statInfo : nullptr, &wasCached);
+
+	if (wantCopy)
+		logfuse_tier_promote(fd, { statInfo.st_dev, statInfo.st_ino });
+
+	if (fd == -1)
+		{
+		logfuse_log("logfuse_open(%s, %s) fd=%d",
+						path,
+						logfuse_str_open_flags(fileInfo->flags).c_str(),
+						fd);
+
+		return(-errno);
+		}
+
+
+
+	// Prepare the file
+	theFile = logfuse_new_file(fd, logfuse_open_flags(fileInfo->flags));
+	if (theFile == nullptr)
+		{
+		close(fd);
+		return(-ENOMEM);
+		}
+
+	theFile->isTiered = wasTiered;
+
+	thePolicy    = logfuse_apply_cache_policy(path, fileInfo);
+	fileInfo->fh = (uintptr_t) theFile;
+
+	if ((fileInfo->flags & O_TRUNC) != 0)
+		logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_open(%s, %s) fd=%d cache=%s%s%s",
+					path,
+					logfuse_str_open_flags(fileInfo->flags).c_str(),
+					fd,
+					logfuse_str_cache_policy(thePolicy),
+					wasCached ? " cached" : "",
+					wasTiered ? " tiered" : "");
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_read : Read from a file.
+//----------------------------------------------------------------------------
+static int logfuse_read(const char *path, char *buffer, size_t size, off_t offset, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
+	bool					wasCached;
+	int						sysErr;
+
+
+
+	// Read the file
+	//
+	// Cached contents are only used while valid, as they are invalidated by
+	// any modification through the mount. Only reads from the backing file
+	// are throttled.
+	wasCached = (theFile->content != nullptr && theFile->content->isValid);
+
+	if (wasCached)
+		{
+		const std::string &theData = theFile->content->data;
+
+		sysErr = 0;
+		if (offset < (off_t) theData.size())
+			{
+			sysErr = (int) std::min(size, theData.size() - (size_t) offset);
+			memcpy(buffer, theData.data() + offset, (size_t) sysErr);
+			}
+		}
+	else
+		{
+		logfuse_throttle_caller(0, size);
+		sysErr = pread(theFile->fd, buffer, size, offset);
+		}
+
+	logfuse_log("logfuse_read(%s, size=%ld, offset=%lld) %s=%d%s",
+					path,
+					size,
+					(long long) offset,
+					sysErr >= 0 ? "read" : "err",
+					sysErr,
+					wasCached ? " cached" : "");
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_write : Write to a file.
+//----------------------------------------------------------------------------
+static int logfuse_write(const char *path, const char *buffer, size_t size, off_t offset, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
+	int						sysErr;
+
+
+
+	// Write the file
+	//
+	// Writes flushed from the writeback cache are marked in the log, as each
+	// one may carry many writes made by the application.
+	logfuse_throttle_caller(0, size);
+	sysErr = pwrite(theFile->fd, buffer, size, offset);
+
+	logfuse_invalidate_attr(path);
+	logfuse_content_invalidate(theFile->fileID);
+
+	logfuse_log("logfuse_write(%s, size=%ld, offset=%lld) %s=%d%s",
+					path,
+					size,
+					(long long) offset,
+					sysErr >= 0 ? "wrote" : "err",
+					sysErr,
+					fileInfo->writepage ? " writeback" : "");
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_statfs : Get file statistics.
+//----------------------------------------------------------------------------
+static int logfuse_statfs(const char *path, struct statvfs *statInfo)
+{	int		sysErr;
+
+
+
+	// Get the info
+	sysErr = statvfs(logfuse_full_path(path).c_str(), statInfo);
+	logfuse_log("logfuse_statfs(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_flush : Flush cached data.
+//----------------------------------------------------------------------------
+static int logfuse_flush(const char *path, fuse_file_info *fileInfo)
+{	int		sysErr;
+
+
+
+	// Flush the file
+	sysErr = close(dup(logfuse_get_fd(fileInfo)));
+	logfuse_log("logfuse_flush(%s, fd=%d) err=%d", path, logfuse_get_fd(fileInfo), sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_release : Release an open file.
+//----------------------------------------------------------------------------
+static int logfuse_release(const char *path, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
+	int						sysErr;
+
+
+
+	// Release the file
+	//
+	// Idle descriptors are parked for reuse, unless they hold a lock that
+	// closing them would release, or refer to a copy in the tier that no
+	// open would look up.
+	if (logfuse_fd_cache_eligible(theFile->flags) && !theFile->wasLocked && !theFile->isTiered && logfuse_fd_cache_park(theFile->fd, theFile->flags))
+		sysErr = 0;
+	else
+		sysErr = close(theFile->fd);
+
+	logfuse_log("logfuse_close(%s) err=%d", path, sysErr);
+
+	delete theFile;
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fsync : Synchronize a file.
+//----------------------------------------------------------------------------
+static int logfuse_fsync(const char *path, int dataSync, fuse_file_info *fileInfo)
+{	int		sysErr;
+
+
+
+	// Sync the file
+	sysErr = fsync(logfuse_get_fd(fileInfo));
+	logfuse_log("logfuse_fsync(%s, %d) err=%d", path, dataSync, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_setxattr : Set an extended attribute.
+//----------------------------------------------------------------------------
+static int logfuse_setxattr(const char *path, const char *name, const char *value, size_t size, int flags XATTR_POSITION)
+{	int		sysErr;
+
+
+
+	// Set the attribute
+#if FUSE_APPLE
+	sysErr =  setxattr(logfuse_full_path(path).c_str(), name, value, size, position, XATTR_NOFOLLOW);
+#else
+	sysErr = lsetxattr(logfuse_full_path(path).c_str(), name, value, size, flags);
+#endif
+
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_setxattr(%s, %s, %s) err=%d", path, name, value, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_getxattr : Get an extended attribute.
+//----------------------------------------------------------------------------
+static int logfuse_getxattr(const char *path, const char *name, char *value, size_t size XATTR_POSITION)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	char					theBuffer[kXattrCacheMaxValue];
+	logfuse_xattr_value		theValue;
+	uint64_t				theGeneration;
+	bool					canCache;
+	bool					wasFetched;
+	int						sysErr;
+
+
+
+	// Check the cache
+	canCache = (theSettings->xattrCacheTTL != 0 && XATTR_CACHEABLE);
+
+	if (canCache && logfuse_xattr_find(path, name, theValue, &theGeneration))
+		{
+		sysErr = (int) logfuse_xattr_copy(theValue, value, size);
+		logfuse_log("logfuse_getxattr(%s, %s) value='%s' err=%d cached", path, name, value, sysErr);
+
+		RETURN_FUSE_ERRNO();
+		}
+
+
+
+	// Get the attribute
+	//
+	// Values are fetched into a local buffer so they can be cached whatever
+	// size the caller asked for, while larger values are passed through. A
+	// fetched value that does not fit the caller's buffer is still answered
+	// from the local copy.
+	wasFetched = false;
+
+	if (canCache)
+		{
+#if FUSE_APPLE
+		sysErr = getxattr(logfuse_full_path(path).c_str(), name, theBuffer, sizeof(theBuffer), 0, XATTR_NOFOLLOW);
+#else
+		sysErr = lgetxattr(logfuse_full_path(path).c_str(), name, theBuffer, sizeof(theBuffer));
+#endif
+
+		if (sysErr != -1 || errno == XATTR_MISSING)
+			{
+			theValue.name   = name;
+			theValue.sysErr = (sysErr == -1) ? errno : 0;
+			theValue.data.assign(theBuffer, (sysErr == -1) ? 0 : (size_t) sysErr);
+
+			logfuse_xattr_insert(theSettings, path, theValue, theGeneration);
+			sysErr     = (int) logfuse_xattr_copy(theValue, value, size);
+			wasFetched = true;
+			}
+		else
+			wasFetched = (errno != ERANGE);
+		}
+
+	if (!wasFetched)
+		{
+#if FUSE_APPLE
+		sysErr = getxattr(logfuse_full_path(path).c_str(), name, value, size, position, XATTR_NOFOLLOW);
+#else
+		sysErr = lgetxattr(logfuse_full_path(path).c_str(), name, value, size);
+#endif
+		}
+
+	logfuse_log("logfuse_getxattr(%s, %s) value='%s' err=%d", path, name, value, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_listxattr : List extended attributes.
+//----------------------------------------------------------------------------
+static int logfuse_listxattr(const char *path, char *list, size_t size)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	char					theBuffer[kXattrCacheMaxValue];
+	logfuse_xattr_value		theValue;
+	uint64_t				theGeneration;
+	bool					wasFetched;
+	ssize_t					sysErr;
+
+
+
+	// Check the cache
+	if (theSettings->xattrCacheTTL != 0 && logfuse_xattr_find(path, "", theValue, &theGeneration))
+		{
+		sysErr = logfuse_xattr_copy(theValue, list, size);
+		logfuse_log("logfuse_listxattr(%s, %s) err=%ld cached", path, list, sysErr);
+
+		RETURN_FUSE_ERRNO();
+		}
+
+
+
+	// List the attributes
+	wasFetched = false;
+
+	if (theSettings->xattrCacheTTL != 0)
+		{
+#if FUSE_APPLE
+		sysErr =  listxattr(logfuse_full_path(path).c_str(), theBuffer, sizeof(theBuffer), XATTR_NOFOLLOW);
+#else
+		sysErr = llistxattr(logfuse_full_path(path).c_str(), theBuffer, sizeof(theBuffer));
+#endif
+		if (sysErr != -1)
+			{
+			theValue.name   = "";
+			theValue.sysErr = 0;
+			theValue.data.assign(theBuffer, (size_t) sysErr);
+
+			logfuse_xattr_insert(theSettings, path, theValue, theGeneration);
+			sysErr     = logfuse_xattr_copy(theValue, list, size);
+			wasFetched = true;
+			}
+		else
+			wasFetched = (errno != ERANGE);
+		}
+
+	if (!wasFetched)
+		{
+#if FUSE_APPLE
+		sysErr =  listxattr(logfuse_full_path(path).c_str(), list, size, XATTR_NOFOLLOW);
+#else
+		sysErr = llistxattr(logfuse_full_path(path).c_str(), list, size);
+#endif
+		}
+
+	logfuse_log("logfuse_listxattr(%s, %s) err=%ld", path, list, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_removexattr : Remove an extended attribute.
+//----------------------------------------------------------------------------
+static int logfuse_removexattr(const char *path, const char *name)
+{	int		sysErr;
+
+
+
+	// Remove the attribute
+#if FUSE_APPLE
+	sysErr =  removexattr(logfuse_full_path(path).c_str(), name, XATTR_NOFOLLOW);
+#else
+	sysErr = lremovexattr(logfuse_full_path(path).c_str(), name);
+#endif
+
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_removexattr(%s, %s) err=%d", path, name, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_opendir : Open a directory.
+//----------------------------------------------------------------------------
+static int logfuse_opendir(const char *path, fuse_file_info *fileInfo)
+{	logfuse_dir_info	*dirInfo;
+	struct stat			statInfo;
+	int					sysErr;
+	int					fd;
+
+
+
+	// Open the directory
+	fd      = openat(logfuse_root_fd(), logfuse_path(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dirInfo = (fd != -1) ? logfuse_dir_open(fd) : nullptr;
+	sysErr  = (dirInfo != nullptr) ? 0 : errno;
+
+	logfuse_log("logfuse_opendir(%s) err=%d", path, sysErr);
+
+	if (sysErr != 0)
+		return(-sysErr);
+
+	fileInfo->fh = (uintptr_t) dirInfo;
+
+
+
+	// Prepare the directory cache
+	//
+	// If the directory has no valid snapshot then we start a new one, which
+	// is cached if the directory is read to the end without changing.
+	if (gConfig.dirCacheSize != 0 && fstat(logfuse_dir_fd(dirInfo), &statInfo) == 0)
+		{
+		dirInfo->snapshot = logfuse_dir_cache_find(path, statInfo);
+
+		if (dirInfo->snapshot != nullptr)
+			logfuse_stat_add(kStatDirCacheHit);
+		else
+			{
+			logfuse_stat_add(kStatDirCacheMiss);
+
+			dirInfo->pending = std::make_shared<logfuse_dir_snapshot>();
+
+			dirInfo->pending->dirID.dev  = statInfo.st_dev;
+			dirInfo->pending->dirID.ino  = statInfo.st_ino;
+			dirInfo->pending->modTime    = STAT_MTIME(statInfo);
+			dirInfo->pending->changeTime = STAT_CTIME(statInfo);
+			dirInfo->pending->theSize    = sizeof(logfuse_dir_snapshot);
+			}
+		}
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_readdir : Read a directory.
+//----------------------------------------------------------------------------
+static int logfuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, fuse_file_info *fileInfo READDIR_FLAGS)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	logfuse_dir_info		*dirInfo     = logfuse_get_dir(fileInfo);
+	std::string				childPath;
+	off_t					nextOffset;
+	struct stat				statInfo;
+	int						sysErr;
+
+
+
+	// Read the snapshot
+	if (dirInfo->snapshot != nullptr)
+		return(logfuse_readdir_snapshot(theSettings, path, *dirInfo->snapshot, buffer, filler, offset, gConfig.readdirStat || READDIR_PLUS));
+
+
+
+	// Seek to the entry
+	//
+	// A snapshot can only be built from a sequential read.
+	if (offset != dirInfo->offset)
+		{
+		dirInfo->entry = nullptr;
+		dirInfo->pending.reset();
+
+		if (!logfuse_dir_seek(dirInfo, offset))
+			{
+			sysErr = errno;
+			logfuse_log("logfuse_readdir(%s) err=%d", path, sysErr);
+			return(-sysErr);
+			}
+
+		dirInfo->offset = offset;
+		}
+
+
+
+	// Read the info
+	//
+	// A snapshot is only cached once the directory has been read to the end,
+	// and an error abandons it.
+	while (true)
+		{
+		// Read the entry
+		if (dirInfo->entry == nullptr)
+			{
+			dirInfo->entry = logfuse_dir_read(dirInfo);
+			if (dirInfo->entry == nullptr)
+				{
+				sysErr = errno;
+				if (sysErr != 0)
+					{
+					dirInfo->pending.reset();
+					logfuse_log("logfuse_readdir(%s) err=%d", path, sysErr);
+					return(-sysErr);
+					}
+
+				if (dirInfo->pending != nullptr)
+					logfuse_readdir_cache(path, dirInfo);
+				break;
+				}
+			}
+
+
+
+		// Get the info
+        memset(&statInfo, 0, sizeof(statInfo));
+        statInfo.st_ino  = dirInfo->entry->d_ino;
+        statInfo.st_mode = dirInfo->entry->d_type << 12;
+
+		if (gConfig.readdirStat || READDIR_PLUS)
+			logfuse_readdir_stat(theSettings, path, dirInfo, childPath, statInfo);
+
+        nextOffset = logfuse_dir_tell(dirInfo);
+
+        if (logfuse_readdir_fill(buffer, filler, dirInfo->entry->d_name, statInfo, nextOffset))
+			{
+			logfuse_log("logfuse_readdir(%s, %s) err=0", path, dirInfo->entry->d_name);
+			break;
+			}
+
+
+
+		// Update our state
+		if (dirInfo->pending != nullptr)
+			{
+			dirInfo->pending->theEntries.push_back({ dirInfo->entry->d_name, statInfo.st_ino, (mode_t) (statInfo.st_mode & S_IFMT) });
+			dirInfo->pending->theSize += sizeof(logfuse_dir_entry) + strlen(dirInfo->entry->d_name);
+
+			if (dirInfo->pending->theSize > gConfig.dirCacheSize)
+				dirInfo->pending.reset();
+			}
+
+		dirInfo->entry  = nullptr;
+        dirInfo->offset = nextOffset;
+		}
+	
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_releasedir : Release a directory.
+//----------------------------------------------------------------------------
+static int logfuse_releasedir(const char *path, fuse_file_info *fileInfo)
+{	logfuse_dir_info	*dirInfo = logfuse_get_dir(fileInfo);
+
+
+
+	// Release the directory
+	logfuse_log("logfuse_releasedir(%s) err=0", path);
+
+	logfuse_dir_close(dirInfo);
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fsyncdir : Synchronise a directory.
+//----------------------------------------------------------------------------
+static int logfuse_fsyncdir(const char *path, int dataSync, fuse_file_info */*fileInfo*/)
+{
+
+
+	// Synchronise the directory
+	logfuse_log("logfuse_fsyncdir(%s, %d) err=0", path, dataSync);
+	
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_init : Initialise the filesystem.
+//----------------------------------------------------------------------------
+static void *logfuse_init(fuse_conn_info *fsConnection)
+{	logfuse_mount	*theMount = logfuse_current_mount();
+
+
+
+	// Initialise the filesystem
+	logfuse_log("logfuse_init: protocol=%d.%d, max_write=%d, max_read=%d, caps=0x%0x",
+						fsConnection->proto_major,
+						fsConnection->proto_minor,
+						fsConnection->max_write,
+						fsConnection->max_readahead,
+						fsConnection->capable);
+
+	fsConnection->want |= FUSE_CAP_ASYNC_READ;
+	fsConnection->want |= FUSE_CAP_POSIX_LOCKS;
+	fsConnection->want |= FUSE_CAP_ATOMIC_O_TRUNC;
+	fsConnection->want |= FUSE_CAP_FLOCK_LOCKS;
+
+#if FUSE_USE_VERSION < 30
+	fsConnection->want |= FUSE_CAP_BIG_WRITES;
+#endif
+
+#if FUSE_APPLE
+	fsConnection->want |= FUSE_CAP_ALLOCATE;
+	fsConnection->want |= FUSE_CAP_EXCHANGE_DATA;
+	fsConnection->want |= FUSE_CAP_CASE_INSENSITIVE;
+	fsConnection->want |= FUSE_CAP_VOL_RENAME;
+	fsConnection->want |= FUSE_CAP_XTIMES;
+#endif
+
+	if (theMount != logfuse_mounts_primary())
+		return(theMount);
+
+	std::thread(logfuse_signal_thread).detach();
+
+	gMountTime = logfuse_time_now();
+
+	if (!gConfig.tierPath.empty())
+		gTier.theThread = std::thread(logfuse_tier_thread);
+
+	logfuse_mounts_start();
+
+	return(theMount);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_destroy : Destroy the filesystem.
+//----------------------------------------------------------------------------
+static void logfuse_destroy(void *userData)
+{	logfuse_mount							*theMount = (logfuse_mount *) userData;
+	uint64_t								startTime = logfuse_time_now();
+	std::chrono::steady_clock::time_point	theDeadline;
+	uint64_t								drainTime;
+	bool									didDrain;
+
+
+
+	// Destroy the mount
+	//
+	// Extra mounts are destroyed by the first mount, which then destroys the
+	// filesystem that they share.
+	//
+	// The deadline starts as the filesystem is destroyed.
+	theDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kLogDrainTimeout);
+	logfuse_log("logfuse_destroy");
+
+	if (theMount != logfuse_mounts_primary())
+		return;
+
+
+
+	// Drain the log
+	//
+	// Buffered messages are written out within the deadline, so that the tail
+	// of the log survives an unmount or a SIGTERM, which ends the FUSE loop.
+	// The log is drained before the other mounts and the tier are stopped,
+	// as their threads may take any time to finish, and later messages are
+	// written directly.
+	didDrain  = logfuse_log_drain(theDeadline);
+	drainTime = logfuse_time_now() - startTime;
+
+	logfuse_mounts_stop();
+	logfuse_tier_stop();
+
+
+
+	// Log the summary
+	//
+	// The summary holds the statistics since the filesystem was mounted, and
+	// follows everything else in the log as the other threads have stopped.
+	logfuse_log("logfuse_summary: uptime=%.3fs drain=%.3fms%s%s",
+					((double) (startTime - gMountTime)) / 1000000000.0,
+					((double) drainTime) / 1000000.0,
+					didDrain ? "" : " timed_out",
+					logfuse_stats_text().c_str());
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_access : Check file access permissions.
+//----------------------------------------------------------------------------
+static int logfuse_access(const char *path, int mode)
+{	const logfuse_settings	*theSettings = logfuse_get_settings();
+	logfuse_access_result	theCaller = logfuse_access_caller(theSettings, mode);
+	uint64_t				negGeneration = 0;
+	uint64_t				theGeneration = 0;
+	int						sysErr;
+
+
+
+	// Check the cache
+	if (logfuse_negative_find(theSettings, path, &negGeneration))
+		{
+		logfuse_log("logfuse_access(%s, %s) err=-1 cached",
+						path,
+						logfuse_str_access_mode(mode).c_str());
+
+		return(-ENOENT);
+		}
+
+	if (logfuse_access_find(theSettings, path, theCaller, &theGeneration))
+		{
+		logfuse_log("logfuse_access(%s, %s) err=%d cached",
+						path,
+						logfuse_str_access_mode(mode).c_str(),
+						theCaller.sysErr == 0 ? 0 : -1);
+
+		return(-theCaller.sysErr);
+		}
+
+
+
+	// Check the permissions
+	sysErr           = faccessat(logfuse_root_fd(), logfuse_path(path), mode, 0);
+	theCaller.sysErr = (sysErr == 0) ? 0 : errno;
+
+	logfuse_negative_insert(theSettings, path, sysErr, negGeneration);
+	logfuse_access_insert(theSettings, path, theCaller, theGeneration);
+
+	logfuse_log("logfuse_access(%s, %s) err=%d",
+					path,
+					logfuse_str_access_mode(mode).c_str(),
+					sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_create : Create and open a file.
+//----------------------------------------------------------------------------
+static int logfuse_create(const char *path, mode_t mode, fuse_file_info *fileInfo)
+{	logfuse_cache_policy	thePolicy;
+	logfuse_file_info		*theFile;
+	int						fd;
+
+
+
+	// Open the file
+	fd = openat(logfuse_root_fd(), logfuse_path(path), logfuse_open_flags(fileInfo->flags), mode);
+	if (fd == -1)
+		{
+		logfuse_log("logfuse_create(%s, 0x%0X, %d) fd=%d", path, mode, fileInfo->flags, fd);
+		return(-errno);
+		}
+
+	logfuse_invalidate_name(path);
+	logfuse_invalidate_created(path, false);
+
+
+
+	// Prepare the file
+	theFile = logfuse_new_file(fd, logfuse_open_flags(fileInfo->flags));
+	if (theFile == nullptr)
+		{
+		close(fd);
+		return(-ENOMEM);
+		}
+
+	thePolicy    = logfuse_apply_cache_policy(path, fileInfo);
+	fileInfo->fh = (uintptr_t) theFile;
+
+	logfuse_log("logfuse_create(%s, 0x%0X, %d) fd=%d cache=%s",
+					path,
+					mode,
+					fileInfo->flags,
+					fd,
+					logfuse_str_cache_policy(thePolicy));
+
+	return(0);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_ftruncate : Change the size of an open file.
+//----------------------------------------------------------------------------
+static int logfuse_ftruncate(const char *path, off_t length, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
+	int						sysErr;
+
+
+
+	// Change the size
+	sysErr = ftruncate(theFile->fd, length);
+
+	logfuse_invalidate_attr(path);
+	logfuse_content_invalidate(theFile->fileID);
+
+	logfuse_log("logfuse_ftruncate(%s, %lld) err=%d", path, (long long) length, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fgetattr : Get attributes from an open file.
+//----------------------------------------------------------------------------
+static int logfuse_fgetattr(const char *path, struct stat *statInfo, fuse_file_info *fileInfo)
+{	int		sysErr;
+
+
+
+	// Get the attributes
+	//
+	// Setting st_blksize to 0 ensures FUSE uses the global iosize option.
+	sysErr               = fstat(logfuse_get_fd(fileInfo), statInfo);
+	statInfo->st_blksize = 0;
+
+	logfuse_log("logfuse_fgetattr(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_lock : Perform POSIX file locking.
+//----------------------------------------------------------------------------
+static int logfuse_lock(const char *path, struct fuse_file_info *fileInfo, int cmd, struct flock *lockInfo)
+{	int		sysErr;
+
+
+
+	// Perform the lock
+	logfuse_get_file(fileInfo)->wasLocked = true;
+
+	sysErr = fcntl(logfuse_get_fd(fileInfo), cmd, lockInfo);
+	logfuse_log("logfuse_lock(%s, %s) err=%d",
+					path,
+					logfuse_str_fcntl_cmd(cmd),
+					sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_utimens : Change the access+modification times of a file.
+//----------------------------------------------------------------------------
+static int logfuse_utimens(const char *path, const timespec timeSpec[2])
+{	int		sysErr;
+
+
+
+#if FUSE_APPLE
+	attrlist				attributeInfo;
+
+	struct __attribute__((packed)) {
+		timespec		modTime;
+		timespec		accessTime;
+	} attributeData;
+
+
+
+	// Get the state we need
+	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+
+	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributeInfo.commonattr  = ATTR_CMN_ACCTIME | ATTR_CMN_MODTIME;
+	
+	attributeData.modTime    = timeSpec[1];
+	attributeData.accessTime = timeSpec[0];
+
+
+
+	// Set the timestamps
+	sysErr = setattrlist(logfuse_full_path(path).c_str(), &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
+#else
+	sysErr = utimensat(logfuse_root_fd(), logfuse_path(path), timeSpec, AT_SYMLINK_NOFOLLOW);
+#endif
+
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_utimens(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_ioctl : Invoke a device control command.
+//----------------------------------------------------------------------------
+static int logfuse_ioctl(const char *path, IOCTL_CMD cmd, void *arg, fuse_file_info *fileInfo, unsigned int flags, void *data)
+{
+
+
+	// Invoke the command
+	logfuse_log("logfuse_ioctl(%s)", path);
+
+	return(-ENOMEM);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_poll : Poll for IO readiness events.
+//----------------------------------------------------------------------------
+static int logfuse_poll(const char *path, fuse_file_info *fileInfo, fuse_pollhandle *pollHnd, unsigned *reventsp)
+{
+
+
+	// Poll for IO
+	logfuse_log("logfuse_poll(%s)", path);
+
+	return(-ENOMEM);
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_flock : Perform BSD file locking.
+//----------------------------------------------------------------------------
+static int logfuse_flock(const char *path, fuse_file_info *fileInfo, int lockOp)
+{	int		sysErr;
+
+
+	// Perform the lock
+	logfuse_get_file(fileInfo)->wasLocked = true;
+
+	sysErr = flock(logfuse_get_fd(fileInfo), lockOp);
+	logfuse_log("logfuse_flock(%s, %d)", path, lockOp);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse_fallocate : Allocate space for a file.
+//----------------------------------------------------------------------------
+static int logfuse_fallocate(const char *path, int mode, off_t offset, off_t length, fuse_file_info *fileInfo)
+{	int				sysErr;
+
+
+
+#if FUSE_APPLE
+	fstore_t		theInfo;
+
+
+
+	// Check our parameters
+    if ((mode & PREALLOCATE) == 0)
+		return(-ENOTSUP);
+
+
+
+	// Get the state we need
+	memset(&theInfo, 0x00, sizeof(theInfo));
+
+	theInfo.fst_offset = offset;
+	theInfo.fst_length = length;
+
+	if ((mode & ALLOCATECONTIG) != 0)
+		theInfo.fst_flags |= F_ALLOCATECONTIG;
+
+	if ((mode & ALLOCATEALL) != 0)
+		theInfo.fst_flags |= F_ALLOCATEALL;
+
+	if ((mode & ALLOCATEFROMPEOF) != 0)
+		theInfo.fst_posmode = F_PEOFPOSMODE;
+
+	if ((mode & ALLOCATEFROMVOL) != 0)
+		theInfo.fst_posmode = F_VOLPOSMODE;
+
+
+
+	// Allocate the space
+	sysErr = fcntl(logfuse_get_fd(fileInfo), F_PREALLOCATE, &theInfo);
+#else
+	// Allocate the space
+	//
+	// The FALLOC_FL_xxx modes have the same meaning for FUSE as for fallocate(2),
+	// so they are passed straight through to the backing file.
+	sysErr = fallocate(logfuse_get_fd(fileInfo), mode, offset, length);
+#endif
+
+	logfuse_invalidate_attr(path);
+	logfuse_content_invalidate(logfuse_get_file(fileInfo)->fileID);
+
+	logfuse_log("logfuse_fallocate(%s, %s, %lld, %lld) err=%d",
+					path,
+					logfuse_str_fallocate_mode(mode).c_str(),
+					(long long) offset,
+					(long long) length,
+					sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+//============================================================================
+//		logfuse_copy_file_range : Copy a range of data between files.
+//----------------------------------------------------------------------------
+static ssize_t logfuse_copy_file_range(const char *pathIn,  fuse_file_info *fileInfoIn,  off_t offsetIn,
+									   const char *pathOut, fuse_file_info *fileInfoOut, off_t offsetOut,
+									   size_t size, int flags)
+{	ssize_t		sysErr;
+	size_t		theSize;
+
+
+
+	// Copy the data
+	//
+	// Copying between the backing files lets the backing filesystem reflink
+	// or copy in-kernel, rather than passing every byte through read/write.
+	//
+	// copy_file_range may copy less than requested, so we loop until the range
+	// is complete to log each request as a single operation.
+	theSize = 0;
+	sysErr  = 0;
+
+	while (theSize < size)
+		{
+		sysErr = copy_file_range(logfuse_get_fd(fileInfoIn),  &offsetIn,
+								 logfuse_get_fd(fileInfoOut), &offsetOut,
+								 size - theSize, (unsigned int) flags);
+		if (sysErr <= 0)
+			break;
+
+		theSize += (size_t) sysErr;
+		}
+
+	if (theSize != 0)
+		sysErr = (ssize_t) theSize;
+
+	logfuse_invalidate_attr(pathOut);
+	logfuse_content_invalidate(logfuse_get_file(fileInfoOut)->fileID);
+
+	logfuse_log("logfuse_copy_file_range(%s, %s, size=%zu, flags=%d) %s=%zd",
+					pathIn,
+					pathOut,
+					size,
+					flags,
+					sysErr >= 0 ? "copied" : "err",
+					sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+//============================================================================
+//		logfuse_lseek : Find the next data or hole in a file.
+//----------------------------------------------------------------------------
+static off_t logfuse_lseek(const char *path, off_t offset, int whence, fuse_file_info *fileInfo)
+{	off_t		sysErr;
+
+
+
+	// Seek the file
+	//
+	// The kernel only forwards SEEK_DATA/SEEK_HOLE, which lets sparse-aware
+	// tools skip the holes in the backing file rather than reading zeros.
+	sysErr = lseek(logfuse_get_fd(fileInfo), offset, whence);
+	logfuse_log("logfuse_lseek(%s, %lld, %s) %s=%lld",
+					path,
+					(long long) offset,
+					logfuse_str_seek_whence(whence),
+					sysErr >= 0 ? "offset" : "err",
+					(long long) sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_setvolname : Set the volume name.
+//----------------------------------------------------------------------------
+static int logfuse_setvolname(const char *name)
+{	attrlist		attributeInfo;
+	int				sysErr;
+
+	struct __attribute__((packed)) {
+		attrreference	info;
+		char			name[NAME_MAX + 1];
+	} attributeData;
+
+
+
+	// Get the state we need
+	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+	memset(&attributeData, 0x00, sizeof(attributeData));
+
+	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
+	attributeInfo.volattr  = ATTR_VOL_INFO | ATTR_VOL_NAME;
+	
+	attributeData.info.attr_dataoffset = sizeof(attrreference);
+	attributeData.info.attr_length     = strlen(name)+1;
+	
+	strncpy(attributeData.name, name, NAME_MAX);
+
+
+
+	// Set the name
+	//
+	// setattrlist requires the path to the volume mount point to set the name.
+	if (false)
+		sysErr = setattrlist(nullptr, &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
+
+	logfuse_log("logfuse_setvolname(%s)", name);
+
+	return(-EACCES);
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_exchange : Exchange two files.
+//----------------------------------------------------------------------------
+static int logfuse_exchange(const char *path1, const char *path2, unsigned long options)
+{	int	sysErr;
+
+
+
+	// Exchange the files
+	sysErr = exchangedata(logfuse_full_path(path1).c_str(), logfuse_full_path(path2).c_str(), options);
+
+	logfuse_invalidate_attr(path1);
+	logfuse_invalidate_attr(path2);
+
+	if (sysErr == 0)
+		{
+		logfuse_content_invalidate_path(path1);
+		logfuse_content_invalidate_path(path2);
+		}
+
+	logfuse_log("logfuse_exchange(%s, %s, %ld) err=%d", path1, path2, options, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_getxtimes : Get extended time info.
+//----------------------------------------------------------------------------
+static int logfuse_getxtimes(const char *path, timespec *backupTime, timespec *createTime)
+{	attrlist				attributeInfo;
+	int						sysErr;
+
+	struct __attribute__((packed)) {
+		uint32_t		size;
+		timespec		createTime;
+		timespec		backupTime;
+	} attributeData;
+
+
+
+	// Get the state we need
+	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+
+	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributeInfo.commonattr  = ATTR_CMN_CRTIME | ATTR_CMN_BKUPTIME;
+
+
+
+	// Get the attributes
+	sysErr = getattrlist(logfuse_full_path(path).c_str(), &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
+	if (sysErr == 0)
+		{
+		*backupTime = attributeData.backupTime;
+		*createTime = attributeData.createTime;
+		}
+	else
+		{
+		memset(backupTime, 0x00, sizeof(timespec));
+		memset(createTime, 0x00, sizeof(timespec));
+		}
+
+	logfuse_log("logfuse_getxtimes(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_setbkuptime : Set the backup time.
+//----------------------------------------------------------------------------
+static int logfuse_setbkuptime(const char *path, const timespec *theTime)
+{	int		sysErr;
+
+
+
+	// Set the time
+	sysErr = logfuse_set_timespec(path, ATTR_CMN_BKUPTIME, *theTime);
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_setbkuptime(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_setchgtime : Set the attribute change time.
+//----------------------------------------------------------------------------
+static int logfuse_setchgtime(const char *path, const timespec *theTime)
+{	int		sysErr;
+
+
+
+	// Set the time
+	sysErr = logfuse_set_timespec(path, ATTR_CMN_CHGTIME, *theTime);
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_setchgtime(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_setcrtime : Set the creation time.
+//----------------------------------------------------------------------------
+static int logfuse_setcrtime(const char *path, const timespec *theTime)
+{	int		sysErr;
+
+
+
+	// Set the time
+	sysErr = logfuse_set_timespec(path, ATTR_CMN_CRTIME, *theTime);
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_setcrtime(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_chflags : Set the file flags.
+//----------------------------------------------------------------------------
+static int logfuse_chflags(const char *path, uint32_t theFlags)
+{	int		sysErr;
+
+
+
+	// Set the flags
+	sysErr = lchflags(logfuse_full_path(path).c_str(), theFlags);
+	logfuse_invalidate_attr(path);
+
+	logfuse_log("logfuse_setcrtime(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_setattr_x : Set extended attributes.
+//----------------------------------------------------------------------------
+static int logfuse_setattr_x(const char *path, struct setattr_x *theAttributes)
+{	int		sysErr;
+
+
+
+	// Set the attributes
+	if (SETATTR_WANTS_MODE(theAttributes))
+		{
+		sysErr = fchmodat(logfuse_root_fd(), logfuse_path(path), theAttributes->mode, AT_SYMLINK_NOFOLLOW);
+		if (sysErr == -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_UID(theAttributes) || SETATTR_WANTS_GID(theAttributes))
+		{
+		sysErr = fchownat(logfuse_root_fd(), logfuse_path(path),
+						SETATTR_WANTS_UID(theAttributes) ? theAttributes->uid : -1,
+						SETATTR_WANTS_GID(theAttributes) ? theAttributes->gid : -1,
+						AT_SYMLINK_NOFOLLOW);
+		if (sysErr == -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_SIZE(theAttributes))
+		{
+		sysErr = truncate(logfuse_full_path(path).c_str(), theAttributes->size);
+		if (sysErr == 0)
+			logfuse_content_invalidate_path(path);
+
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_ACCTIME(theAttributes))
+		{
+		sysErr = logfuse_set_timespec(path, ATTR_CMN_ACCTIME, theAttributes->acctime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_MODTIME(theAttributes))
+		{
+		sysErr = logfuse_set_timespec(path, ATTR_CMN_MODTIME, theAttributes->modtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_CRTIME(theAttributes))
+		{
+		sysErr = logfuse_set_timespec(path, ATTR_CMN_CRTIME, theAttributes->crtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_CHGTIME(theAttributes))
+		{
+		sysErr = logfuse_set_timespec(path, ATTR_CMN_CHGTIME, theAttributes->chgtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_BKUPTIME(theAttributes))
+		{
+		sysErr = logfuse_set_timespec(path, ATTR_CMN_BKUPTIME, theAttributes->bkuptime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_FLAGS(theAttributes))
+		{
+		sysErr = lchflags(logfuse_full_path(path).c_str(), theAttributes->flags);
+		if (sysErr != -1)
+			goto done;
+		}
+
+done:
+	logfuse_invalidate_attr(path);
+	logfuse_invalidate_access(path);
+	logfuse_log("logfuse_setattr_x(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_APPLE
+//============================================================================
+//		logfuse_fsetattr_x : Set extended attributes.
+//----------------------------------------------------------------------------
+static int logfuse_fsetattr_x(const char *path, setattr_x *theAttributes, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
+	int						sysErr;
+
+
+
+	// Set the attributes
+	if (SETATTR_WANTS_MODE(theAttributes))
+		{
+		sysErr = fchmod(theFile->fd, theAttributes->mode);
+		if (sysErr == -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_UID(theAttributes) || SETATTR_WANTS_GID(theAttributes))
+		{
+		sysErr = fchown(theFile->fd,
+						SETATTR_WANTS_UID(theAttributes) ? theAttributes->uid : -1,
+						SETATTR_WANTS_GID(theAttributes) ? theAttributes->gid : -1);
+		if (sysErr == -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_SIZE(theAttributes))
+		{
+		sysErr = ftruncate(theFile->fd, theAttributes->size);
+		logfuse_content_invalidate(theFile->fileID);
+
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_ACCTIME(theAttributes))
+		{
+		sysErr = logfuse_fset_timespec(theFile->fd, ATTR_CMN_ACCTIME, theAttributes->acctime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_MODTIME(theAttributes))
+		{
+		sysErr = logfuse_fset_timespec(theFile->fd, ATTR_CMN_MODTIME, theAttributes->modtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_CRTIME(theAttributes))
+		{
+		sysErr = logfuse_fset_timespec(theFile->fd, ATTR_CMN_CRTIME, theAttributes->crtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_CHGTIME(theAttributes))
+		{
+		sysErr = logfuse_fset_timespec(theFile->fd, ATTR_CMN_CHGTIME, theAttributes->chgtime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_BKUPTIME(theAttributes))
+		{
+		sysErr = logfuse_fset_timespec(theFile->fd, ATTR_CMN_BKUPTIME, theAttributes->bkuptime);
+		if (sysErr != -1)
+			goto done;
+		}
+
+	if (SETATTR_WANTS_FLAGS(theAttributes))
+		{
+		sysErr = fchflags(theFile->fd, theAttributes->flags);
+		if (sysErr != -1)
+			goto done;
+		}
+
+done:
+	logfuse_invalidate_attr(path);
+	logfuse_invalidate_access(path);
+	logfuse_log("logfuse_setattr_x(%s) err=%d", path, sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+#endif // FUSE_APPLE
+
+
+
+
+
+#if FUSE_USE_VERSION >= 30
+#pragma mark FUSE 3
+//============================================================================
+//		FUSE 3 methods.
+//----------------------------------------------------------------------------
+//		logfuse3_getattr : Get file attributes.
+//----------------------------------------------------------------------------
+static int logfuse3_getattr(const char *path, struct stat *statInfo, fuse_file_info *fileInfo)
+{
+
+
+	// Get the attributes
+	//
+	// FUSE 3 folds fgetattr into getattr, passing the file info if known.
+	if (fileInfo != nullptr)
+		return(logfuse_fgetattr(path, statInfo, fileInfo));
+
+	return(logfuse_getattr(path, statInfo));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse3_rename : Rename a file.
+//----------------------------------------------------------------------------
+static int logfuse3_rename(const char *from, const char *to, unsigned int flags)
+{	int		sysErr;
+
+
+
+	// Rename the file
+	if (flags == 0)
+		return(logfuse_rename(from, to));
+
+#if defined(__linux__) && defined(SYS_renameat2)
+	sysErr = (int) syscall(SYS_renameat2, logfuse_root_fd(), logfuse_path(from), logfuse_root_fd(), logfuse_path(to), flags);
+#else
+	sysErr = -1;
+	errno  = EINVAL;
+#endif
+
+
+
+	// Update the caches
+	//
+	// A rename that cannot replace its target is an ordinary rename, while
+	// an exchange leaves both names in place with new contents.
+	if (sysErr == 0 && (flags & RENAME_EXCHANGE) == 0)
+		logfuse_invalidate_rename(from, to);
+	else
+		{
+		logfuse_invalidate_name(from);
+		logfuse_invalidate_name(to);
+		}
+
+	logfuse_log("logfuse_rename(%s, %s, %s) err=%d",
+					from,
+					to,
+					(flags & RENAME_EXCHANGE) != 0 ? "RENAME_EXCHANGE" : "RENAME_NOREPLACE",
+					sysErr);
+
+	RETURN_FUSE_ERRNO();
+}
+
+
+
+
+
+//============================================================================
+//		logfuse3_chmod : Change the permission bits of a file.
+//----------------------------------------------------------------------------
+static int logfuse3_chmod(const char *path, mode_t mode, fuse_file_info */*fileInfo*/)
+{
+
+
+	// Change the mode
+	return(logfuse_chmod(path, mode));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse3_chown : Change the owner and group of a file.
+//----------------------------------------------------------------------------
+static int logfuse3_chown(const char *path, uid_t owner, gid_t group, fuse_file_info */*fileInfo*/)
+{
+
+
+	// Change the owner
+	return(logfuse_chown(path, owner, group));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse3_truncate : Change the size of a file.
+//----------------------------------------------------------------------------
+static int logfuse3_truncate(const char *path, off_t length, fuse_file_info *fileInfo)
+{
+
+
+	// Truncate the file
+	//
+	// FUSE 3 folds ftruncate into truncate, passing the file info if known.
+	if (fileInfo != nullptr)
+		return(logfuse_ftruncate(path, length, fileInfo));
+
+	return(logfuse_truncate(path, length));
+}
+
+
+
+
+
+//============================================================================
+//		logfuse3_utimens : Change the access and modification times of a file.
 //----------------------------------------------------------------------------
-static logfuse_dir_info *logfuse_get_dir(fuse_file_info *fileInfo)
+static int logfuse3_utimens(const char *path, const timespec timeSpec[2], fuse_file_info */*fileInfo*/)
 {
 
 
-	// Validate our state
-	static_assert(sizeof(logfuse_dir_info *) <= sizeof(fileInfo->fh), "Unable to store pointer");
-
-
-
-	// Get the directory
-	return((logfuse_dir_info *) ((uintptr_t) fileInfo->fh));
+	// Change the times
+	return(logfuse_utimens(path, timeSpec));
 }
 
 
@@ -196,26 +8625,43 @@ static logfuse_dir_info *logfuse_get_dir(fuse_file_info *fileInfo)
 
 
 //============================================================================
-//		logfuse_fset_timespec : Set a file time.
+//		logfuse3_init_connection : Tune the connection.
 //----------------------------------------------------------------------------
-static int logfuse_fset_timespec(int fd, attrgroup_t theAttribute, timespec theTime)
-{	attrlist		attributeInfo;
-	int				sysErr;
+static void logfuse3_init_connection(fuse_conn_info *fsConnection)
+{
 
 
+	// Tune the connection
+	//
+	// The kernel negotiates max_pages from max_write, and FUSE 3 refuses to
+	// mount if we want a capability the kernel does not offer.
+	switch (gConfig.readdirPlus) {
+		case kReaddirPlusDefault:
+			break;
+
+		case kReaddirPlusYes:
+			fsConnection->want |=  FUSE_CAP_READDIRPLUS;
+			fsConnection->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+			break;
 
-	// Get the state we need
-	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+		case kReaddirPlusNo:
+			fsConnection->want &= ~(FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO);
+			break;
 
-	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
-	attributeInfo.commonattr  = theAttribute;
+		case kReaddirPlusAuto:
+			fsConnection->want |= FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO;
+			break;
+		}
 
+	if (gConfig.maxPages != 0)
+		fsConnection->max_write = (unsigned int) (gConfig.maxPages * (size_t) sysconf(_SC_PAGESIZE));
 
+	if (gConfig.writebackCache)
+		fsConnection->want |= FUSE_CAP_WRITEBACK_CACHE;
 
-	// Set the time
-	sysErr = fsetattrlist(fd, &attributeInfo, &theTime, sizeof(timespec), FSOPT_NOFOLLOW);
+	fsConnection->want &= fsConnection->capable;
 
-	return(sysErr);
+	logfuse_log("logfuse_init: max_write=%d, want=0x%0x", fsConnection->max_write, fsConnection->want);
 }
 
 
@@ -223,76 +8669,125 @@ static int logfuse_fset_timespec(int fd, attrgroup_t theAttribute, timespec theT
 
 
 //============================================================================
-//		logfuse_set_timespec : Set a file time.
+//		logfuse3_init : Initialise the filesystem.
 //----------------------------------------------------------------------------
-static int logfuse_set_timespec(const char *path, attrgroup_t theAttribute, timespec theTime)
-{	attrlist		attributeInfo;
-	int				sysErr;
+static void *logfuse3_init(fuse_conn_info *fsConnection, fuse_config *fsConfig)
+{	void	*theResult;
 
 
 
-	// Get the state we need
-	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+	// Apply the timeouts
+	if (gConfig.attrTimeout >= 0.0)
+		fsConfig->attr_timeout = gConfig.attrTimeout;
 
-	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
-	attributeInfo.commonattr  = theAttribute;
+	if (gConfig.entryTimeout >= 0.0)
+		fsConfig->entry_timeout = gConfig.entryTimeout;
 
+	if (gConfig.negativeTimeout >= 0.0)
+		fsConfig->negative_timeout = gConfig.negativeTimeout;
 
 
-	// Set the time
-	sysErr = setattrlist(path, &attributeInfo, &theTime, sizeof(timespec), FSOPT_NOFOLLOW);
 
-	return(sysErr);
+	// Apply the connection
+	theResult = logfuse_init(fsConnection);
+
+	logfuse3_init_connection(fsConnection);
+
+	logfuse_log("logfuse_init: attr_timeout=%g, entry_timeout=%g, negative_timeout=%g",
+						fsConfig->attr_timeout,
+						fsConfig->entry_timeout,
+						fsConfig->negative_timeout);
+
+	return(theResult);
 }
 
 
 
 
 
+#if defined(__linux__)
 //============================================================================
-//		logfuse_str_access_mode : Access mode string.
+//		logfuse3_main : Run the filesystem with a fixed pool of workers.
 //----------------------------------------------------------------------------
-static std::string logfuse_str_access_mode(int mode)
-{
+static int logfuse3_main(fuse_args *fuseArgs, const fuse_operations *fuseOps)
+{	fuse_cmdline_opts		fuseOpts;
+	fuse					*theFuse;
+	fuse_session			*fuseSession;
+	int						sysErr;
 
 
-	// Get the text
-	TEXT_BEGIN();
-		TEXT_BIT(mode, F_OK);
-		TEXT_BIT(mode, R_OK);
-		TEXT_BIT(mode, W_OK);
-		TEXT_BIT(mode, X_OK);
-	TEXT_END(mode);
+
+	// Parse the command line
+	if (!logfuse_parse_cmdline(fuseArgs, &fuseOpts, &sysErr))
+		return(sysErr);
+
+
+
+	// Run the filesystem
+	//
+	// This follows fuse_main, other than running our own pool of workers
+	// in place of fuse_loop_mt.
+	sysErr  = 1;
+	theFuse = fuse_new(fuseArgs, fuseOps, sizeof(*fuseOps), logfuse_mounts_primary());
+
+	if (theFuse != nullptr)
+		{
+		fuseSession = fuse_get_session(theFuse);
+
+		if (fuse_mount(theFuse, fuseOpts.mountpoint) == 0)
+			{
+			if (fuse_daemonize(fuseOpts.foreground) == 0 && fuse_set_signal_handlers(fuseSession) == 0)
+				{
+				if (fuse_start_cleanup_thread(theFuse) == 0)
+					{
+					sysErr = logfuse_session_loop(fuseSession, fuseOpts);
+					fuse_stop_cleanup_thread(theFuse);
+					}
+
+				fuse_remove_signal_handlers(fuseSession);
+				}
+
+			fuse_unmount(theFuse);
+			}
+
+		fuse_destroy(theFuse);
+		}
+
+	free(fuseOpts.mountpoint);
+
+	return(sysErr == 0 ? 0 : 1);
 }
+#endif // defined(__linux__)
+#endif // FUSE_USE_VERSION >= 30
 
 
 
 
 
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+#pragma mark FUSE low-level
 //============================================================================
-//		logfuse_str_open_flags : open flags string.
+//		FUSE low-level methods.
 //----------------------------------------------------------------------------
-static std::string logfuse_str_open_flags(int flags)
+//		logfuse_ll_inode : Get an inode.
+//----------------------------------------------------------------------------
+static logfuse_inode *logfuse_ll_inode(fuse_ino_t ino)
 {
 
 
-	// Get the text
-	TEXT_BEGIN();
-		TEXT_BIT(flags, O_RDONLY);
-		TEXT_BIT(flags, O_WRONLY);
-		TEXT_BIT(flags, O_RDWR);
-		TEXT_BIT(flags, O_NONBLOCK);
-		TEXT_BIT(flags, O_APPEND);
-		TEXT_BIT(flags, O_SHLOCK);
-		TEXT_BIT(flags, O_EXLOCK);
-		TEXT_BIT(flags, O_NOFOLLOW);
-		TEXT_BIT(flags, O_CREAT);
-		TEXT_BIT(flags, O_TRUNC);
-		TEXT_BIT(flags, O_EXCL);
-		TEXT_BIT(flags, O_EVTONLY);
-		TEXT_BIT(flags, O_SYMLINK);
-		TEXT_BIT(flags, O_CLOEXEC);
-	TEXT_END(flags);
+	// Validate our state
+	static_assert(sizeof(logfuse_inode *) <= sizeof(fuse_ino_t), "Unable to store pointer");
+
+
+
+	// Get the inode
+	//
+	// The kernel names every inode by the node ID we returned from lookup,
+	// other than the root which always has FUSE_ROOT_ID.
+	if (ino == FUSE_ROOT_ID)
+		return(&gInodes.theRoot);
+
+	return((logfuse_inode *) ((uintptr_t) ino));
 }
 
 
@@ -300,91 +8795,31 @@ static std::string logfuse_str_open_flags(int flags)
 
 
 //============================================================================
-//		logfuse_str_fcntl_cmd : fcntl command string.
+//		logfuse_ll_fd : Get an inode's descriptor.
 //----------------------------------------------------------------------------
-static const char *logfuse_str_fcntl_cmd(int cmd)
+static int logfuse_ll_fd(fuse_ino_t ino)
 {
 
 
-	// Get the text
-	switch (cmd) {
-		case F_DUPFD:						return("F_DUPFD");						break;
-		case F_GETFD:						return("F_GETFD");						break;
-		case F_SETFD:						return("F_SETFD");						break;
-		case F_GETFL:						return("F_GETFL");						break;
-		case F_SETFL:						return("F_SETFL");						break;
-		case F_GETOWN:						return("F_GETOWN");						break;
-		case F_SETOWN:						return("F_SETOWN");						break;
-		case F_GETLK:						return("F_GETLK");						break;
-		case F_SETLK:						return("F_SETLK");						break;
-		case F_SETLKW:						return("F_SETLKW");						break;
-		case F_SETLKWTIMEOUT:				return("F_SETLKWTIMEOUT");				break;
-		case F_FLUSH_DATA:					return("F_FLUSH_DATA");					break;
-		case F_PREALLOCATE:					return("F_PREALLOCATE");				break;
-		case F_SETSIZE:						return("F_SETSIZE");					break;
-		case F_RDADVISE:					return("F_RDADVISE");					break;
-		case F_RDAHEAD:						return("F_RDAHEAD");					break;
-		case F_NOCACHE:						return("F_NOCACHE");					break;
-		case F_LOG2PHYS:					return("F_LOG2PHYS");					break;
-		case F_GETPATH:						return("F_GETPATH");					break;
-		case F_FULLFSYNC:					return("F_FULLFSYNC");					break;
-		case F_PATHPKG_CHECK:				return("F_PATHPKG_CHECK");				break;
-		case F_FREEZE_FS:					return("F_FREEZE_FS");					break;
-		case F_THAW_FS:						return("F_THAW_FS");					break;
-		case F_GLOBAL_NOCACHE:				return("F_GLOBAL_NOCACHE");				break;
-		case F_ADDSIGS:						return("F_ADDSIGS");					break;
-		case F_ADDFILESIGS:					return("F_ADDFILESIGS");				break;
-		case F_NODIRECT:					return("F_NODIRECT");					break;
-		case F_GETPROTECTIONCLASS:			return("F_GETPROTECTIONCLASS");			break;
-		case F_SETPROTECTIONCLASS:			return("F_SETPROTECTIONCLASS");			break;
-		case F_LOG2PHYS_EXT:				return("F_LOG2PHYS_EXT");				break;
-		case F_GETLKPID:					return("F_GETLKPID");					break;
-		case F_SETBACKINGSTORE:				return("F_SETBACKINGSTORE");			break;
-		case F_GETPATH_MTMINFO:				return("F_GETPATH_MTMINFO");			break;
-		case F_GETCODEDIR:					return("F_GETCODEDIR");					break;
-		case F_SETNOSIGPIPE:				return("F_SETNOSIGPIPE");				break;
-		case F_GETNOSIGPIPE:				return("F_GETNOSIGPIPE");				break;
-		case F_TRANSCODEKEY:				return("F_TRANSCODEKEY");				break;
-		case F_SINGLE_WRITER:				return("F_SINGLE_WRITER");				break;
-		case F_GETPROTECTIONLEVEL:			return("F_GETPROTECTIONLEVEL");			break;
-		case F_FINDSIGS:					return("F_FINDSIGS");					break;
-		case F_ADDFILESIGS_FOR_DYLD_SIM:	return("F_ADDFILESIGS_FOR_DYLD_SIM");	break;
-		case F_BARRIERFSYNC:				return("F_BARRIERFSYNC");				break;
-		case F_ADDFILESIGS_RETURN:			return("F_ADDFILESIGS_RETURN");			break;
-		case F_CHECK_LV:					return("F_CHECK_LV");					break;
-		case F_PUNCHHOLE:					return("F_PUNCHHOLE");					break;
-		case F_TRIM_ACTIVE_FILE:			return("F_TRIM_ACTIVE_FILE");			break;
-		default:
-			break;
-		}
-
-	return("UNKNOWN");
+	// Get the descriptor
+	return(logfuse_ll_inode(ino)->fd);
 }
 
 
 
 
 
-#pragma mark FUSE
 //============================================================================
-//		FUSE methods.
-//----------------------------------------------------------------------------
-//		logfuse_getattr : Get file attributes.
+//		logfuse_ll_ino : Get an inode's backing inode number.
 //----------------------------------------------------------------------------
-static int logfuse_getattr(const char *path, struct stat *statInfo)
-{	int		sysErr;
-
+static unsigned long long logfuse_ll_ino(fuse_ino_t ino)
+{
 
 
-	// Get the attributes
+	// Get the inode number
 	//
-	// Setting st_blksize to 0 ensures FUSE uses the global iosize option.
-	sysErr               = lstat(path, statInfo);
-	statInfo->st_blksize = 0;
-	
-	logfuse_log("logfuse_getattr(%s) err=%d", path, sysErr);
-
-	RETURN_FUSE_ERRNO();
+	// Node IDs are pointers, so we log the backing inode number instead.
+	return((unsigned long long) logfuse_ll_inode(ino)->fileID.ino);
 }
 
 
@@ -392,20 +8827,17 @@ static int logfuse_getattr(const char *path, struct stat *statInfo)
 
 
 //============================================================================
-//		logfuse_readlink : Read a symbol link.
+//		logfuse_ll_proc_path : Get an inode's path through /proc.
 //----------------------------------------------------------------------------
-static int logfuse_readlink(const char *path, char *buffer, size_t size)
-{	int		sysErr;
-
-
-
-	// Read the link
-	sysErr = readlink(path, buffer, size - 1);
-	buffer[sysErr == -1 ? 0 : sysErr] = 0x00;
+static std::string logfuse_ll_proc_path(fuse_ino_t ino)
+{
 
-	logfuse_log("logfuse_readlink(%s, %s) err=%d", path, buffer, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Get the path
+	//
+	// An O_PATH descriptor cannot be read, written, or have its mode or
+	// extended attributes changed, so these calls reopen it through /proc.
+	return("/proc/self/fd/" + std::to_string(logfuse_ll_fd(ino)));
 }
 
 
@@ -413,22 +8845,16 @@ static int logfuse_readlink(const char *path, char *buffer, size_t size)
 
 
 //============================================================================
-//		logfuse_mknod : Create a file node.
+//		logfuse_ll_timeout : Get a timeout.
 //----------------------------------------------------------------------------
-static int logfuse_mknod(const char *path, mode_t mode, dev_t rdev)
-{	int		sysErr;
-
-
-
-	// Create the node
-	if (S_ISFIFO(mode))
-		sysErr = mkfifo(path, mode);
-	else
-		sysErr = mknod( path, mode, rdev);
+static double logfuse_ll_timeout(double theTimeout, double theDefault)
+{
 
-	logfuse_log("logfuse_mknod(%s, %d, %d) err=%d", path, mode, rdev, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Get the timeout
+	//
+	// The defaults match those of the high-level API.
+	return(theTimeout >= 0.0 ? theTimeout : theDefault);
 }
 
 
@@ -436,37 +8862,77 @@ static int logfuse_mknod(const char *path, mode_t mode, dev_t rdev)
 
 
 //============================================================================
-//		logfuse_mkdir : Create a directory.
+//		logfuse_ll_lookup_entry : Look up a directory entry.
 //----------------------------------------------------------------------------
-static int logfuse_mkdir(const char *path, mode_t mode)
-{	int		sysErr;
+static int logfuse_ll_lookup_entry(fuse_ino_t parent, const char *name, fuse_entry_param *theEntry)
+{	logfuse_file_id		fileID;
+	logfuse_inode		*theInode;
+	int					sysErr;
+	int					fd;
 
 
 
-	// Create the directory
-	sysErr = mkdir(path, mode);
-	logfuse_log("logfuse_mkdir(%s, %d) err=%d", path, mode, sysErr);
+	// Get the state we need
+	memset(theEntry, 0x00, sizeof(*theEntry));
 
-	RETURN_FUSE_ERRNO();
-}
+	theEntry->attr_timeout  = logfuse_ll_timeout(gConfig.attrTimeout,  1.0);
+	theEntry->entry_timeout = logfuse_ll_timeout(gConfig.entryTimeout, 1.0);
 
 
 
+	// Open the entry
+	fd = openat(logfuse_ll_fd(parent), name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return(errno);
 
+	if (fstatat(fd, "", &theEntry->attr, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW) == -1)
+		{
+		sysErr = errno;
+		close(fd);
+		return(sysErr);
+		}
 
-//============================================================================
-//		logfuse_unlink : Remove a file.
-//----------------------------------------------------------------------------
-static int logfuse_unlink(const char *path)
-{	int		sysErr;
+	fileID.dev = theEntry->attr.st_dev;
+	fileID.ino = theEntry->attr.st_ino;
 
 
 
-	// Remove the file
-	sysErr = unlink(path);
-	logfuse_log("logfuse_unlink(%s) err=%d", path, sysErr);
+	// Find the inode
+	//
+	// A file reached through several names shares one inode, and keeps the
+	// descriptor from the first lookup.
+	{	std::lock_guard<std::mutex>		acquireLock(gInodes.theLock);
 
-	RETURN_FUSE_ERRNO();
+		auto theIter = gInodes.theInodes.find(fileID);
+		if (theIter != gInodes.theInodes.end())
+			{
+			theInode = theIter->second.get();
+			theInode->nlookup++;
+			}
+		else
+			{
+			theInode = new (std::nothrow) logfuse_inode;
+			if (theInode == nullptr)
+				{
+				close(fd);
+				return(ENOMEM);
+				}
+
+			theInode->fd      = fd;
+			theInode->fileID  = fileID;
+			theInode->nlookup = 1;
+
+			gInodes.theInodes.emplace(fileID, std::unique_ptr<logfuse_inode>(theInode));
+			fd = -1;
+			}
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	theEntry->ino = (uintptr_t) theInode;
+
+	return(0);
 }
 
 
@@ -474,18 +8940,28 @@ static int logfuse_unlink(const char *path)
 
 
 //============================================================================
-//		logfuse_rmdir : Remove a directory.
+//		logfuse_ll_forget_inode : Forget lookups of an inode.
 //----------------------------------------------------------------------------
-static int logfuse_rmdir(const char *path)
-{	int		sysErr;
+static void logfuse_ll_forget_inode(fuse_ino_t ino, uint64_t nlookup)
+{	std::lock_guard<std::mutex>		acquireLock(gInodes.theLock);
+	logfuse_inode					*theInode = logfuse_ll_inode(ino);
 
 
 
-	// Remove the directory
-	sysErr = rmdir(path);
-	logfuse_log("logfuse_rmdir(%s) err=%d", path, sysErr);
+	// Forget the inode
+	//
+	// The root is never forgotten, and every other inode is released once
+	// the kernel has forgotten every lookup of it.
+	if (theInode == &gInodes.theRoot)
+		return;
 
-	RETURN_FUSE_ERRNO();
+	theInode->nlookup -= std::min(nlookup, theInode->nlookup);
+
+	if (theInode->nlookup == 0)
+		{
+		close(theInode->fd);
+		gInodes.theInodes.erase(theInode->fileID);
+		}
 }
 
 
@@ -493,18 +8969,17 @@ static int logfuse_rmdir(const char *path)
 
 
 //============================================================================
-//		logfuse_symlink : Create a symbolic link.
+//		logfuse_ll_reply_entry : Reply with a directory entry.
 //----------------------------------------------------------------------------
-static int logfuse_symlink(const char *from, const char *to)
-{	int		sysErr;
-
-
+static void logfuse_ll_reply_entry(fuse_req_t req, int theErr, const fuse_entry_param *theEntry)
+{
 
-	// Create the link
-	sysErr = symlink(from, to);
-	logfuse_log("logfuse_symlink(%s, %s) err=%d", from, to, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Send the reply
+	if (theErr == 0)
+		fuse_reply_entry(req, theEntry);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -512,18 +8987,15 @@ static int logfuse_symlink(const char *from, const char *to)
 
 
 //============================================================================
-//		logfuse_rename : Rename a file.
+//		logfuse_ll_throttle : Throttle the caller of a request.
 //----------------------------------------------------------------------------
-static int logfuse_rename(const char *from, const char *to)
-{	int		sysErr;
-
+static void logfuse_ll_throttle(fuse_req_t req, size_t numOps, size_t numBytes)
+{	const fuse_ctx		*theContext = fuse_req_ctx(req);
 
 
-	// Rename the file
-	sysErr = rename(from, to);
-	logfuse_log("logfuse_rename(%s, %s) err=%d", from, to, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Throttle the caller
+	logfuse_throttle(logfuse_get_settings(), theContext->uid, theContext->pid, numOps, numBytes);
 }
 
 
@@ -531,18 +9003,20 @@ static int logfuse_rename(const char *from, const char *to)
 
 
 //============================================================================
-//		logfuse_link : Create a hard link.
+//		logfuse_ll_init : Initialise the filesystem.
 //----------------------------------------------------------------------------
-static int logfuse_link(const char *from, const char *to)
-{	int		sysErr;
+static void logfuse_ll_init(void */*userData*/, fuse_conn_info *fsConnection)
+{
 
 
+	// Initialise the filesystem
+	//
+	// POSIX locks are left to the kernel, which keeps them local to the mount.
+	logfuse_init(fsConnection);
 
-	// Create the link
-	sysErr = link(from, to);
-	logfuse_log("logfuse_link(%s, %s) err=%d", from, to, sysErr);
+	fsConnection->want &= ~FUSE_CAP_POSIX_LOCKS;
 
-	RETURN_FUSE_ERRNO();
+	logfuse3_init_connection(fsConnection);
 }
 
 
@@ -550,18 +9024,24 @@ static int logfuse_link(const char *from, const char *to)
 
 
 //============================================================================
-//		logfuse_chmod : Change the permission bits.
+//		logfuse_ll_destroy : Destroy the filesystem.
 //----------------------------------------------------------------------------
-static int logfuse_chmod(const char *path, mode_t mode)
-{	int		sysErr;
+static void logfuse_ll_destroy(void *userData)
+{
 
 
+	// Destroy the filesystem
+	//
+	// Any inodes the kernel did not forget are released with the session.
+	{	std::lock_guard<std::mutex>		acquireLock(gInodes.theLock);
 
-	// Change the permission
-	sysErr = chmod(path, mode);
-	logfuse_log("logfuse_chmod(%s, %d) err=%d", path, mode, sysErr);
+		for (const auto &theIter : gInodes.theInodes)
+			close(theIter.second->fd);
 
-	RETURN_FUSE_ERRNO();
+		gInodes.theInodes.clear();
+	}
+
+	logfuse_destroy(userData);
 }
 
 
@@ -569,18 +9049,30 @@ static int logfuse_chmod(const char *path, mode_t mode)
 
 
 //============================================================================
-//		logfuse_chown : Change the owner and group of a file.
+//		logfuse_ll_lookup : Look up a directory entry.
 //----------------------------------------------------------------------------
-static int logfuse_chown(const char *path, uid_t owner, gid_t group)
-{	int		sysErr;
+static void logfuse_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{	fuse_entry_param	theEntry;
+	int					theErr;
 
 
 
-	// Change the owner/group
-	sysErr = chown(path, owner, group);
-	logfuse_log("logfuse_chown(%s, %d, %d) err=%d", path, owner, group, sysErr);
+	// Look up the entry
+	//
+	// A missing entry is returned with a zero node ID when negative_timeout is
+	// set, which lets the kernel cache its absence.
+	theErr = logfuse_ll_lookup_entry(parent, name, &theEntry);
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_lookup(%llu, %s) err=%d", logfuse_ll_ino(parent), name, theErr);
+
+	if (theErr == ENOENT && gConfig.negativeTimeout > 0.0)
+		{
+		memset(&theEntry, 0x00, sizeof(theEntry));
+		theEntry.entry_timeout = gConfig.negativeTimeout;
+		theErr                 = 0;
+		}
+
+	logfuse_ll_reply_entry(req, theErr, &theEntry);
 }
 
 
@@ -588,18 +9080,17 @@ static int logfuse_chown(const char *path, uid_t owner, gid_t group)
 
 
 //============================================================================
-//		logfuse_truncate : Change the size of a file.
+//		logfuse_ll_forget : Forget lookups of an inode.
 //----------------------------------------------------------------------------
-static int logfuse_truncate(const char *path, off_t length)
-{	int		sysErr;
-
+static void logfuse_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
 
 
-	// Change the size
-	sysErr = truncate(path, length);
-	logfuse_log("logfuse_truncate(%s, %lld) err=%d", path, length, sysErr);
+	// Forget the inode
+	logfuse_log("logfuse_ll_forget(%llu, %llu)", logfuse_ll_ino(ino), (unsigned long long) nlookup);
 
-	RETURN_FUSE_ERRNO();
+	logfuse_ll_forget_inode(ino, nlookup);
+	fuse_reply_none(req);
 }
 
 
@@ -607,26 +9098,19 @@ static int logfuse_truncate(const char *path, off_t length)
 
 
 //============================================================================
-//		logfuse_open : Open a file.
+//		logfuse_ll_forget_multi : Forget lookups of several inodes.
 //----------------------------------------------------------------------------
-static int logfuse_open(const char *path, fuse_file_info *fileInfo)
-{	int		fd;
-
+static void logfuse_ll_forget_multi(fuse_req_t req, size_t count, fuse_forget_data *forgets)
+{
 
 
-	// Open the file
-	fd = open(path, fileInfo->flags);
-	logfuse_log("logfuse_open(%s, %s) fd=%d",
-					path,
-					logfuse_str_open_flags(fileInfo->flags).c_str(),
-					fd);
+	// Forget the inodes
+	logfuse_log("logfuse_ll_forget_multi(%zu)", count);
 
-	if (fd == -1)
-		return(-errno);
-	
-	fileInfo->fh = fd;
+	for (size_t n = 0; n < count; n++)
+		logfuse_ll_forget_inode(forgets[n].ino, forgets[n].nlookup);
 
-	return(0);
+	fuse_reply_none(req);
 }
 
 
@@ -634,23 +9118,25 @@ static int logfuse_open(const char *path, fuse_file_info *fileInfo)
 
 
 //============================================================================
-//		logfuse_read : Read from a file.
+//		logfuse_ll_getattr : Get file attributes.
 //----------------------------------------------------------------------------
-static int logfuse_read(const char *path, char *buffer, size_t size, off_t offset, fuse_file_info *fileInfo)
-{	int		sysErr;
+static void logfuse_ll_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info */*fileInfo*/)
+{	struct stat		statInfo;
+	int				sysErr;
+	int				theErr;
 
 
 
-	// Read the file
-	sysErr = pread(fileInfo->fh, buffer, size, offset);
-	logfuse_log("logfuse_read(%s, size=%ld, offset=%lld) %s=%d",
-					path,
-					size,
-					offset,
-					sysErr >= 0 ? "read" : "err",
-					sysErr);
+	// Get the attributes
+	sysErr = fstatat(logfuse_ll_fd(ino), "", &statInfo, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_getattr(%llu) err=%d", logfuse_ll_ino(ino), theErr);
+
+	if (theErr == 0)
+		fuse_reply_attr(req, &statInfo, logfuse_ll_timeout(gConfig.attrTimeout, 1.0));
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -658,42 +9144,83 @@ static int logfuse_read(const char *path, char *buffer, size_t size, off_t offse
 
 
 //============================================================================
-//		logfuse_write : Write to a file.
+//		logfuse_ll_setattr : Set file attributes.
 //----------------------------------------------------------------------------
-static int logfuse_write(const char *path, const char *buffer, size_t size, off_t offset, fuse_file_info *fileInfo)
-{	int		sysErr;
-
+static void logfuse_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int valid, fuse_file_info *fileInfo)
+{	std::string		procPath = logfuse_ll_proc_path(ino);
+	int				fd       = (fileInfo != nullptr) ? logfuse_get_fd(fileInfo) : -1;
+	timespec		timeSpec[2];
+	uid_t			theUID;
+	gid_t			theGID;
+	int				sysErr;
+	int				theErr;
 
 
-	// Write the file
-	sysErr = pwrite(fileInfo->fh, buffer, size, offset);
-	logfuse_log("logfuse_write(%s, size=%ld, offset=%lld) %s=%d",
-					path,
-					size,
-					offset,
-					sysErr >= 0 ? "wrote" : "err",
-					sysErr);
 
-	RETURN_FUSE_ERRNO();
-}
+	// Set the attributes
+	//
+	// Attributes are applied in turn, stopping at the first failure.
+	sysErr = 0;
 
+	if (sysErr == 0 && (valid & FUSE_SET_ATTR_MODE) != 0)
+		{
+		if (fd != -1)
+			sysErr = fchmod(fd, attr->st_mode);
+		else
+			sysErr = fchmodat(AT_FDCWD, procPath.c_str(), attr->st_mode, 0);
+		}
 
+	if (sysErr == 0 && (valid & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) != 0)
+		{
+		theUID = (valid & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t) -1;
+		theGID = (valid & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t) -1;
+		sysErr = fchownat(logfuse_ll_fd(ino), "", theUID, theGID, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+		}
 
+	if (sysErr == 0 && (valid & FUSE_SET_ATTR_SIZE) != 0)
+		{
+		if (fd != -1)
+			sysErr = ftruncate(fd, attr->st_size);
+		else
+			sysErr = truncate(procPath.c_str(), attr->st_size);
+		}
 
+	if (sysErr == 0 && (valid & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) != 0)
+		{
+		timeSpec[0].tv_sec  = 0;
+		timeSpec[0].tv_nsec = UTIME_OMIT;
+		timeSpec[1]         = timeSpec[0];
+
+		if (valid & FUSE_SET_ATTR_ATIME_NOW)
+			timeSpec[0].tv_nsec = UTIME_NOW;
+		else if (valid & FUSE_SET_ATTR_ATIME)
+			timeSpec[0] = STAT_ATIME(*attr);
+
+		if (valid & FUSE_SET_ATTR_MTIME_NOW)
+			timeSpec[1].tv_nsec = UTIME_NOW;
+		else if (valid & FUSE_SET_ATTR_MTIME)
+			timeSpec[1] = STAT_MTIME(*attr);
+
+		if (fd != -1)
+			sysErr = futimens(fd, timeSpec);
+		else
+			sysErr = utimensat(AT_FDCWD, procPath.c_str(), timeSpec, 0);
+		}
 
-//============================================================================
-//		logfuse_statfs : Get file statistics.
-//----------------------------------------------------------------------------
-static int logfuse_statfs(const char *path, struct statvfs *statInfo)
-{	int		sysErr;
+	theErr = (sysErr == -1) ? errno : 0;
 
+	logfuse_log("logfuse_ll_setattr(%llu, %s) err=%d",
+					logfuse_ll_ino(ino),
+					logfuse_str_setattr_valid(valid).c_str(),
+					theErr);
 
 
-	// Get the info
-	sysErr = statvfs(path, statInfo);
-	logfuse_log("logfuse_statfs(%s) err=%d", path, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Return the attributes
+	if (theErr == 0)
+		logfuse_ll_getattr(req, ino, fileInfo);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -701,18 +9228,31 @@ static int logfuse_statfs(const char *path, struct statvfs *statInfo)
 
 
 //============================================================================
-//		logfuse_flush : Flush cached data.
+//		logfuse_ll_readlink : Read a symbolic link.
 //----------------------------------------------------------------------------
-static int logfuse_flush(const char *path, fuse_file_info *fileInfo)
-{	int		sysErr;
+static void logfuse_ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{	char		theBuffer[PATH_MAX + 1];
+	ssize_t		sysErr;
+	int			theErr;
 
 
 
-	// Flush the file
-	sysErr = close(dup(fileInfo->fh));
-	logfuse_log("logfuse_flush(%s, fd=%lld) err=%d", path, fileInfo->fh, sysErr);
+	// Read the link
+	sysErr = readlinkat(logfuse_ll_fd(ino), "", theBuffer, sizeof(theBuffer));
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	if (sysErr == (ssize_t) sizeof(theBuffer))
+		theErr = ENAMETOOLONG;
+
+	if (theErr == 0)
+		theBuffer[sysErr] = 0x00;
+
+	logfuse_log("logfuse_ll_readlink(%llu, %s) err=%d", logfuse_ll_ino(ino), theErr == 0 ? theBuffer : "", theErr);
+
+	if (theErr == 0)
+		fuse_reply_readlink(req, theBuffer);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -720,18 +9260,22 @@ static int logfuse_flush(const char *path, fuse_file_info *fileInfo)
 
 
 //============================================================================
-//		logfuse_release : Release an open file.
+//		logfuse_ll_mknod : Create a file node.
 //----------------------------------------------------------------------------
-static int logfuse_release(const char *path, fuse_file_info *fileInfo)
-{	int		sysErr;
+static void logfuse_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{	fuse_entry_param	theEntry;
+	int					sysErr;
+	int					theErr;
 
 
 
-	// Release the file
-	sysErr = close(fileInfo->fh);
-	logfuse_log("logfuse_close(%s) err=%d", path, sysErr);
+	// Create the node
+	sysErr = mknodat(logfuse_ll_fd(parent), name, mode, rdev);
+	theErr = (sysErr == -1) ? errno : logfuse_ll_lookup_entry(parent, name, &theEntry);
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_mknod(%llu, %s, %d, %d) err=%d", logfuse_ll_ino(parent), name, mode, (int) rdev, theErr);
+
+	logfuse_ll_reply_entry(req, theErr, &theEntry);
 }
 
 
@@ -739,18 +9283,22 @@ static int logfuse_release(const char *path, fuse_file_info *fileInfo)
 
 
 //============================================================================
-//		logfuse_fsync : Synchronize a file.
+//		logfuse_ll_mkdir : Create a directory.
 //----------------------------------------------------------------------------
-static int logfuse_fsync(const char *path, int dataSync, fuse_file_info *fileInfo)
-{	int		sysErr;
+static void logfuse_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{	fuse_entry_param	theEntry;
+	int					sysErr;
+	int					theErr;
 
 
 
-	// Sync the file
-	sysErr = fsync(fileInfo->fh);
-	logfuse_log("logfuse_fsync(%s, %d) err=%d", path, dataSync, sysErr);
+	// Create the directory
+	sysErr = mkdirat(logfuse_ll_fd(parent), name, mode);
+	theErr = (sysErr == -1) ? errno : logfuse_ll_lookup_entry(parent, name, &theEntry);
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_mkdir(%llu, %s, %d) err=%d", logfuse_ll_ino(parent), name, mode, theErr);
+
+	logfuse_ll_reply_entry(req, theErr, &theEntry);
 }
 
 
@@ -758,23 +9306,21 @@ static int logfuse_fsync(const char *path, int dataSync, fuse_file_info *fileInf
 
 
 //============================================================================
-//		logfuse_setxattr : Set an extended attribute.
+//		logfuse_ll_unlink : Remove a file.
 //----------------------------------------------------------------------------
-static int logfuse_setxattr(const char *path, const char *name, const char *value, size_t size, int flags XATTR_POSITION)
+static void logfuse_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Set the attribute
-#if FUSE_APPLE
-	sysErr =  setxattr(path, name, value, size, position, XATTR_NOFOLLOW);
-#else
-	sysErr = lsetxattr(path, name, value, size, flags);
-#endif
+	// Remove the file
+	sysErr = unlinkat(logfuse_ll_fd(parent), name, 0);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	logfuse_log("logfuse_setxattr(%s, %s, %s) err=%d", path, name, value, sysErr);
+	logfuse_log("logfuse_ll_unlink(%llu, %s) err=%d", logfuse_ll_ino(parent), name, theErr);
 
-	RETURN_FUSE_ERRNO();
+	fuse_reply_err(req, theErr);
 }
 
 
@@ -782,23 +9328,21 @@ static int logfuse_setxattr(const char *path, const char *name, const char *valu
 
 
 //============================================================================
-//		logfuse_getxattr : Get an extended attribute.
+//		logfuse_ll_rmdir : Remove a directory.
 //----------------------------------------------------------------------------
-static int logfuse_getxattr(const char *path, const char *name, char *value, size_t size XATTR_POSITION)
+static void logfuse_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Get the attribute
-#if FUSE_APPLE
-	sysErr = getxattr(path, name, value, size, position, XATTR_NOFOLLOW);
-#else
-	sysErr = lgetxattr(path, name, value, size);
-#endif
+	// Remove the directory
+	sysErr = unlinkat(logfuse_ll_fd(parent), name, AT_REMOVEDIR);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	logfuse_log("logfuse_getxattr(%s, %s) value='%s' err=%d", path, name, value, sysErr);
+	logfuse_log("logfuse_ll_rmdir(%llu, %s) err=%d", logfuse_ll_ino(parent), name, theErr);
 
-	RETURN_FUSE_ERRNO();
+	fuse_reply_err(req, theErr);
 }
 
 
@@ -806,18 +9350,22 @@ static int logfuse_getxattr(const char *path, const char *name, char *value, siz
 
 
 //============================================================================
-//		logfuse_listxattr : List extended attributes.
+//		logfuse_ll_symlink : Create a symbolic link.
 //----------------------------------------------------------------------------
-static int logfuse_listxattr(const char *path, char *list, size_t size)
-{	ssize_t		sysErr;
+static void logfuse_ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
+{	fuse_entry_param	theEntry;
+	int					sysErr;
+	int					theErr;
 
 
 
-	// List the attributes
-	sysErr = listxattr(path, list, size, XATTR_NOFOLLOW);
-	logfuse_log("logfuse_listxattr(%s, %s) err=%ld", path, list, sysErr);
+	// Create the link
+	sysErr = symlinkat(link, logfuse_ll_fd(parent), name);
+	theErr = (sysErr == -1) ? errno : logfuse_ll_lookup_entry(parent, name, &theEntry);
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_symlink(%s, %llu, %s) err=%d", link, logfuse_ll_ino(parent), name, theErr);
+
+	logfuse_ll_reply_entry(req, theErr, &theEntry);
 }
 
 
@@ -825,18 +9373,31 @@ static int logfuse_listxattr(const char *path, char *list, size_t size)
 
 
 //============================================================================
-//		logfuse_removexattr : Remove an extended attribute.
+//		logfuse_ll_rename : Rename a file.
 //----------------------------------------------------------------------------
-static int logfuse_removexattr(const char *path, const char *name)
+static void logfuse_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newParent, const char *newName, unsigned int flags)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Remove the attribute
-	sysErr = removexattr(path, name, XATTR_NOFOLLOW);
-	logfuse_log("logfuse_removexattr(%s, %s) err=%d", path, name, sysErr);
+	// Rename the file
+	if (flags == 0)
+		sysErr = renameat(logfuse_ll_fd(parent), name, logfuse_ll_fd(newParent), newName);
+	else
+		sysErr = (int) syscall(SYS_renameat2, logfuse_ll_fd(parent), name, logfuse_ll_fd(newParent), newName, flags);
 
-	RETURN_FUSE_ERRNO();
+	theErr = (sysErr == -1) ? errno : 0;
+
+	logfuse_log("logfuse_ll_rename(%llu, %s, %llu, %s, %u) err=%d",
+					logfuse_ll_ino(parent),
+					name,
+					logfuse_ll_ino(newParent),
+					newName,
+					flags,
+					theErr);
+
+	fuse_reply_err(req, theErr);
 }
 
 
@@ -844,102 +9405,107 @@ static int logfuse_removexattr(const char *path, const char *name)
 
 
 //============================================================================
-//		logfuse_opendir : Open a directory.
+//		logfuse_ll_link : Create a hard link.
 //----------------------------------------------------------------------------
-static int logfuse_opendir(const char *path, fuse_file_info *fileInfo)
-{	logfuse_dir_info	*dirInfo;
+static void logfuse_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newParent, const char *newName)
+{	fuse_entry_param	theEntry;
 	int					sysErr;
-	DIR					*dir;
+	int					theErr;
 
 
 
-	// Open the directory
-	dir    = opendir(path);
-	sysErr = (dir != nullptr) ? 0 : errno;
+	// Create the link
+	//
+	// Linking an O_PATH descriptor directly needs CAP_DAC_READ_SEARCH, while
+	// following its /proc link does not.
+	sysErr = linkat(AT_FDCWD, logfuse_ll_proc_path(ino).c_str(), logfuse_ll_fd(newParent), newName, AT_SYMLINK_FOLLOW);
+	theErr = (sysErr == -1) ? errno : logfuse_ll_lookup_entry(newParent, newName, &theEntry);
 
-	logfuse_log("logfuse_opendir(%s) err=%d", path, sysErr);
+	logfuse_log("logfuse_ll_link(%llu, %llu, %s) err=%d", logfuse_ll_ino(ino), logfuse_ll_ino(newParent), newName, theErr);
 
-	if (sysErr != 0)
-		return(-sysErr);
+	logfuse_ll_reply_entry(req, theErr, &theEntry);
+}
 
 
 
-	// Create our info
-	dirInfo = (logfuse_dir_info *) malloc(sizeof(logfuse_dir_info));
-	if (dirInfo == nullptr)
-		{
-		closedir(dir);
-		return(-ENOMEM);
-		}
 
-	dirInfo->dir    = dir;
-	dirInfo->entry  = nullptr;
-	dirInfo->offset = 0;
 
-	fileInfo->fh = (uintptr_t) dirInfo;
+//============================================================================
+//		logfuse_ll_new_file : Create the info for an open file.
+//----------------------------------------------------------------------------
+static logfuse_file_info *logfuse_ll_new_file(fuse_ino_t ino, int fd, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile;
 
-	return(0);
-}
 
 
+	// Create the file info
+	theFile = new (std::nothrow) logfuse_file_info;
+	if (theFile == nullptr)
+		return(nullptr);
 
+	theFile->fd        = fd;
+	theFile->flags     = logfuse_open_flags(fileInfo->flags);
+	theFile->wasLocked = false;
+	theFile->isTiered  = false;
+	theFile->fileID    = logfuse_ll_inode(ino)->fileID;
 
+	logfuse_apply_cache_policy(nullptr, fileInfo);
+	fileInfo->fh = (uintptr_t) theFile;
 
-//============================================================================
-//		logfuse_readdir : Read a directory.
-//----------------------------------------------------------------------------
-static int logfuse_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, fuse_file_info *fileInfo)
-{	logfuse_dir_info	*dirInfo = logfuse_get_dir(fileInfo);
-	off_t				nextOffset;
-	struct stat			statInfo;
+	return(theFile);
+}
 
 
 
-	// Seek to the entry
-	if (offset != dirInfo->offset)
-		{
-		seekdir(dirInfo->dir, offset);
-		
-		dirInfo->entry  = nullptr;
-		dirInfo->offset = offset;
-		}
 
 
+//============================================================================
+//		logfuse_ll_open : Open a file.
+//----------------------------------------------------------------------------
+static void logfuse_ll_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo)
+{	bool			wasTiered;
+	bool			wantCopy;
+	int				fd;
+	int				theErr;
 
-	// Read the info
-	while (true)
-		{
-		// Read the entry
-		if (dirInfo->entry == nullptr)
-			{
-			dirInfo->entry = readdir(dirInfo->dir);
-			if (dirInfo->entry == nullptr)
-				break;
-			}
 
 
+	// Open the file
+	//
+	// A file with a copy in the tier is opened from there.
+	fd       = -1;
+	wantCopy = false;
 
-		// Get the info
-        memset(&statInfo, 0, sizeof(statInfo));
-        statInfo.st_ino  = dirInfo->entry->d_ino;
-        statInfo.st_mode = dirInfo->entry->d_type << 12;
+	if (logfuse_tier_eligible(fileInfo->flags))
+		fd = logfuse_tier_open_inode(logfuse_ll_inode(ino)->fileID, logfuse_ll_fd(ino), &wantCopy);
 
-        nextOffset = telldir(dirInfo->dir);
+	wasTiered = (fd != -1);
 
-        if (filler(buffer, dirInfo->entry->d_name, &statInfo, nextOffset))
-			{
-			logfuse_log("logfuse_readdir(%s, %s) err=0", path, dirInfo->entry->d_name);
-			break;
-			}
+	if (!wasTiered)
+		fd = open(logfuse_ll_proc_path(ino).c_str(), (logfuse_open_flags(fileInfo->flags) & ~O_NOFOLLOW) | O_CLOEXEC);
 
+	theErr = (fd == -1) ? errno : 0;
 
+	if (wantCopy)
+		logfuse_tier_promote(fd, logfuse_ll_inode(ino)->fileID);
 
-		// Update our state
-		dirInfo->entry  = nullptr;
-        dirInfo->offset = nextOffset;
+	if (theErr == 0 && logfuse_ll_new_file(ino, fd, fileInfo) == nullptr)
+		{
+		close(fd);
+		theErr = ENOMEM;
 		}
-	
-	return(0);
+
+	logfuse_log("logfuse_ll_open(%llu, %s) fd=%d err=%d%s",
+					logfuse_ll_ino(ino),
+					logfuse_str_open_flags(fileInfo->flags).c_str(),
+					fd,
+					theErr,
+					wasTiered ? " tiered" : "");
+
+	if (theErr == 0)
+		fuse_reply_open(req, fileInfo);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -947,37 +9513,40 @@ static int logfuse_readdir(const char *path, void *buffer, fuse_fill_dir_t fille
 
 
 //============================================================================
-//		logfuse_releasedir : Release a directory.
+//		logfuse_ll_create : Create and open a file.
 //----------------------------------------------------------------------------
-static int logfuse_releasedir(const char *path, fuse_file_info *fileInfo)
-{	logfuse_dir_info	*dirInfo = logfuse_get_dir(fileInfo);
-
-
-
-	// Release the directory
-	logfuse_log("logfuse_releasedir(%s) err=0", path);
-
-	closedir(dirInfo->dir);
-	free(    dirInfo);
-
-	return(0);
-}
+static void logfuse_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, fuse_file_info *fileInfo)
+{	fuse_entry_param	theEntry;
+	int					fd;
+	int					theErr;
 
 
 
+	// Create the file
+	fd     = openat(logfuse_ll_fd(parent), name, (logfuse_open_flags(fileInfo->flags) | O_CREAT | O_CLOEXEC) & ~O_NOFOLLOW, mode);
+	theErr = (fd == -1) ? errno : logfuse_ll_lookup_entry(parent, name, &theEntry);
 
+	if (theErr == 0 && logfuse_ll_new_file(theEntry.ino, fd, fileInfo) == nullptr)
+		{
+		logfuse_ll_forget_inode(theEntry.ino, 1);
+		theErr = ENOMEM;
+		}
 
-//============================================================================
-//		logfuse_fsyncdir : Synchronise a directory.
-//----------------------------------------------------------------------------
-static int logfuse_fsyncdir(const char *path, int dataSync, fuse_file_info */*fileInfo*/)
-{
+	if (theErr != 0 && fd != -1)
+		close(fd);
 
+	logfuse_log("logfuse_ll_create(%llu, %s, %s, %d) fd=%d err=%d",
+					logfuse_ll_ino(parent),
+					name,
+					logfuse_str_open_flags(fileInfo->flags).c_str(),
+					mode,
+					fd,
+					theErr);
 
-	// Synchronise the directory
-	logfuse_log("logfuse_fsyncdir(%s, %d) err=0", path, dataSync);
-	
-	return(0);
+	if (theErr == 0)
+		fuse_reply_create(req, &theEntry, fileInfo);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -985,35 +9554,36 @@ static int logfuse_fsyncdir(const char *path, int dataSync, fuse_file_info */*fi
 
 
 //============================================================================
-//		logfuse_init : Initialise the filesystem.
+//		logfuse_ll_read : Read from a file.
 //----------------------------------------------------------------------------
-static void *logfuse_init(fuse_conn_info *fsConnection)
-{
+static void logfuse_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fileInfo)
+{	static thread_local std::vector<char>	theBuffer;
+	ssize_t									sysErr;
+	int										theErr;
 
 
-	// Initialise the filesystem
-	logfuse_log("logfuse_init: protocol=%d.%d, max_write=%d, max_read=%d, caps=0x%0x",
-						fsConnection->proto_major,
-						fsConnection->proto_minor,
-						fsConnection->max_write,
-						fsConnection->max_readahead,
-						fsConnection->capable);
-
-	fsConnection->want |= FUSE_CAP_ASYNC_READ;
-	fsConnection->want |= FUSE_CAP_POSIX_LOCKS;
-	fsConnection->want |= FUSE_CAP_ATOMIC_O_TRUNC;
-	fsConnection->want |= FUSE_CAP_BIG_WRITES;
-	fsConnection->want |= FUSE_CAP_FLOCK_LOCKS;
 
-#if FUSE_APPLE
-	fsConnection->want |= FUSE_CAP_ALLOCATE;
-	fsConnection->want |= FUSE_CAP_EXCHANGE_DATA;
-	fsConnection->want |= FUSE_CAP_CASE_INSENSITIVE;
-	fsConnection->want |= FUSE_CAP_VOL_RENAME;
-	fsConnection->want |= FUSE_CAP_XTIMES;
-#endif
+	// Read the file
+	//
+	// Each worker reuses its buffer, which grows to the largest read.
+	if (theBuffer.size() < size)
+		theBuffer.resize(size);
 
-	return(nullptr);
+	logfuse_ll_throttle(req, 0, size);
+	sysErr = pread(logfuse_get_fd(fileInfo), theBuffer.data(), size, offset);
+	theErr = (sysErr == -1) ? errno : 0;
+
+	logfuse_log("logfuse_ll_read(%llu, size=%zu, offset=%lld) %s=%d",
+					logfuse_ll_ino(ino),
+					size,
+					(long long) offset,
+					sysErr >= 0 ? "read" : "err",
+					(int) (sysErr >= 0 ? sysErr : theErr));
+
+	if (theErr == 0)
+		fuse_reply_buf(req, theBuffer.data(), (size_t) sysErr);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -1021,14 +9591,31 @@ static void *logfuse_init(fuse_conn_info *fsConnection)
 
 
 //============================================================================
-//		logfuse_destroy : Destroy the filesystem.
+//		logfuse_ll_write : Write to a file.
 //----------------------------------------------------------------------------
-static void logfuse_destroy(void */*userData*/)
-{
+static void logfuse_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buffer, size_t size, off_t offset, fuse_file_info *fileInfo)
+{	ssize_t		sysErr;
+	int			theErr;
 
 
-	// Destroy the filesyste,
-	logfuse_log("logfuse_destroy");
+
+	// Write the file
+	logfuse_ll_throttle(req, 0, size);
+	sysErr = pwrite(logfuse_get_fd(fileInfo), buffer, size, offset);
+	theErr = (sysErr == -1) ? errno : 0;
+
+	logfuse_log("logfuse_ll_write(%llu, size=%zu, offset=%lld) %s=%d%s",
+					logfuse_ll_ino(ino),
+					size,
+					(long long) offset,
+					sysErr >= 0 ? "wrote" : "err",
+					(int) (sysErr >= 0 ? sysErr : theErr),
+					fileInfo->writepage ? " writeback" : "");
+
+	if (theErr == 0)
+		fuse_reply_write(req, (size_t) sysErr);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -1036,21 +9623,24 @@ static void logfuse_destroy(void */*userData*/)
 
 
 //============================================================================
-//		logfuse_access : Check file access permissions.
+//		logfuse_ll_flush : Flush a file.
 //----------------------------------------------------------------------------
-static int logfuse_access(const char *path, int mode)
+static void logfuse_ll_flush(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Check the permissions
-	sysErr = access(path, mode);
-	logfuse_log("logfuse_access(%s, %s) err=%d",
-					path,
-					logfuse_str_access_mode(mode).c_str(),
-					sysErr);
+	// Flush the file
+	//
+	// Closing a duplicate reports any deferred write errors, without closing
+	// the descriptor that later requests will use.
+	sysErr = close(dup(logfuse_get_fd(fileInfo)));
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_flush(%llu) err=%d", logfuse_ll_ino(ino), theErr);
+
+	fuse_reply_err(req, theErr);
 }
 
 
@@ -1058,23 +9648,20 @@ static int logfuse_access(const char *path, int mode)
 
 
 //============================================================================
-//		logfuse_create : Create and open a file.
+//		logfuse_ll_release : Release an open file.
 //----------------------------------------------------------------------------
-static int logfuse_create(const char *path, mode_t mode, fuse_file_info *fileInfo)
-{	int		fd;
+static void logfuse_ll_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo)
+{	logfuse_file_info		*theFile = logfuse_get_file(fileInfo);
 
 
 
-	// Open the file
-	fd = open(path, fileInfo->flags, mode);
-	logfuse_log("logfuse_create(%s, 0x%0X, %d) fd=%d", path, mode, fileInfo->flags, fd);
+	// Release the file
+	logfuse_log("logfuse_ll_release(%llu) fd=%d", logfuse_ll_ino(ino), theFile->fd);
 
-	if (fd == -1)
-		return(-errno);
-	
-	fileInfo->fh = fd;
-	
-	return(0);
+	close(theFile->fd);
+	delete theFile;
+
+	fuse_reply_err(req, 0);
 }
 
 
@@ -1082,18 +9669,25 @@ static int logfuse_create(const char *path, mode_t mode, fuse_file_info *fileInf
 
 
 //============================================================================
-//		logfuse_ftruncate : Change the size of an open file.
+//		logfuse_ll_fsync : Synchronise a file's contents.
 //----------------------------------------------------------------------------
-static int logfuse_ftruncate(const char *path, off_t length, fuse_file_info *fileInfo)
+static void logfuse_ll_fsync(fuse_req_t req, fuse_ino_t ino, int dataSync, fuse_file_info *fileInfo)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Change the size
-	sysErr = ftruncate(fileInfo->fh, length);
-	logfuse_log("logfuse_ftruncate(%s, %lld) err=%d", path, length, sysErr);
+	// Synchronise the file
+	if (dataSync)
+		sysErr = fdatasync(logfuse_get_fd(fileInfo));
+	else
+		sysErr = fsync(logfuse_get_fd(fileInfo));
 
-	RETURN_FUSE_ERRNO();
+	theErr = (sysErr == -1) ? errno : 0;
+
+	logfuse_log("logfuse_ll_fsync(%llu, %d) err=%d", logfuse_ll_ino(ino), dataSync, theErr);
+
+	fuse_reply_err(req, theErr);
 }
 
 
@@ -1101,22 +9695,31 @@ static int logfuse_ftruncate(const char *path, off_t length, fuse_file_info *fil
 
 
 //============================================================================
-//		logfuse_fgetattr : Get attributes from an open file.
+//		logfuse_ll_opendir : Open a directory.
 //----------------------------------------------------------------------------
-static int logfuse_fgetattr(const char *path, struct stat *statInfo, fuse_file_info *fileInfo)
-{	int		sysErr;
+static void logfuse_ll_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo)
+{	logfuse_dir_info	*dirInfo = nullptr;
+	int					theErr;
+	int					fd;
 
 
 
-	// Get the attributes
-	//
-	// Setting st_blksize to 0 ensures FUSE uses the global iosize option.
-	sysErr               = fstat(fileInfo->fh, statInfo);
-	statInfo->st_blksize = 0;
+	// Open the directory
+	fd = openat(logfuse_ll_fd(ino), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1)
+		dirInfo = logfuse_dir_open(fd);
 
-	logfuse_log("logfuse_fgetattr(%s) err=%d", path, sysErr);
+	theErr = (dirInfo == nullptr) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_opendir(%llu) err=%d", logfuse_ll_ino(ino), theErr);
+
+	if (theErr == 0)
+		{
+		fileInfo->fh = (uintptr_t) dirInfo;
+		fuse_reply_open(req, fileInfo);
+		}
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
@@ -1124,65 +9727,128 @@ static int logfuse_fgetattr(const char *path, struct stat *statInfo, fuse_file_i
 
 
 //============================================================================
-//		logfuse_lock : Perform POSIX file locking.
+//		logfuse_ll_readdir_entries : Read directory entries.
 //----------------------------------------------------------------------------
-static int logfuse_lock(const char *path, struct fuse_file_info *fileInfo, int cmd, struct flock *lockInfo)
-{	int		sysErr;
+static void logfuse_ll_readdir_entries(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fileInfo, bool withPlus)
+{	logfuse_dir_info			*dirInfo = logfuse_get_dir(fileInfo);
+	std::unique_ptr<char[]>		theBuffer(new (std::nothrow) char[size]);
+	size_t						thePos, theSize;
+	fuse_entry_param			theEntry;
+	const char					*theName;
+	off_t						nextOffset;
+	int							numEntries;
+	int							theErr;
 
 
 
-	// Perform the lock
-	sysErr = fcntl(fileInfo->fh, cmd, lockInfo);
-	logfuse_log("logfuse_lock(%s, %s) err=%d",
-					path,
-					logfuse_str_fcntl_cmd(cmd),
-					sysErr);
+	// Validate our state
+	if (theBuffer == nullptr)
+		{
+		fuse_reply_err(req, ENOMEM);
+		return;
+		}
 
-	RETURN_FUSE_ERRNO();
-}
 
 
+	// Seek to the entry
+	if (offset != dirInfo->offset)
+		{
+		dirInfo->entry = nullptr;
 
+		if (!logfuse_dir_seek(dirInfo, offset))
+			{
+			fuse_reply_err(req, errno);
+			return;
+			}
 
+		dirInfo->offset = offset;
+		}
 
-//============================================================================
-//		logfuse_utimens : Change the access+modification times of a file.
-//----------------------------------------------------------------------------
-static int logfuse_utimens(const char *path, const timespec timeSpec[2])
-{	int		sysErr;
 
 
+	// Read the entries
+	//
+	// An entry that does not fit is kept for the next request. With readdirplus
+	// each entry is looked up, after checking it fits, since every entry we
+	// return holds a lookup that the kernel will later forget.
+	//
+	// An error is returned once the entries read before it have been returned.
+	thePos     = 0;
+	numEntries = 0;
+	theErr     = 0;
 
-#if FUSE_APPLE
-	attrlist				attributeInfo;
+	while (true)
+		{
+		// Read the entry
+		if (dirInfo->entry == nullptr)
+			{
+			dirInfo->entry = logfuse_dir_read(dirInfo);
+			if (dirInfo->entry == nullptr)
+				{
+				theErr = errno;
+				break;
+				}
+			}
 
-	struct __attribute__((packed)) {
-		timespec		modTime;
-		timespec		accessTime;
-	} attributeData;
+		theName    = dirInfo->entry->d_name;
+		nextOffset = logfuse_dir_tell(dirInfo);
 
 
 
-	// Get the state we need
-	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+		// Add the entry
+		memset(&theEntry, 0x00, sizeof(theEntry));
+		theEntry.attr.st_ino  = dirInfo->entry->d_ino;
+		theEntry.attr.st_mode = dirInfo->entry->d_type << 12;
 
-	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
-    attributeInfo.commonattr  = ATTR_CMN_ACCTIME | ATTR_CMN_MODTIME;
-	
-	attributeData.modTime    = timeSpec[1];
-	attributeData.accessTime = timeSpec[0];
+		if (withPlus)
+			{
+			if (fuse_add_direntry_plus(req, nullptr, 0, theName, nullptr, 0) > size - thePos)
+				break;
+
+			if (strcmp(theName, ".") != 0 && strcmp(theName, "..") != 0 &&
+				logfuse_ll_lookup_entry(ino, theName, &theEntry) != 0)
+				{
+				memset(&theEntry, 0x00, sizeof(theEntry));
+				theEntry.attr.st_ino  = dirInfo->entry->d_ino;
+				theEntry.attr.st_mode = dirInfo->entry->d_type << 12;
+				}
 
+			theSize = fuse_add_direntry_plus(req, &theBuffer[thePos], size - thePos, theName, &theEntry, nextOffset);
+			}
+		else
+			{
+			theSize = fuse_add_direntry(req, &theBuffer[thePos], size - thePos, theName, &theEntry.attr, nextOffset);
+			if (theSize > size - thePos)
+				break;
+			}
 
 
-	// Set the timestamps
-	sysErr = setattrlist(path, &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
-#else
-	sysErr = utimensat(0, path, timeSpec, AT_SYMLINK_NOFOLLOW);
-#endif
 
-	logfuse_log("logfuse_utimens(%s) err=%d", path, sysErr);
+		// Update our state
+		thePos += theSize;
+		numEntries++;
 
-	RETURN_FUSE_ERRNO();
+		dirInfo->entry  = nullptr;
+		dirInfo->offset = nextOffset;
+		}
+
+	if (withPlus)
+		logfuse_log("logfuse_ll_readdirplus(%llu, offset=%lld) entries=%d err=%d",
+						logfuse_ll_ino(ino),
+						(long long) offset,
+						numEntries,
+						theErr);
+	else
+		logfuse_log("logfuse_ll_readdir(%llu, offset=%lld) entries=%d err=%d",
+						logfuse_ll_ino(ino),
+						(long long) offset,
+						numEntries,
+						theErr);
+
+	if (theErr != 0 && numEntries == 0)
+		fuse_reply_err(req, theErr);
+	else
+		fuse_reply_buf(req, theBuffer.get(), thePos);
 }
 
 
@@ -1190,16 +9856,14 @@ static int logfuse_utimens(const char *path, const timespec timeSpec[2])
 
 
 //============================================================================
-//		logfuse_ioctl : Invoke a device control command.
+//		logfuse_ll_readdir : Read a directory.
 //----------------------------------------------------------------------------
-static int logfuse_ioctl(const char *path, int cmd, void *arg, fuse_file_info *fileInfo, unsigned int flags, void *data)
+static void logfuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fileInfo)
 {
 
 
-	// Invoke the command
-	logfuse_log("logfuse_ioctl(%s)", path);
-
-	return(-ENOMEM);
+	// Read the directory
+	logfuse_ll_readdir_entries(req, ino, size, offset, fileInfo, false);
 }
 
 
@@ -1207,16 +9871,14 @@ static int logfuse_ioctl(const char *path, int cmd, void *arg, fuse_file_info *f
 
 
 //============================================================================
-//		logfuse_poll : Poll for IO readiness events.
+//		logfuse_ll_readdirplus : Read a directory with attributes.
 //----------------------------------------------------------------------------
-static int logfuse_poll(const char *path, fuse_file_info *fileInfo, fuse_pollhandle *pollHnd, unsigned *reventsp)
+static void logfuse_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fileInfo)
 {
 
 
-	// Poll for IO
-	logfuse_log("logfuse_poll(%s)", path);
-
-	return(-ENOMEM);
+	// Read the directory
+	logfuse_ll_readdir_entries(req, ino, size, offset, fileInfo, true);
 }
 
 
@@ -1224,17 +9886,17 @@ static int logfuse_poll(const char *path, fuse_file_info *fileInfo, fuse_pollhan
 
 
 //============================================================================
-//		logfuse_flock : Perform BSD file locking.
+//		logfuse_ll_releasedir : Release an open directory.
 //----------------------------------------------------------------------------
-static int logfuse_flock(const char *path, fuse_file_info *fileInfo, int lockOp)
-{	int		sysErr;
+static void logfuse_ll_releasedir(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo)
+{
 
 
-	// Perform the lock
-	sysErr = flock(fileInfo->fh, lockOp);
-	logfuse_log("logfuse_flock(%s, %d)", path, lockOp);
+	// Release the directory
+	logfuse_log("logfuse_ll_releasedir(%llu)", logfuse_ll_ino(ino));
 
-	RETURN_FUSE_ERRNO();
+	logfuse_dir_close(logfuse_get_dir(fileInfo));
+	fuse_reply_err(req, 0);
 }
 
 
@@ -1242,415 +9904,456 @@ static int logfuse_flock(const char *path, fuse_file_info *fileInfo, int lockOp)
 
 
 //============================================================================
-//		logfuse_fallocate : Allocate space for a file.
+//		logfuse_ll_fsyncdir : Synchronise a directory's contents.
 //----------------------------------------------------------------------------
-static int logfuse_fallocate(const char *path, int mode, off_t offset, off_t length, fuse_file_info *fileInfo)
-{	fstore_t		theInfo;
-	int				sysErr;
+static void logfuse_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int dataSync, fuse_file_info *fileInfo)
+{	int		sysErr;
+	int		theErr;
 
 
 
-	// Check our parameters
-    if ((mode & PREALLOCATE) == 0)
-		return(-ENOTSUP);
+	// Synchronise the directory
+	if (dataSync)
+		sysErr = fdatasync(logfuse_dir_fd(logfuse_get_dir(fileInfo)));
+	else
+		sysErr = fsync(logfuse_dir_fd(logfuse_get_dir(fileInfo)));
 
+	theErr = (sysErr == -1) ? errno : 0;
 
+	logfuse_log("logfuse_ll_fsyncdir(%llu, %d) err=%d", logfuse_ll_ino(ino), dataSync, theErr);
 
-	// Get the state we need
-	memset(&theInfo, 0x00, sizeof(theInfo));
+	fuse_reply_err(req, theErr);
+}
 
-	theInfo.fst_offset = offset;
-	theInfo.fst_length = length;
 
-	if ((mode & ALLOCATECONTIG) != 0)
-		theInfo.fst_flags |= F_ALLOCATECONTIG;
 
-	if ((mode & ALLOCATEALL) != 0)
-		theInfo.fst_flags |= F_ALLOCATEALL;
 
-	if ((mode & ALLOCATEFROMPEOF) != 0)
-		theInfo.fst_posmode = F_PEOFPOSMODE;
 
-	if ((mode & ALLOCATEFROMVOL) != 0)
-		theInfo.fst_posmode = F_VOLPOSMODE;
+//============================================================================
+//		logfuse_ll_statfs : Get file system statistics.
+//----------------------------------------------------------------------------
+static void logfuse_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{	struct statvfs		statInfo;
+	int					sysErr;
+	int					theErr;
 
 
 
-	// Allocate the space
-	sysErr = fcntl(fileInfo->fh, F_PREALLOCATE, &theInfo);
-	logfuse_log("logfuse_fallocate(%s, %d, %lld, %lld) err=%d", path, mode, offset, length, sysErr);
+	// Get the file system information
+	sysErr = fstatvfs(logfuse_ll_fd(ino), &statInfo);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_statfs(%llu) err=%d", logfuse_ll_ino(ino), theErr);
+
+	if (theErr == 0)
+		fuse_reply_statfs(req, &statInfo);
+	else
+		fuse_reply_err(req, theErr);
 }
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_setvolname : Set the volume name.
+//		logfuse_ll_reply_xattr : Reply with an extended attribute result.
 //----------------------------------------------------------------------------
-static int logfuse_setvolname(const char *name)
-{	attrlist		attributeInfo;
-	int				sysErr;
-
-	struct __attribute__((packed)) {
-		attrreference	info;
-		char			name[NAME_MAX + 1];
-	} attributeData;
-
-
-
-	// Get the state we need
-	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
-	memset(&attributeData, 0x00, sizeof(attributeData));
-
-	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
-	attributeInfo.volattr  = ATTR_VOL_INFO | ATTR_VOL_NAME;
-	
-	attributeData.info.attr_dataoffset = sizeof(attrreference);
-	attributeData.info.attr_length     = strlen(name)+1;
-	
-	strncpy(attributeData.name, name, NAME_MAX);
-
+static void logfuse_ll_reply_xattr(fuse_req_t req, size_t size, const char *theBuffer, ssize_t sysErr, int theErr)
+{
 
 
-	// Set the name
+	// Send the reply
 	//
-	// setattrlist requires the path to the volume mount point to set the name.
-	if (false)
-		sysErr = setattrlist(nullptr, &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
+	// A request with no buffer is asking for the size of the result.
+	if (sysErr == -1)
+		fuse_reply_err(req, theErr);
 
-	logfuse_log("logfuse_setvolname(%s)", name);
+	else if (size == 0)
+		fuse_reply_xattr(req, (size_t) sysErr);
 
-	return(-EACCES);
+	else
+		fuse_reply_buf(req, theBuffer, (size_t) sysErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_exchange : Exchange two files.
+//		logfuse_ll_setxattr : Set an extended attribute.
 //----------------------------------------------------------------------------
-static int logfuse_exchange(const char *path1, const char *path2, unsigned long options)
-{	int	sysErr;
+static void logfuse_ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
+{	int		sysErr;
+	int		theErr;
 
 
 
-	// Exchange the files
-	sysErr = exchangedata(path1, path2, options);
-	logfuse_log("logfuse_exchange(%s, %s, %ld) err=%d", path1, path2, options, sysErr);
+	// Set the attribute
+	sysErr = setxattr(logfuse_ll_proc_path(ino).c_str(), name, value, size, flags);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_setxattr(%llu, %s, %zu, %d) err=%d", logfuse_ll_ino(ino), name, size, flags, theErr);
+
+	fuse_reply_err(req, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_getxtimes : Get extended time info.
+//		logfuse_ll_getxattr : Get an extended attribute.
 //----------------------------------------------------------------------------
-static int logfuse_getxtimes(const char *path, timespec *backupTime, timespec *createTime)
-{	attrlist				attributeInfo;
-	int						sysErr;
+static void logfuse_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+{	std::vector<char>	theBuffer(size);
+	ssize_t				sysErr;
+	int					theErr;
 
-	struct __attribute__((packed)) {
-		uint32_t		size;
-		timespec		createTime;
-		timespec		backupTime;
-	} attributeData;
 
 
+	// Get the attribute
+	sysErr = getxattr(logfuse_ll_proc_path(ino).c_str(), name, theBuffer.data(), size);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	// Get the state we need
-	memset(&attributeInfo, 0x00, sizeof(attributeInfo));
+	logfuse_log("logfuse_ll_getxattr(%llu, %s, %zu) %s=%d",
+					logfuse_ll_ino(ino),
+					name,
+					size,
+					sysErr >= 0 ? "size" : "err",
+					(int) (sysErr >= 0 ? sysErr : theErr));
 
-	attributeInfo.bitmapcount = ATTR_BIT_MAP_COUNT;
-    attributeInfo.commonattr  = ATTR_CMN_CRTIME | ATTR_CMN_BKUPTIME;
+	logfuse_ll_reply_xattr(req, size, theBuffer.data(), sysErr, theErr);
+}
 
 
 
-	// Get the attributes
-	sysErr = getattrlist(path, &attributeInfo, &attributeData, sizeof(attributeData), FSOPT_NOFOLLOW);
-	if (sysErr == 0)
-		{
-		*backupTime = attributeData.backupTime;
-		*createTime = attributeData.createTime;
-		}
-	else
-		{
-		memset(backupTime, 0x00, sizeof(timespec));
-		memset(createTime, 0x00, sizeof(timespec));
-		}
 
-	logfuse_log("logfuse_getxtimes(%s) err=%d", path, sysErr);
 
-	RETURN_FUSE_ERRNO();
+//============================================================================
+//		logfuse_ll_listxattr : List extended attributes.
+//----------------------------------------------------------------------------
+static void logfuse_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{	std::vector<char>	theBuffer(size);
+	ssize_t				sysErr;
+	int					theErr;
+
+
+
+	// List the attributes
+	sysErr = listxattr(logfuse_ll_proc_path(ino).c_str(), theBuffer.data(), size);
+	theErr = (sysErr == -1) ? errno : 0;
+
+	logfuse_log("logfuse_ll_listxattr(%llu, %zu) %s=%d",
+					logfuse_ll_ino(ino),
+					size,
+					sysErr >= 0 ? "size" : "err",
+					(int) (sysErr >= 0 ? sysErr : theErr));
+
+	logfuse_ll_reply_xattr(req, size, theBuffer.data(), sysErr, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_setbkuptime : Set the backup time.
+//		logfuse_ll_removexattr : Remove an extended attribute.
 //----------------------------------------------------------------------------
-static int logfuse_setbkuptime(const char *path, const timespec *theTime)
+static void logfuse_ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Set the time
-	sysErr = logfuse_set_timespec(path, ATTR_CMN_BKUPTIME, *theTime);
-	logfuse_log("logfuse_setbkuptime(%s) err=%d", path, sysErr);
+	// Remove the attribute
+	sysErr = removexattr(logfuse_ll_proc_path(ino).c_str(), name);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_removexattr(%llu, %s) err=%d", logfuse_ll_ino(ino), name, theErr);
+
+	fuse_reply_err(req, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_setchgtime : Set the attribute change time.
+//		logfuse_ll_access : Check file access permissions.
 //----------------------------------------------------------------------------
-static int logfuse_setchgtime(const char *path, const timespec *theTime)
+static void logfuse_ll_access(fuse_req_t req, fuse_ino_t ino, int mode)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Set the time
-	sysErr = logfuse_set_timespec(path, ATTR_CMN_CHGTIME, *theTime);
-	logfuse_log("logfuse_setchgtime(%s) err=%d", path, sysErr);
+	// Check the access
+	sysErr = faccessat(AT_FDCWD, logfuse_ll_proc_path(ino).c_str(), mode, 0);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_access(%llu, %s) err=%d",
+					logfuse_ll_ino(ino),
+					logfuse_str_access_mode(mode).c_str(),
+					theErr);
+
+	fuse_reply_err(req, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_setcrtime : Set the creation time.
+//		logfuse_ll_flock : Perform BSD file locking.
 //----------------------------------------------------------------------------
-static int logfuse_setcrtime(const char *path, const timespec *theTime)
+static void logfuse_ll_flock(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fileInfo, int op)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Set the time
-	sysErr = logfuse_set_timespec(path, ATTR_CMN_CRTIME, *theTime);
-	logfuse_log("logfuse_setcrtime(%s) err=%d", path, sysErr);
+	// Lock the file
+	sysErr = flock(logfuse_get_fd(fileInfo), op);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_flock(%llu, %d) err=%d", logfuse_ll_ino(ino), op, theErr);
+
+	fuse_reply_err(req, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_chflags : Set the file flags.
+//		logfuse_ll_fallocate : Allocate space for a file.
 //----------------------------------------------------------------------------
-static int logfuse_chflags(const char *path, uint32_t theFlags)
+static void logfuse_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length, fuse_file_info *fileInfo)
 {	int		sysErr;
+	int		theErr;
 
 
 
-	// Set the flags
-	sysErr = lchflags(path, theFlags);
-	logfuse_log("logfuse_setcrtime(%s) err=%d", path, sysErr);
+	// Allocate the space
+	sysErr = fallocate(logfuse_get_fd(fileInfo), mode, offset, length);
+	theErr = (sysErr == -1) ? errno : 0;
 
-	RETURN_FUSE_ERRNO();
+	logfuse_log("logfuse_ll_fallocate(%llu, %s, %lld, %lld) err=%d",
+					logfuse_ll_ino(ino),
+					logfuse_str_fallocate_mode(mode).c_str(),
+					(long long) offset,
+					(long long) length,
+					theErr);
+
+	fuse_reply_err(req, theErr);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_setattr_x : Set extended attributes.
+//		logfuse_ll_throttle_op : Throttle an operation.
 //----------------------------------------------------------------------------
-static int logfuse_setattr_x(const char *path, struct setattr_x *theAttributes)
-{	int		sysErr;
+template<typename T, int N>
+struct logfuse_ll_throttle_op;
 
+template<typename... A, int N>
+struct logfuse_ll_throttle_op<void (*)(fuse_req_t, A...), N> {
+	static void			(*theFunc)(fuse_req_t, A...);
 
+	static void invoke(fuse_req_t req, A... theArgs)
+	{
 
-	// Set the attributes
-	if (SETATTR_WANTS_MODE(theAttributes))
-		{
-		sysErr = lchmod(path, theAttributes->mode);
-		if (sysErr == -1)
-			goto done;
-		}
-
-	if (SETATTR_WANTS_UID(theAttributes) || SETATTR_WANTS_GID(theAttributes))
-		{
-		sysErr = lchown(path,
-						SETATTR_WANTS_UID(theAttributes) ? theAttributes->uid : -1,
-						SETATTR_WANTS_GID(theAttributes) ? theAttributes->gid : -1);
-		if (sysErr == -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_SIZE(theAttributes))
-		{
-		sysErr = truncate(path, theAttributes->size);
-		if (sysErr != -1)
-			goto done;
-		}
+		// Invoke the operation
+		logfuse_ll_throttle(req, 1, 0);
+		theFunc(req, theArgs...);
+	}
+};
 
-	if (SETATTR_WANTS_ACCTIME(theAttributes))
-		{
-		sysErr = logfuse_set_timespec(path, ATTR_CMN_ACCTIME, theAttributes->acctime);
-		if (sysErr != -1)
-			goto done;
-		}
+template<typename... A, int N>
+void (*logfuse_ll_throttle_op<void (*)(fuse_req_t, A...), N>::theFunc)(fuse_req_t, A...);
 
-	if (SETATTR_WANTS_MODTIME(theAttributes))
-		{
-		sysErr = logfuse_set_timespec(path, ATTR_CMN_MODTIME, theAttributes->modtime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_CRTIME(theAttributes))
-		{
-		sysErr = logfuse_set_timespec(path, ATTR_CMN_CRTIME, theAttributes->crtime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_CHGTIME(theAttributes))
-		{
-		sysErr = logfuse_set_timespec(path, ATTR_CMN_CHGTIME, theAttributes->chgtime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_BKUPTIME(theAttributes))
-		{
-		sysErr = logfuse_set_timespec(path, ATTR_CMN_BKUPTIME, theAttributes->bkuptime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_FLAGS(theAttributes))
-		{
-		sysErr = lchflags(path, theAttributes->flags);
-		if (sysErr != -1)
-			goto done;
-		}
+//============================================================================
+//		logfuse_ll_throttle_ops : Throttle the operations.
+//----------------------------------------------------------------------------
+static void logfuse_ll_throttle_ops(fuse_lowlevel_ops &fuseOps)
+{
 
-done:
-	logfuse_log("logfuse_setattr_x(%s) err=%d", path, sysErr);
 
-	RETURN_FUSE_ERRNO();
+	// Wrap the operations
+	//
+	// Each request is counted as an operation of its caller. Forgets and
+	// releases are sent by the kernel rather than a caller, and are never
+	// throttled.
+	THROTTLE_LL_OP(fuseOps, lookup);
+	THROTTLE_LL_OP(fuseOps, getattr);
+	THROTTLE_LL_OP(fuseOps, setattr);
+	THROTTLE_LL_OP(fuseOps, readlink);
+	THROTTLE_LL_OP(fuseOps, mknod);
+	THROTTLE_LL_OP(fuseOps, mkdir);
+	THROTTLE_LL_OP(fuseOps, unlink);
+	THROTTLE_LL_OP(fuseOps, rmdir);
+	THROTTLE_LL_OP(fuseOps, symlink);
+	THROTTLE_LL_OP(fuseOps, rename);
+	THROTTLE_LL_OP(fuseOps, link);
+	THROTTLE_LL_OP(fuseOps, open);
+	THROTTLE_LL_OP(fuseOps, read);
+	THROTTLE_LL_OP(fuseOps, write);
+	THROTTLE_LL_OP(fuseOps, flush);
+	THROTTLE_LL_OP(fuseOps, fsync);
+	THROTTLE_LL_OP(fuseOps, opendir);
+	THROTTLE_LL_OP(fuseOps, readdir);
+	THROTTLE_LL_OP(fuseOps, fsyncdir);
+	THROTTLE_LL_OP(fuseOps, statfs);
+	THROTTLE_LL_OP(fuseOps, setxattr);
+	THROTTLE_LL_OP(fuseOps, getxattr);
+	THROTTLE_LL_OP(fuseOps, listxattr);
+	THROTTLE_LL_OP(fuseOps, removexattr);
+	THROTTLE_LL_OP(fuseOps, access);
+	THROTTLE_LL_OP(fuseOps, create);
+	THROTTLE_LL_OP(fuseOps, flock);
+	THROTTLE_LL_OP(fuseOps, fallocate);
+	THROTTLE_LL_OP(fuseOps, readdirplus);
 }
-#endif // FUSE_APPLE
 
 
 
 
 
-#if FUSE_APPLE
 //============================================================================
-//		logfuse_fsetattr_x : Set extended attributes.
+//		logfuse_ll_main : Run the low-level filesystem.
 //----------------------------------------------------------------------------
-static int logfuse_fsetattr_x(const char *path, setattr_x *theAttributes, fuse_file_info *fileInfo)
-{	int		sysErr;
+static int logfuse_ll_main(fuse_args *fuseArgs)
+{	fuse_lowlevel_ops		fuseOps;
+	fuse_cmdline_opts		fuseOpts;
+	fuse_session			*fuseSession;
+	struct rlimit			theLimit;
+	struct stat				statInfo;
+	int						sysErr;
 
 
 
-	// Set the attributes
-	if (SETATTR_WANTS_MODE(theAttributes))
-		{
-		sysErr = fchmod(fileInfo->fh, theAttributes->mode);
-		if (sysErr == -1)
-			goto done;
-		}
+	// Initialise ourselves
+	memset(&fuseOps, 0x00, sizeof(fuseOps));
 
-	if (SETATTR_WANTS_UID(theAttributes) || SETATTR_WANTS_GID(theAttributes))
-		{
-		sysErr = fchown(fileInfo->fh,
-						SETATTR_WANTS_UID(theAttributes) ? theAttributes->uid : -1,
-						SETATTR_WANTS_GID(theAttributes) ? theAttributes->gid : -1);
-		if (sysErr == -1)
-			goto done;
-		}
+	fuseOps.init			= logfuse_ll_init;
+	fuseOps.destroy			= logfuse_ll_destroy;
+	fuseOps.lookup			= logfuse_ll_lookup;
+	fuseOps.forget			= logfuse_ll_forget;
+	fuseOps.getattr			= logfuse_ll_getattr;
+	fuseOps.setattr			= logfuse_ll_setattr;
+	fuseOps.readlink		= logfuse_ll_readlink;
+	fuseOps.mknod			= logfuse_ll_mknod;
+	fuseOps.mkdir			= logfuse_ll_mkdir;
+	fuseOps.unlink			= logfuse_ll_unlink;
+	fuseOps.rmdir			= logfuse_ll_rmdir;
+	fuseOps.symlink			= logfuse_ll_symlink;
+	fuseOps.rename			= logfuse_ll_rename;
+	fuseOps.link			= logfuse_ll_link;
+	fuseOps.open			= logfuse_ll_open;
+	fuseOps.read			= logfuse_ll_read;
+	fuseOps.write			= logfuse_ll_write;
+	fuseOps.flush			= logfuse_ll_flush;
+	fuseOps.release			= logfuse_ll_release;
+	fuseOps.fsync			= logfuse_ll_fsync;
+	fuseOps.opendir			= logfuse_ll_opendir;
+	fuseOps.readdir			= logfuse_ll_readdir;
+	fuseOps.releasedir		= logfuse_ll_releasedir;
+	fuseOps.fsyncdir		= logfuse_ll_fsyncdir;
+	fuseOps.statfs			= logfuse_ll_statfs;
+	fuseOps.setxattr		= logfuse_ll_setxattr;
+	fuseOps.getxattr		= logfuse_ll_getxattr;
+	fuseOps.listxattr		= logfuse_ll_listxattr;
+	fuseOps.removexattr		= logfuse_ll_removexattr;
+	fuseOps.access			= logfuse_ll_access;
+	fuseOps.create			= logfuse_ll_create;
+	fuseOps.forget_multi	= logfuse_ll_forget_multi;
+	fuseOps.flock			= logfuse_ll_flock;
+	fuseOps.fallocate		= logfuse_ll_fallocate;
+	fuseOps.readdirplus		= logfuse_ll_readdirplus;
+
+
+
+	// Prepare throttling
+	//
+	// The operations are only wrapped when throttling was given, or could be
+	// loaded later from the config file.
+	if (logfuse_get_settings()->throttleOps != 0 || logfuse_get_settings()->throttleBytes != 0 || !gConfig.configPath.empty())
+		logfuse_ll_throttle_ops(fuseOps);
 
-	if (SETATTR_WANTS_SIZE(theAttributes))
-		{
-		sysErr = ftruncate(fileInfo->fh, theAttributes->size);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_ACCTIME(theAttributes))
-		{
-		sysErr = logfuse_fset_timespec(fileInfo->fh, ATTR_CMN_ACCTIME, theAttributes->acctime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_MODTIME(theAttributes))
+	// Raise the descriptor limit
+	//
+	// Every inode the kernel has looked up holds a descriptor, so the soft
+	// limit is raised to the hard limit to let the kernel hold more of them.
+	if (getrlimit(RLIMIT_NOFILE, &theLimit) == 0 && theLimit.rlim_cur < theLimit.rlim_max)
 		{
-		sysErr = logfuse_fset_timespec(fileInfo->fh, ATTR_CMN_MODTIME, theAttributes->modtime);
-		if (sysErr != -1)
-			goto done;
+		theLimit.rlim_cur = theLimit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &theLimit) != 0)
+			fprintf(stderr, "logfuse: unable to raise descriptor limit: %s\n", strerror(errno));
 		}
 
-	if (SETATTR_WANTS_CRTIME(theAttributes))
-		{
-		sysErr = logfuse_fset_timespec(fileInfo->fh, ATTR_CMN_CRTIME, theAttributes->crtime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_CHGTIME(theAttributes))
-		{
-		sysErr = logfuse_fset_timespec(fileInfo->fh, ATTR_CMN_CHGTIME, theAttributes->chgtime);
-		if (sysErr != -1)
-			goto done;
-		}
 
-	if (SETATTR_WANTS_BKUPTIME(theAttributes))
+	// Prepare the root
+	//
+	// Without a root option the whole file system is passed through, as the
+	// high-level frontend does with full paths.
+	gInodes.theRoot.fd      = (gRootFd != AT_FDCWD) ? gRootFd : open("/", ROOT_OPEN_FLAGS);
+	gInodes.theRoot.nlookup = 1;
+
+	if (gInodes.theRoot.fd == -1 || fstat(gInodes.theRoot.fd, &statInfo) == -1)
 		{
-		sysErr = logfuse_fset_timespec(fileInfo->fh, ATTR_CMN_BKUPTIME, theAttributes->bkuptime);
-		if (sysErr != -1)
-			goto done;
+		fprintf(stderr, "logfuse: unable to open root: %s\n", strerror(errno));
+		return(1);
 		}
 
-	if (SETATTR_WANTS_FLAGS(theAttributes))
+	gInodes.theRoot.fileID.dev = statInfo.st_dev;
+	gInodes.theRoot.fileID.ino = statInfo.st_ino;
+
+
+
+	// Parse the command line
+	if (!logfuse_parse_cmdline(fuseArgs, &fuseOpts, &sysErr))
+		return(sysErr);
+
+
+
+	// Run the filesystem
+	sysErr      = 1;
+	fuseSession = fuse_session_new(fuseArgs, &fuseOps, sizeof(fuseOps), nullptr);
+
+	if (fuseSession != nullptr)
 		{
-		sysErr = fchflags(fileInfo->fh, theAttributes->flags);
-		if (sysErr != -1)
-			goto done;
+		if (fuse_set_signal_handlers(fuseSession) == 0)
+			{
+			if (fuse_session_mount(fuseSession, fuseOpts.mountpoint) == 0)
+				{
+				fuse_daemonize(fuseOpts.foreground);
+
+				sysErr = logfuse_session_loop(fuseSession, fuseOpts);
+
+				fuse_session_unmount(fuseSession);
+				}
+
+			fuse_remove_signal_handlers(fuseSession);
+			}
+
+		fuse_session_destroy(fuseSession);
 		}
 
-done:
-	logfuse_log("logfuse_setattr_x(%s) err=%d", path, sysErr);
+	free(fuseOpts.mountpoint);
 
-	RETURN_FUSE_ERRNO();
+	return(sysErr == 0 ? 0 : 1);
 }
-#endif // FUSE_APPLE
+#endif // FUSE_USE_VERSION >= 30 && defined(__linux__)
 
 
 
@@ -1662,6 +10365,10 @@ done:
 int main(int argc, char **argv)
 {	fuse_args			fuseArgs = FUSE_ARGS_INIT(argc, argv);
 	fuse_operations		fuseOps;
+	logfuse_config		theConfig;
+	sigset_t			theSignals;
+	bool				hasRules;
+	bool				hasThrottle;
 	int					sysErr;
 
 
@@ -1669,20 +10376,37 @@ int main(int argc, char **argv)
 	// Initialise ourselves
 	memset(&fuseOps, 0x00, sizeof(fuseOps));
 
+#if FUSE_USE_VERSION >= 30
+	fuseOps.getattr			= logfuse3_getattr;
+	fuseOps.rename			= logfuse3_rename;
+	fuseOps.chmod			= logfuse3_chmod;
+	fuseOps.chown			= logfuse3_chown;
+	fuseOps.truncate		= logfuse3_truncate;
+	fuseOps.init			= logfuse3_init;
+	fuseOps.utimens			= logfuse3_utimens;
+//	fuseOps.ftruncate		= -> truncate
+//	fuseOps.fgetattr		= -> getattr
+#else
 	fuseOps.getattr			= logfuse_getattr;
-	fuseOps.readlink		= logfuse_readlink;
+	fuseOps.rename			= logfuse_rename;
+	fuseOps.chmod			= logfuse_chmod;
+	fuseOps.chown			= logfuse_chown;
+	fuseOps.truncate		= logfuse_truncate;
+	fuseOps.init			= logfuse_init;
+	fuseOps.utimens			= logfuse_utimens;
+	fuseOps.ftruncate		= logfuse_ftruncate;
+	fuseOps.fgetattr		= logfuse_fgetattr;
 //	fuseOps.getdir			= -> readdir
+//	fuseOps.utime			= -> utimens
+#endif
+
+	fuseOps.readlink		= logfuse_readlink;
 	fuseOps.mknod			= logfuse_mknod;
 	fuseOps.mkdir			= logfuse_mkdir;
 	fuseOps.unlink			= logfuse_unlink;
 	fuseOps.rmdir			= logfuse_rmdir;
 	fuseOps.symlink			= logfuse_symlink;
-	fuseOps.rename			= logfuse_rename;
 	fuseOps.link			= logfuse_link;
-	fuseOps.chmod			= logfuse_chmod;
-	fuseOps.chown			= logfuse_chown;
-	fuseOps.truncate		= logfuse_truncate;
-//	fuseOps.utime			= -> utimens
 	fuseOps.open			= logfuse_open;
 	fuseOps.read			= logfuse_read;
 	fuseOps.write			= logfuse_write;
@@ -1698,14 +10422,10 @@ int main(int argc, char **argv)
 	fuseOps.readdir			= logfuse_readdir;
 	fuseOps.releasedir		= logfuse_releasedir;
 	fuseOps.fsyncdir		= logfuse_fsyncdir;
-	fuseOps.init			= logfuse_init;
 	fuseOps.destroy			= logfuse_destroy;
 	fuseOps.access			= logfuse_access;
 	fuseOps.create			= logfuse_create;
-	fuseOps.ftruncate		= logfuse_ftruncate;
-	fuseOps.fgetattr		= logfuse_fgetattr;
 	fuseOps.lock			= logfuse_lock;
-	fuseOps.utimens			= logfuse_utimens;
 //	fuseOps.bmap			= Block device only
 	fuseOps.ioctl			= logfuse_ioctl;
 	fuseOps.poll			= logfuse_poll;
@@ -1714,6 +10434,11 @@ int main(int argc, char **argv)
 	fuseOps.flock			= logfuse_flock;
 	fuseOps.fallocate		= logfuse_fallocate;
 
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	fuseOps.copy_file_range	= logfuse_copy_file_range;
+	fuseOps.lseek			= logfuse_lseek;
+#endif
+
 #if FUSE_APPLE
 	fuseOps.setvolname		= logfuse_setvolname;
 	fuseOps.exchange		= logfuse_exchange;
@@ -1728,12 +10453,132 @@ int main(int argc, char **argv)
 
 
 
-	// Run the filesystem
+	// Parse the options
+	//
+	// The settings given at mount time are published before any config file
+	// is loaded, as the file is applied over them.
+	//
+	// Every option in the file applies when it is first loaded. The settings
+	// given at mount time are kept as the base for later reloads.
 	umask(0);
 
-	sysErr = fuse_opt_parse(&fuseArgs, nullptr, nullptr, nullptr);
+	gConfig.settings.cacheDefault  = kCachePolicyDefault;
+	gConfig.settings.logAllOps     = true;
+	gConfig.settings.logSample     = 1;
+	gConfig.settings.throttleBurst = kThrottleBurst;
+	gConfig.contentCacheMax        = kContentCacheMaxFile;
+	gConfig.tierThreshold          = kTierThreshold;
+	gConfig.attrTimeout            = -1.0;
+	gConfig.entryTimeout           = -1.0;
+	gConfig.negativeTimeout        = -1.0;
+
+	sysErr = fuse_opt_parse(&fuseArgs, &gConfig, kLogfuseOptions, logfuse_opt_proc);
+
+	if (sysErr == 0 && !logfuse_settings_publish(gConfig.settings))
+		{
+		fprintf(stderr, "logfuse: unable to open log sink '%s': %s\n", gConfig.settings.logSink.c_str(), strerror(errno));
+		return(1);
+		}
+
+	if (sysErr == 0 && !gConfig.configPath.empty())
+		{
+		if (!logfuse_config_load(gConfig.configPath.c_str(), theConfig) || !logfuse_settings_publish(theConfig.settings))
+			{
+			fprintf(stderr, "logfuse: unable to load config '%s'\n", gConfig.configPath.c_str());
+			return(1);
+			}
+
+		theConfig.settings = gConfig.settings;
+		gConfig            = theConfig;
+		}
+
+
+
+	// Prepare fault injection
+	//
+	// The operations are only wrapped when rules or throttling were given, or
+	// could be loaded later from the config file. The low-level frontend
+	// replies from within each operation, so can't have errors injected after
+	// its calls, and wraps its own operations for throttling.
+	hasRules    = (sysErr == 0 && (!logfuse_get_settings()->delayRules.empty() || !logfuse_get_settings()->faultRules.empty()));
+	hasThrottle = (sysErr == 0 && (logfuse_get_settings()->throttleOps != 0 || logfuse_get_settings()->throttleBytes != 0));
+
+	if (hasRules && gConfig.lowLevel)
+		{
+		fprintf(stderr, "logfuse: delay and fault rules are not supported with lowlevel\n");
+		return(1);
+		}
+
+#if FUSE_USE_VERSION >= 30 && !defined(__linux__)
+	if (!gConfig.mounts.empty())
+#else
+	if (!gConfig.mounts.empty() && gConfig.lowLevel)
+#endif
+		{
+		fprintf(stderr, "logfuse: extra mounts are not supported with this frontend\n");
+		return(1);
+		}
+
+	if ((hasRules || hasThrottle || (sysErr == 0 && !gConfig.configPath.empty())) && !gConfig.lowLevel)
+		logfuse_inject_ops(fuseOps);
+
+
+
+	// Prepare our signals
+	//
+	// Our signals are blocked before FUSE creates any threads, so that they
+	// are only delivered to our signal thread.
+	//
+	// SIGHUP normally unmounts the filesystem, so it is only taken over when
+	// there is a config file to reload.
+	sigemptyset(&theSignals);
+	sigaddset(  &theSignals, SIGUSR1);
+
+	if (!gConfig.configPath.empty())
+		sigaddset(&theSignals, SIGHUP);
+
+	pthread_sigmask(SIG_BLOCK, &theSignals, nullptr);
+
+
+
+	// Open the root
+	if (sysErr == 0 && !gConfig.rootPath.empty())
+		{
+		gRootFd = open(gConfig.rootPath.c_str(), ROOT_OPEN_FLAGS);
+		if (gRootFd == -1)
+			{
+			fprintf(stderr, "logfuse: unable to open root '%s': %s\n", gConfig.rootPath.c_str(), strerror(errno));
+			return(1);
+			}
+		}
+
+	if (sysErr == 0 && !gConfig.tierPath.empty() && !logfuse_tier_prepare())
+		{
+		fprintf(stderr, "logfuse: unable to open tier '%s': %s\n", gConfig.tierPath.c_str(), strerror(errno));
+		return(1);
+		}
+
+	if (sysErr == 0 && !logfuse_mounts_prepare(&fuseArgs, &fuseOps))
+		return(1);
+
+#if FUSE_USE_VERSION >= 30 && defined(__linux__)
+	if (sysErr == 0 && gConfig.lowLevel)
+		{
+		sysErr = logfuse_ll_main(&fuseArgs);
+		fuse_opt_free_args(&fuseArgs);
+		return(sysErr);
+		}
+
+	if (sysErr == 0 && (gConfig.maxThreads != 0 || gConfig.pinThreads))
+		{
+		sysErr = logfuse3_main(&fuseArgs, &fuseOps);
+		fuse_opt_free_args(&fuseArgs);
+		return(sysErr);
+		}
+#endif
+
 	if (sysErr == 0)
-		sysErr = fuse_main(fuseArgs.argc, fuseArgs.argv, &fuseOps, nullptr);
+		sysErr = fuse_main(fuseArgs.argc, fuseArgs.argv, &fuseOps, logfuse_mounts_primary());
 	
     return(sysErr);
 }